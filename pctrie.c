@@ -25,377 +25,2026 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include "pctrie.h"
+#include "pctrie_internal.h"
 
-#define BIT_TEST(k, b)  ((k) & (0x80000000ULL >> (b)))
-#define BIT_PREFIX(k, b)    (((uint64_t)(k) >> (32 - (b))) << (32 - (b)))
+#define NODE(trie, i)       (&(trie)->arena.nodes[(i)])
+
+/* Number of the subtree locks; the arena lock follows them */
+#define _NLOCKS             (1 << PATH_COMPRESSED_TRIE_LOCK_BITS)
+#define ARENA_LOCK(trie)    (&(trie)->locks[_NLOCKS])
+
+static uint32_t _pin_levels(struct path_compressed_trie *, uint32_t, int);
+
+/*
+ * Commit a new slab of the arena
+ */
+static int
+_arena_grow(struct path_compressed_trie_arena *arena)
+{
+    size_t n;
+
+    n = PATH_COMPRESSED_TRIE_SLAB_NODES;
+    if ( arena->committed + n > PATH_COMPRESSED_TRIE_MAX_NODES ) {
+        return -1;
+    }
+    if ( 0 != mprotect(arena->nodes + arena->committed,
+                       sizeof(struct path_compressed_trie_node) * n,
+                       PROT_READ | PROT_WRITE) ) {
+        return -1;
+    }
+    if ( 0 != mprotect(arena->data + arena->committed, sizeof(void *) * n,
+                       PROT_READ | PROT_WRITE) ) {
+        return -1;
+    }
+    arena->committed += n;
+
+    return 0;
+}
+
+/*
+ * Release the address space of the arena
+ */
+static void
+_arena_release(struct path_compressed_trie_arena *arena)
+{
+    munmap(arena->nodes, sizeof(struct path_compressed_trie_node)
+           * PATH_COMPRESSED_TRIE_MAX_NODES);
+    munmap(arena->data, sizeof(void *) * PATH_COMPRESSED_TRIE_MAX_NODES);
+}
+
+/*
+ * Reserve the address space for the arena
+ */
+static int
+_arena_init(struct path_compressed_trie_arena *arena)
+{
+    memset(arena, 0, sizeof(struct path_compressed_trie_arena));
+
+    arena->nodes = mmap(NULL, sizeof(struct path_compressed_trie_node)
+                        * PATH_COMPRESSED_TRIE_MAX_NODES, PROT_NONE,
+                        MAP_PRIVATE | MAP_ANON, -1, 0);
+    if ( MAP_FAILED == arena->nodes ) {
+        return -1;
+    }
+    arena->data = mmap(NULL, sizeof(void *) * PATH_COMPRESSED_TRIE_MAX_NODES,
+                       PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if ( MAP_FAILED == arena->data ) {
+        munmap(arena->nodes, sizeof(struct path_compressed_trie_node)
+               * PATH_COMPRESSED_TRIE_MAX_NODES);
+        return -1;
+    }
+
+    /* Commit the first slab; the index 0 is reserved for NULL */
+    if ( _arena_grow(arena) < 0 ) {
+        _arena_release(arena);
+        return -1;
+    }
+    arena->carved = 1;
+
+    return 0;
+}
+
+/*
+ * Acquire a spinlock; yield while it is contended so that the holder can run
+ */
+static __inline__ void
+_lock(struct path_compressed_trie_lock *l)
+{
+    while ( __atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE) ) {
+        while ( __atomic_load_n(&l->locked, __ATOMIC_RELAXED) ) {
+            sched_yield();
+        }
+    }
+}
+
+/*
+ * Release a spinlock
+ */
+static __inline__ void
+_unlock(struct path_compressed_trie_lock *l)
+{
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * Lock the arena and the epochs if the writers are concurrent
+ */
+static __inline__ void
+_arena_lock(struct path_compressed_trie *trie)
+{
+    if ( NULL != trie->locks ) {
+        _lock(ARENA_LOCK(trie));
+    }
+}
+static __inline__ void
+_arena_unlock(struct path_compressed_trie *trie)
+{
+    if ( NULL != trie->locks ) {
+        _unlock(ARENA_LOCK(trie));
+    }
+}
+
+/*
+ * Lock the subtrees that the update of the prefix may modify: the one
+ * selected by the top bits of the key, or all the subtrees under a prefix
+ * shorter than PATH_COMPRESSED_TRIE_LOCK_BITS (in order to avoid deadlocks)
+ */
+static void
+_subtree_lock(struct path_compressed_trie *trie, uint32_t key, int prefixlen,
+              int acquire)
+{
+    uint32_t first;
+    uint32_t n;
+    uint32_t i;
+
+    if ( NULL == trie->locks ) {
+        return;
+    }
+    first = (key & PREFIX_MASK(prefixlen))
+        >> (32 - PATH_COMPRESSED_TRIE_LOCK_BITS);
+    n = prefixlen >= PATH_COMPRESSED_TRIE_LOCK_BITS
+        ? 1 : (1U << (PATH_COMPRESSED_TRIE_LOCK_BITS - prefixlen));
+    for ( i = 0; i < n; i++ ) {
+        if ( acquire ) {
+            _lock(&trie->locks[first + i]);
+        } else {
+            _unlock(&trie->locks[first + n - 1 - i]);
+        }
+    }
+}
+
+/*
+ * Initialize the epoch-based reclamation
+ */
+static int
+_epoch_init(struct path_compressed_trie_epoch *epoch)
+{
+    int ret;
+
+    ret = posix_memalign((void **)&epoch->readers,
+                         sizeof(struct path_compressed_trie_reader),
+                         sizeof(struct path_compressed_trie_reader)
+                         * PATH_COMPRESSED_TRIE_MAX_READERS);
+    if ( 0 != ret ) {
+        return -1;
+    }
+    memset(epoch->readers, 0, sizeof(struct path_compressed_trie_reader)
+           * PATH_COMPRESSED_TRIE_MAX_READERS);
+    memset(epoch->limbo, 0, sizeof(epoch->limbo));
+    epoch->nreaders = 0;
+    epoch->retired = 0;
+    /* The epoch 0 is reserved for the quiescent readers */
+    epoch->global = 1;
+
+    return 0;
+}
+
+/*
+ * Release the epoch-based reclamation; the retired nodes are released with
+ * the arena
+ */
+static void
+_epoch_release(struct path_compressed_trie_epoch *epoch)
+{
+    int i;
+
+    for ( i = 0; i < 3; i++ ) {
+        free(epoch->limbo[i].nodes);
+    }
+    free(epoch->readers);
+}
+
+/*
+ * Initialize the data structure for path-compressed trie
+ */
+struct path_compressed_trie *
+path_compressed_trie_init(struct path_compressed_trie *trie)
+{
+    return path_compressed_trie_init_flags(trie, 0);
+}
+
+/*
+ * Initialize the data structure for path-compressed trie with the flags
+ */
+struct path_compressed_trie *
+path_compressed_trie_init_flags(struct path_compressed_trie *trie, int flags)
+{
+    if ( NULL == trie ) {
+        /* Allocate new data structure */
+        trie = malloc(sizeof(struct path_compressed_trie));
+        if ( NULL == trie ) {
+            return NULL;
+        }
+        trie->_allocated = 1;
+    } else {
+        trie->_allocated = 0;
+    }
+
+    /* Set NULL to the root node */
+    trie->root = 0;
+    trie->generation = 0;
+
+    /* Initialize the arena */
+    if ( _arena_init(&trie->arena) < 0 ) {
+        if ( trie->_allocated ) {
+            free(trie);
+        }
+        return NULL;
+    }
+
+    /* Reader slots of the epoch-based reclamation */
+    if ( _epoch_init(&trie->epoch) < 0 ) {
+        _arena_release(&trie->arena);
+        if ( trie->_allocated ) {
+            free(trie);
+        }
+        return NULL;
+    }
+
+    /* Front table; all the entries are initially final without prefix */
+    trie->front = NULL;
+    trie->front_spare = NULL;
+    trie->front_bits = 0;
+    if ( flags & PATH_COMPRESSED_TRIE_FRONT_24 ) {
+        trie->front_bits = 24;
+    } else if ( flags & PATH_COMPRESSED_TRIE_FRONT_16 ) {
+        trie->front_bits = 16;
+    }
+    if ( trie->front_bits > 0 ) {
+        trie->front = calloc((size_t)1 << trie->front_bits,
+                             sizeof(struct path_compressed_trie_front_entry));
+        if ( NULL == trie->front ) {
+            _epoch_release(&trie->epoch);
+            _arena_release(&trie->arena);
+            if ( trie->_allocated ) {
+                free(trie);
+            }
+            return NULL;
+        }
+    }
+
+    /* Subtree locks and the pinned top levels for the concurrent writers */
+    trie->locks = NULL;
+    if ( flags & PATH_COMPRESSED_TRIE_CONCURRENT ) {
+        if ( 0 != posix_memalign((void **)&trie->locks,
+                                 sizeof(struct path_compressed_trie_lock),
+                                 sizeof(struct path_compressed_trie_lock)
+                                 * (_NLOCKS + 1)) ) {
+            trie->locks = NULL;
+            path_compressed_trie_release(trie);
+            return NULL;
+        }
+        memset(trie->locks, 0,
+               sizeof(struct path_compressed_trie_lock) * (_NLOCKS + 1));
+        trie->root = _pin_levels(trie, 0, 0);
+        if ( 0 == trie->root ) {
+            path_compressed_trie_release(trie);
+            return NULL;
+        }
+    }
+
+    return trie;
+}
+
+/*
+ * Release the path-compressed trie
+ */
+void
+path_compressed_trie_release(struct path_compressed_trie *trie)
+{
+    /* Release all the slabs at once instead of traversing the nodes */
+    _arena_release(&trie->arena);
+    _epoch_release(&trie->epoch);
+    free(trie->front);
+    free(trie->front_spare);
+    free(trie->locks);
+    if ( trie->_allocated ) {
+        free(trie);
+    }
+}
+
+/*
+ * Lookup the data corresponding to the key specified by the argument
+ */
+void *
+path_compressed_trie_lookup(struct path_compressed_trie *trie, uint32_t key)
+{
+    struct path_compressed_trie_front_entry *front;
+    struct path_compressed_trie_front_entry e;
+
+    front = LOAD_ACQUIRE(&trie->front);
+    if ( NULL != front ) {
+        /* Resume the walk from the node in the front table entry */
+        __atomic_load(&front[key >> (32 - trie->front_bits)], &e,
+                      __ATOMIC_ACQUIRE);
+        return trie->arena.data[_pctrie_walk(trie->arena.nodes, e.node,
+                                             e.cand, key)];
+    }
+
+    /* The data of the index 0 is NULL */
+    return trie->arena.data[_pctrie_walk(trie->arena.nodes,
+                                         LOAD_ACQUIRE(&trie->root), 0, key)];
+}
+
+/*
+ * Start a lookup in a lane of the batched lookup
+ */
+static __inline__ void
+_batch_start(struct path_compressed_trie *trie, uint32_t key, uint32_t *idx,
+             uint32_t *cand)
+{
+    struct path_compressed_trie_front_entry *front;
+    struct path_compressed_trie_front_entry e;
+
+    front = LOAD_ACQUIRE(&trie->front);
+    if ( NULL != front ) {
+        __atomic_load(&front[key >> (32 - trie->front_bits)], &e,
+                      __ATOMIC_ACQUIRE);
+        *idx = e.node;
+        *cand = e.cand;
+    } else {
+        *idx = LOAD_ACQUIRE(&trie->root);
+        *cand = 0;
+    }
+    __builtin_prefetch(&trie->arena.nodes[*idx]);
+}
+
+/*
+ * Lookup a batch of keys.  PATH_COMPRESSED_TRIE_BATCH_WIDTH lookups advance in
+ * lockstep (asynchronous memory access chaining): each lookup prefetches its
+ * next node and yields to the others, so that the cache misses of the
+ * independent lookups overlap instead of stalling one by one.  A lane that
+ * completes its lookup is refilled with the next key.
+ */
+void
+path_compressed_trie_lookup_batch(struct path_compressed_trie *trie,
+                                  const uint32_t *keys, void **out, size_t n)
+{
+    struct path_compressed_trie_node *nodes;
+    struct path_compressed_trie_node *cur;
+    uint32_t idx[PATH_COMPRESSED_TRIE_BATCH_WIDTH];
+    uint32_t cand[PATH_COMPRESSED_TRIE_BATCH_WIDTH];
+    size_t pos[PATH_COMPRESSED_TRIE_BATCH_WIDTH];
+    size_t next;
+    int width;
+    int active;
+    int l;
+    uint32_t key;
+    uint32_t i;
+
+    nodes = trie->arena.nodes;
+
+    /* Start the first lookups */
+    for ( l = 0; l < PATH_COMPRESSED_TRIE_BATCH_WIDTH && (size_t)l < n; l++ ) {
+        pos[l] = l;
+        _batch_start(trie, keys[l], &idx[l], &cand[l]);
+    }
+    width = l;
+    active = l;
+    next = l;
+
+    while ( active > 0 ) {
+        for ( l = 0; l < width; l++ ) {
+            if ( pos[l] >= n ) {
+                /* This lane has completed */
+                continue;
+            }
+            key = keys[pos[l]];
+            i = idx[l];
+            cur = &nodes[i];
+            if ( 0 != i
+                 && 0 == ((key ^ cur->key) & PREFIX_MASK(cur->prefixlen)) ) {
+                if ( LOAD_ACQUIRE(&cur->valid) ) {
+                    cand[l] = i;
+                }
+                i = LOAD_ACQUIRE(&cur->child[NEXT_BIT(key, cur->prefixlen)]);
+                if ( 0 != i ) {
+                    /* Prefetch the next node and yield */
+                    idx[l] = i;
+                    __builtin_prefetch(&nodes[i]);
+                    continue;
+                }
+            }
+
+            /* Completed */
+            out[pos[l]] = trie->arena.data[cand[l]];
+            if ( next < n ) {
+                /* Refill the lane with the next key */
+                pos[l] = next++;
+                _batch_start(trie, keys[pos[l]], &idx[l], &cand[l]);
+            } else {
+                pos[l] = n;
+                active--;
+            }
+        }
+    }
+}
+
+/*
+ * Compute the position of the first bit differing between the prefixes with
+ * XOR and count-leading-zeros over the keys masked by the shorter prefix; it
+ * is the shorter prefix length if one covers the other, and -1 if they are
+ * the same prefix
+ */
+static __inline__ int
+_diff(uint32_t key0, int plen0, uint32_t key1, int plen1)
+{
+    uint32_t x;
+    int plen;
+
+    plen = plen0 < plen1 ? plen0 : plen1;
+    x = (key0 ^ key1) & PREFIX_MASK(plen);
+    if ( 0 != x ) {
+        return __builtin_clz(x);
+    }
+
+    return plen0 == plen1 ? -1 : plen;
+}
+
+/*
+ * Allocate a node from the arena
+ */
+static uint32_t
+_alloc_node(struct path_compressed_trie_arena *arena)
+{
+    uint32_t n;
+
+    if ( 0 != arena->free ) {
+        /* Reuse a released node */
+        n = arena->free;
+        arena->free = arena->nodes[n].child[0];
+        arena->nfree--;
+    } else {
+        if ( arena->carved == arena->committed ) {
+            /* Commit a new slab */
+            if ( _arena_grow(arena) < 0 ) {
+                return 0;
+            }
+        }
+        /* Carve a node from the last slab */
+        n = arena->carved++;
+    }
+    arena->nused++;
+    arena->allocs++;
+
+    return n;
+}
+
+/*
+ * Release a node to the free list of the arena
+ */
+static void
+_free_node(struct path_compressed_trie_arena *arena, uint32_t n)
+{
+    arena->nodes[n].child[0] = arena->free;
+    arena->data[n] = NULL;
+    arena->free = n;
+    arena->nfree++;
+    arena->nused--;
+    arena->frees++;
+}
+
+/*
+ * Release a node that has never been published to the readers
+ */
+static void
+_release_node(struct path_compressed_trie *trie, uint32_t n)
+{
+    _arena_lock(trie);
+    _free_node(&trie->arena, n);
+    _arena_unlock(trie);
+}
+
+/*
+ * Scan the readers and advance the global epoch if all the active readers
+ * have observed the current one; then the nodes retired two epochs ago are
+ * unreachable and released to the arena
+ */
+static int
+_epoch_advance(struct path_compressed_trie *trie)
+{
+    struct path_compressed_trie_epoch *epoch;
+    struct path_compressed_trie_limbo *limbo;
+    uint64_t e;
+    size_t i;
+    int nreaders;
+
+    epoch = &trie->epoch;
+
+    /* Order the unlinks before the scan of the readers */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    nreaders = LOAD_ACQUIRE(&epoch->nreaders);
+    for ( i = 0; i < (size_t)nreaders; i++ ) {
+        e = LOAD_ACQUIRE(&epoch->readers[i].epoch);
+        if ( 0 != e && e != epoch->global ) {
+            /* A reader is still in the previous epoch */
+            return -1;
+        }
+    }
+    STORE_RELEASE(&epoch->global, epoch->global + 1);
+
+    limbo = &epoch->limbo[(epoch->global + 1) % 3];
+    for ( i = 0; i < limbo->n; i++ ) {
+        _free_node(&trie->arena, limbo->nodes[i]);
+    }
+    epoch->retired -= limbo->n;
+    limbo->n = 0;
+
+    return 0;
+}
+
+/*
+ * Release the retired nodes as far as the readers allow without waiting
+ */
+static void
+_epoch_reclaim(struct path_compressed_trie *trie)
+{
+    int i;
+
+    _arena_lock(trie);
+    for ( i = 0; i < 2 && trie->epoch.retired > 0; i++ ) {
+        if ( _epoch_advance(trie) < 0 ) {
+            break;
+        }
+    }
+    _arena_unlock(trie);
+}
+
+/*
+ * Retire a node unlinked from the trie; the concurrent readers may still be
+ * walking through it
+ */
+static void
+_retire_node(struct path_compressed_trie *trie, uint32_t n)
+{
+    struct path_compressed_trie_limbo *limbo;
+    uint32_t *nodes;
+    size_t size;
+
+    _arena_lock(trie);
+    limbo = &trie->epoch.limbo[trie->epoch.global % 3];
+    if ( limbo->n == limbo->size ) {
+        size = limbo->size ? limbo->size * 2 : 1024;
+        nodes = realloc(limbo->nodes, sizeof(uint32_t) * size);
+        if ( NULL == nodes ) {
+            /* Wait for the readers instead */
+            _arena_unlock(trie);
+            path_compressed_trie_synchronize(trie);
+            _release_node(trie, n);
+            return;
+        }
+        limbo->nodes = nodes;
+        limbo->size = size;
+    }
+    limbo->nodes[limbo->n++] = n;
+    trie->epoch.retired++;
+    _arena_unlock(trie);
+}
+
+/*
+ * Create a new node
+ */
+static uint32_t
+_new_node(struct path_compressed_trie *trie, uint32_t key, int prefixlen,
+          void *data)
+{
+    struct path_compressed_trie_node *n;
+    uint32_t idx;
+
+    _arena_lock(trie);
+    idx = _alloc_node(&trie->arena);
+    _arena_unlock(trie);
+    if ( 0 == idx ) {
+        return 0;
+    }
+    n = NODE(trie, idx);
+    n->bit = -1;
+    n->flags = 0;
+    n->child[0] = 0;
+    n->child[1] = 0;
+    n->key = key;
+    n->prefixlen = prefixlen;
+    n->valid = (NULL != data);
+    trie->arena.data[idx] = data;
+
+    return idx;
+}
+
+/*
+ * Build the levels of the trie above the subtrees of the concurrent writers
+ * as branching nodes without data, so that the writers never modify the
+ * structure shared by them
+ */
+static uint32_t
+_pin_levels(struct path_compressed_trie *trie, uint32_t key, int depth)
+{
+    struct path_compressed_trie_node *n;
+    uint32_t idx;
+    uint32_t c;
+    int i;
+
+    idx = _new_node(trie, key, depth, NULL);
+    if ( 0 == idx ) {
+        return 0;
+    }
+    n = NODE(trie, idx);
+    n->bit = depth;
+    n->flags = PATH_COMPRESSED_TRIE_NODE_PINNED;
+    if ( depth + 1 < PATH_COMPRESSED_TRIE_LOCK_BITS ) {
+        for ( i = 0; i < 2; i++ ) {
+            c = _pin_levels(trie, key | ((uint32_t)i << (31 - depth)),
+                            depth + 1);
+            if ( 0 == c ) {
+                return 0;
+            }
+            n->child[i] = c;
+        }
+    }
+
+    return idx;
+}
+
+/*
+ * Set the entries of the front table of the slices in the block of the keys
+ * sharing the top len bits with the key
+ */
+static void
+_front_set(struct path_compressed_trie *trie,
+           struct path_compressed_trie_front_entry *front, uint32_t key,
+           int len, uint32_t resume, uint32_t cand)
+{
+    struct path_compressed_trie_front_entry e;
+    uint64_t first;
+    uint64_t n;
+    uint64_t i;
+    int bits;
+
+    bits = trie->front_bits;
+    first = key >> (32 - bits);
+    n = 1ULL << (bits - len);
+    e.node = resume;
+    e.cand = cand;
+    for ( i = 0; i < n; i++ ) {
+        /* Replace the entry at once for the concurrent readers */
+        __atomic_store(&front[first + i], &e, __ATOMIC_RELEASE);
+    }
+}
+
+/*
+ * Recompute the entries of the front table of the block of the keys sharing
+ * the top len (<= front_bits) bits with the key, walking from the node idx
+ * under the longest prefix cand above it.  The nodes covering the block are
+ * descended once, and the block is split in halves only where a more
+ * specific node is in it; the other blocks are filled at once.
+ */
+static void
+_front_fill(struct path_compressed_trie *trie,
+            struct path_compressed_trie_front_entry *front, uint32_t idx,
+            uint32_t cand, uint32_t key, int len)
+{
+    struct path_compressed_trie_node *n;
+    int bits;
+
+    bits = trie->front_bits;
+    while ( 0 != idx ) {
+        n = NODE(trie, idx);
+        if ( (key ^ n->key)
+             & PREFIX_MASK(n->prefixlen < len ? n->prefixlen : len) ) {
+            /* No more specific prefix in the block */
+            break;
+        }
+        if ( n->prefixlen < len ) {
+            /* The node covers the block */
+            if ( n->valid ) {
+                cand = idx;
+            }
+            idx = n->child[NEXT_BIT(key, n->prefixlen)];
+            continue;
+        }
+        if ( len == bits ) {
+            /* A slice with the node in or below it */
+            if ( n->prefixlen == bits && n->bit < 0 ) {
+                /* The prefix of the slice itself */
+                if ( n->valid ) {
+                    cand = idx;
+                }
+                break;
+            }
+            /* Resume the walk from this node */
+            _front_set(trie, front, key, len, idx, cand);
+            return;
+        }
+        /* Split the block */
+        if ( n->prefixlen == len ) {
+            if ( n->valid ) {
+                cand = idx;
+            }
+            _front_fill(trie, front, n->child[0], cand, key, len + 1);
+            _front_fill(trie, front, n->child[1], cand,
+                        key | ((uint32_t)1 << (31 - len)), len + 1);
+        } else {
+            _front_fill(trie, front, idx, cand, key, len + 1);
+            _front_fill(trie, front, idx, cand,
+                        key | ((uint32_t)1 << (31 - len)), len + 1);
+        }
+        return;
+    }
+    _front_set(trie, front, key, len, 0, cand);
+}
+
+/*
+ * Update the entries covered by the prefix in the front table, walking from
+ * the root
+ */
+static void
+_front_range(struct path_compressed_trie *trie,
+             struct path_compressed_trie_front_entry *front, uint32_t root,
+             uint32_t key, int prefixlen)
+{
+    int len;
+
+    len = prefixlen < trie->front_bits ? prefixlen : trie->front_bits;
+    _front_fill(trie, front, root, 0, key & PREFIX_MASK(len), len);
+}
+
+/*
+ * Update the front table entries covered by the prefix, in the spare table as
+ * well to keep it in sync
+ */
+static void
+_front_update(struct path_compressed_trie *trie, uint32_t key, int prefixlen)
+{
+    _front_range(trie, trie->front, trie->root, key, prefixlen);
+    if ( NULL != trie->front_spare ) {
+        _front_range(trie, trie->front_spare, trie->root, key, prefixlen);
+    }
+}
+
+/*
+ * Bump the generation after the update is published
+ */
+static __inline__ void
+_generation_bump(struct path_compressed_trie *trie)
+{
+    __atomic_add_fetch(&trie->generation, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Add a data value under the link cur; the number of the nodes linked is set
+ * to nlinked
+ */
+static int
+_add(struct path_compressed_trie *trie, uint32_t *cur, uint32_t key,
+     int prefixlen, void *data, size_t *nlinked)
+{
+    struct path_compressed_trie_node *p;
+    uint32_t n;
+    uint32_t c;
+    int d;
+
+    *nlinked = 0;
+    for ( ;; ) {
+        if ( 0 == *cur ) {
+            /* New node to the leaf */
+            n = _new_node(trie, key, prefixlen, data);
+            if ( 0 == n ) {
+                return -1;
+            }
+            STORE_RELEASE(cur, n);
+            *nlinked = 1;
+
+            return 0;
+        }
+        p = NODE(trie, *cur);
+
+        /* Compare the prefixes */
+        d = _diff(key, prefixlen, p->key, p->prefixlen);
+        if ( d < 0 ) {
+            /* Same prefixes for key and p->key */
+            if ( p->valid ) {
+                /* Already exists. */
+                return -1;
+            }
+            /* *cur is a branching node without data */
+            trie->arena.data[*cur] = data;
+            STORE_RELEASE(&p->valid, NULL != data);
+
+            return 0;
+        }
+        if ( d < p->prefixlen ) {
+            break;
+        }
+
+        /* The new node is a descendant node of *cur */
+        if ( p->bit < 0 ) {
+            /* *cur is a leaf. */
+            n = _new_node(trie, key, prefixlen, data);
+            if ( 0 == n ) {
+                return -1;
+            }
+            p->bit = d;
+            STORE_RELEASE(&p->child[NEXT_BIT(key, d)], n);
+            *nlinked = 1;
+
+            return 0;
+        }
+        cur = &p->child[NEXT_BIT(key, p->bit)];
+    }
+
+    /* Insert to the parent of *cur */
+    if ( d == prefixlen ) {
+        /* *cur is a descendant node of the new node */
+        n = _new_node(trie, key, prefixlen, data);
+        if ( 0 == n ) {
+            return -1;
+        }
+        NODE(trie, n)->bit = d;
+        NODE(trie, n)->child[NEXT_BIT(p->key, d)] = *cur;
+        *nlinked = 1;
+    } else {
+        /* *cur and the new node are descendant nodes of another node. */
+        n = _new_node(trie, BIT_PREFIX(key, d), d, NULL);
+        if ( 0 == n ) {
+            return -1;
+        }
+        c = _new_node(trie, key, prefixlen, data);
+        if ( 0 == c ) {
+            _release_node(trie, n);
+            return -1;
+        }
+        NODE(trie, n)->bit = d;
+        NODE(trie, n)->child[NEXT_BIT(key, d)] = c;
+        NODE(trie, n)->child[NEXT_BIT(p->key, d)] = *cur;
+        *nlinked = 2;
+    }
+    STORE_RELEASE(cur, n);
+
+    return 0;
+}
+
+/*
+ * Add a data value to the key
+ */
+int
+path_compressed_trie_add(struct path_compressed_trie *trie, uint32_t key,
+                         int prefixlen, void *data)
+{
+    size_t nlinked;
+    int ret;
+
+    _subtree_lock(trie, key, prefixlen, 1);
+    ret = _add(trie, &trie->root, key, prefixlen, data, &nlinked);
+    if ( 0 == ret && NULL != trie->front ) {
+        _front_update(trie, key, prefixlen);
+    }
+    if ( 0 == ret ) {
+        _generation_bump(trie);
+    }
+    _subtree_lock(trie, key, prefixlen, 0);
+
+    return ret;
+}
+
+/*
+ * Compare the prefix entries in the pre-order of the trie: by the masked key
+ * and then by the prefix length
+ */
+static int
+_entry_cmp(const void *a, const void *b)
+{
+    const struct path_compressed_trie_prefix_entry *x;
+    const struct path_compressed_trie_prefix_entry *y;
+    uint32_t kx;
+    uint32_t ky;
+
+    x = a;
+    y = b;
+    kx = x->key & PREFIX_MASK(x->prefixlen);
+    ky = y->key & PREFIX_MASK(y->prefixlen);
+    if ( kx != ky ) {
+        return kx < ky ? -1 : 1;
+    }
+
+    return x->prefixlen - y->prefixlen;
+}
+
+/*
+ * Release the nodes of a subtree that has never been published
+ */
+static void
+_free_subtree(struct path_compressed_trie *trie, uint32_t idx)
+{
+    uint32_t stack[66];
+    int sp;
+
+    sp = 0;
+    if ( 0 != idx ) {
+        stack[sp++] = idx;
+    }
+    while ( sp > 0 ) {
+        idx = stack[--sp];
+        if ( 0 != NODE(trie, idx)->child[0] ) {
+            stack[sp++] = NODE(trie, idx)->child[0];
+        }
+        if ( 0 != NODE(trie, idx)->child[1] ) {
+            stack[sp++] = NODE(trie, idx)->child[1];
+        }
+        _release_node(trie, idx);
+    }
+}
+
+/*
+ * Link the node as a child of the node p, or as the root if p is 0
+ */
+static __inline__ void
+_build_link(struct path_compressed_trie *trie, uint32_t *root, uint32_t p,
+            uint32_t n)
+{
+    struct path_compressed_trie_node *pn;
+
+    if ( 0 == p ) {
+        *root = n;
+        return;
+    }
+    pn = NODE(trie, p);
+    pn->bit = pn->prefixlen;
+    pn->child[NEXT_BIT(NODE(trie, n)->key, pn->prefixlen)] = n;
+}
+
+/*
+ * Build the trie from the prefixes at once.  The prefixes are linked in the
+ * pre-order of the trie, keeping the path from the root to the last node in
+ * a stack: a prefix is a descendant of the deepest node on the path covering
+ * it, and a branching node is inserted where it diverges from the rest of
+ * the path.  The resulting trie is the same as the one built by adding the
+ * prefixes one by one, and it is published to the readers at once.  This
+ * linear build needs an empty trie: the prefixes are added one by one to a
+ * trie with nodes, which includes the pinned levels of a concurrent trie.
+ * Nothing is added if a prefix length is out of 0..32.
+ */
+int
+path_compressed_trie_build(struct path_compressed_trie *trie,
+                           const struct path_compressed_trie_prefix_entry
+                           *entries, size_t n)
+{
+    struct path_compressed_trie_prefix_entry *sorted;
+    struct path_compressed_trie_node *top;
+    struct path_compressed_trie_node *xn;
+    uint32_t stack[33];
+    uint32_t root;
+    uint32_t last;
+    uint32_t x;
+    uint32_t b;
+    size_t i;
+    int sp;
+    int d;
+
+    for ( i = 0; i < n; i++ ) {
+        if ( entries[i].prefixlen < 0 || entries[i].prefixlen > 32 ) {
+            return -1;
+        }
+    }
+
+    if ( 0 != trie->root ) {
+        /* Add the prefixes to the existing nodes one by one */
+        for ( i = 0; i < n; i++ ) {
+            if ( path_compressed_trie_add(trie, entries[i].key,
+                                          entries[i].prefixlen,
+                                          entries[i].data) < 0 ) {
+                return -1;
+            }
+        }
+        return 0;
+    }
+
+    /* Sort the entries unless they are already in the order */
+    sorted = NULL;
+    for ( i = 1; i < n; i++ ) {
+        if ( _entry_cmp(&entries[i - 1], &entries[i]) >= 0 ) {
+            break;
+        }
+    }
+    if ( i < n ) {
+        sorted = malloc(sizeof(struct path_compressed_trie_prefix_entry) * n);
+        if ( NULL == sorted ) {
+            return -1;
+        }
+        memcpy(sorted, entries,
+               sizeof(struct path_compressed_trie_prefix_entry) * n);
+        qsort(sorted, n, sizeof(struct path_compressed_trie_prefix_entry),
+              _entry_cmp);
+        for ( i = 1; i < n; i++ ) {
+            if ( 0 == _entry_cmp(&sorted[i - 1], &sorted[i]) ) {
+                /* Duplicate prefixes */
+                free(sorted);
+                return -1;
+            }
+        }
+        entries = sorted;
+    }
+
+    root = 0;
+    sp = 0;
+    for ( i = 0; i < n; i++ ) {
+        x = _new_node(trie, entries[i].key, entries[i].prefixlen,
+                      entries[i].data);
+        if ( 0 == x ) {
+            _free_subtree(trie, root);
+            free(sorted);
+            return -1;
+        }
+        xn = NODE(trie, x);
+
+        /* Pop the nodes not covering the new one */
+        last = 0;
+        while ( sp > 0 ) {
+            top = NODE(trie, stack[sp - 1]);
+            if ( top->prefixlen <= xn->prefixlen
+                 && !((top->key ^ xn->key) & PREFIX_MASK(top->prefixlen)) ) {
+                break;
+            }
+            last = stack[--sp];
+        }
+
+        if ( 0 != last ) {
+            /* The new node diverges from the last popped one below the top of
+               the stack; insert a branching node unless the divergence is the
+               branching bit of the top */
+            d = __builtin_clz(NODE(trie, last)->key ^ xn->key);
+            if ( 0 == sp || d > NODE(trie, stack[sp - 1])->prefixlen ) {
+                b = _new_node(trie, BIT_PREFIX(xn->key, d), d, NULL);
+                if ( 0 == b ) {
+                    _release_node(trie, x);
+                    _free_subtree(trie, root);
+                    free(sorted);
+                    return -1;
+                }
+                NODE(trie, b)->bit = d;
+                NODE(trie, b)->child[0] = last;
+                _build_link(trie, &root, sp > 0 ? stack[sp - 1] : 0, b);
+                stack[sp++] = b;
+            }
+        }
+
+        _build_link(trie, &root, sp > 0 ? stack[sp - 1] : 0, x);
+        stack[sp++] = x;
+    }
+    free(sorted);
+
+    /* Publish the whole trie */
+    STORE_RELEASE(&trie->root, root);
+    if ( NULL != trie->front ) {
+        _front_update(trie, 0, 0);
+    }
+    _generation_bump(trie);
+
+    return 0;
+}
+
+/*
+ * Delete the data value corresponding to the key under the link root and
+ * return the value; the number of the nodes unlinked is set to nunlinked
+ */
+static void *
+_delete(struct path_compressed_trie *trie, uint32_t *root, uint32_t key,
+        int prefixlen, size_t *nunlinked)
+{
+    struct path_compressed_trie_node *nn;
+    struct path_compressed_trie_node *pn;
+    uint32_t *path[34];
+    uint32_t *cur;
+    uint32_t idx;
+    void *data;
+    int sp;
+
+    /* Find the node keeping the links from the root */
+    *nunlinked = 0;
+    sp = 0;
+    cur = root;
+    for ( ;; ) {
+        if ( 0 == *cur ) {
+            return NULL;
+        }
+        nn = NODE(trie, *cur);
+        if ( nn->prefixlen > prefixlen
+             || ((key ^ nn->key) & PREFIX_MASK(nn->prefixlen)) ) {
+            return NULL;
+        }
+        if ( nn->prefixlen == prefixlen ) {
+            break;
+        }
+        if ( nn->bit < 0 ) {
+            /* Reach at a leaf */
+            return NULL;
+        }
+        path[sp++] = cur;
+        cur = &nn->child[NEXT_BIT(key, nn->bit)];
+    }
+    if ( !nn->valid ) {
+        return NULL;
+    }
+    /* The data is kept for the readers that already matched the node */
+    data = trie->arena.data[*cur];
+    STORE_RELEASE(&nn->valid, 0);
+
+    /* Restore the path compression: a node without data is unlinked if it
+       has no child and replaced by its child if it has only one.  The
+       unlink goes on to the parent left without a child. */
+    for ( ;; ) {
+        nn = NODE(trie, *cur);
+        if ( nn->valid || (nn->flags & PATH_COMPRESSED_TRIE_NODE_PINNED)
+             || (0 != nn->child[0] && 0 != nn->child[1]) ) {
+            break;
+        }
+        idx = *cur;
+        STORE_RELEASE(cur, nn->child[0] | nn->child[1]);
+        _retire_node(trie, idx);
+        (*nunlinked)++;
+        if ( 0 != *cur || 0 == sp ) {
+            break;
+        }
+        cur = path[--sp];
+        pn = NODE(trie, *cur);
+        if ( !(pn->flags & PATH_COMPRESSED_TRIE_NODE_PINNED)
+             && 0 == pn->child[0] && 0 == pn->child[1] ) {
+            /* The parent becomes a leaf */
+            pn->bit = -1;
+        }
+    }
+
+    return data;
+}
+
+/*
+ * Delete the data value corresponding to the key and return it
+ */
+void *
+path_compressed_trie_delete(struct path_compressed_trie *trie, uint32_t key,
+                            int prefixlen)
+{
+    size_t nunlinked;
+    void *data;
+
+    _subtree_lock(trie, key, prefixlen, 1);
+    data = _delete(trie, &trie->root, key, prefixlen, &nunlinked);
+    if ( NULL != data && NULL != trie->front ) {
+        _front_update(trie, key, prefixlen);
+    }
+    if ( NULL != data ) {
+        _generation_bump(trie);
+    }
+    _subtree_lock(trie, key, prefixlen, 0);
+    _epoch_reclaim(trie);
+
+    return data;
+}
+
+/*
+ * Get the statistics of the node arena
+ */
+void
+path_compressed_trie_arena_stats(struct path_compressed_trie *trie,
+                                 struct path_compressed_trie_arena_stats *st)
+{
+    st->slabs = trie->arena.committed / PATH_COMPRESSED_TRIE_SLAB_NODES;
+    st->capacity = trie->arena.committed;
+    st->used = trie->arena.nused;
+    st->free = trie->arena.nfree;
+    st->retired = trie->epoch.retired;
+    st->bytes = trie->arena.committed
+        * (sizeof(struct path_compressed_trie_node) + sizeof(void *));
+    st->allocs = trie->arena.allocs;
+    st->frees = trie->arena.frees;
+}
+
+/*
+ * Register the calling thread as a reader; the lookups of the thread run
+ * between path_compressed_trie_reader_enter() and
+ * path_compressed_trie_reader_exit() concurrently with a writer thread
+ */
+struct path_compressed_trie_reader *
+path_compressed_trie_reader_register(struct path_compressed_trie *trie)
+{
+    struct path_compressed_trie_reader *r;
+    int used;
+    int n;
+    int i;
+
+    for ( i = 0; i < PATH_COMPRESSED_TRIE_MAX_READERS; i++ ) {
+        r = &trie->epoch.readers[i];
+        used = 0;
+        if ( __atomic_compare_exchange_n(&r->used, &used, 1, 0,
+                                         __ATOMIC_ACQ_REL,
+                                         __ATOMIC_RELAXED) ) {
+            /* Extend the slots scanned by the writer */
+            n = LOAD_ACQUIRE(&trie->epoch.nreaders);
+            while ( n < i + 1
+                    && !__atomic_compare_exchange_n(&trie->epoch.nreaders, &n,
+                                                    i + 1, 0, __ATOMIC_ACQ_REL,
+                                                    __ATOMIC_ACQUIRE) ) {
+                ;
+            }
+            return r;
+        }
+    }
+
+    /* No free slot */
+    return NULL;
+}
+
+/*
+ * Unregister a reader
+ */
+void
+path_compressed_trie_reader_unregister(struct path_compressed_trie *trie,
+                                       struct path_compressed_trie_reader *r)
+{
+    (void)trie;
+    STORE_RELEASE(&r->epoch, 0);
+    STORE_RELEASE(&r->used, 0);
+}
+
+/*
+ * Enter a read-side critical section; the nodes reachable in it are not
+ * released until the reader exits
+ */
+void
+path_compressed_trie_reader_enter(struct path_compressed_trie *trie,
+                                  struct path_compressed_trie_reader *r)
+{
+    /* Publish the epoch before any load from the trie */
+    __atomic_store_n(&r->epoch, LOAD_ACQUIRE(&trie->epoch.global),
+                     __ATOMIC_SEQ_CST);
+}
+
+/*
+ * Exit the read-side critical section
+ */
+void
+path_compressed_trie_reader_exit(struct path_compressed_trie_reader *r)
+{
+    STORE_RELEASE(&r->epoch, 0);
+}
+
+/*
+ * Wait until all the readers leave the critical sections entered before the
+ * call and release all the retired nodes; the data returned by
+ * path_compressed_trie_delete() may be freed after this
+ */
+void
+path_compressed_trie_synchronize(struct path_compressed_trie *trie)
+{
+    int ret;
+    int i;
+
+    for ( i = 0; i < 2; ) {
+        _arena_lock(trie);
+        ret = _epoch_advance(trie);
+        _arena_unlock(trie);
+        if ( 0 == ret ) {
+            i++;
+        } else {
+            sched_yield();
+        }
+    }
+}
+
+/*
+ * Get the memory usage of the trie in bytes: the committed arena and the front
+ * table
+ */
+size_t
+path_compressed_trie_memory(struct path_compressed_trie *trie)
+{
+    size_t size;
+
+    size = sizeof(struct path_compressed_trie) + trie->arena.committed
+        * (sizeof(struct path_compressed_trie_node) + sizeof(void *));
+    if ( NULL != trie->front ) {
+        size += sizeof(struct path_compressed_trie_front_entry)
+            << trie->front_bits;
+    }
+    if ( NULL != trie->front_spare ) {
+        size += sizeof(struct path_compressed_trie_front_entry)
+            << trie->front_bits;
+    }
+
+    return size;
+}
+
+/*
+ * Get the shape statistics of the trie.  The nodes are walked in the
+ * pre-order with a stack of the nodes and their depths.  A lookup walk visits
+ * a node whose parent has the prefix length l for the addresses covered by
+ * the parent and the bit next to it, 2^-(l+1) of the address space, so the
+ * average number of the visits is the sum of the shares over the nodes.
+ */
+void
+path_compressed_trie_stats(struct path_compressed_trie *trie,
+                           struct path_compressed_trie_stats *st)
+{
+    struct path_compressed_trie_node *n;
+    uint32_t stack[PATH_COMPRESSED_TRIE_MAX_DEPTH + 1];
+    int depth[PATH_COMPRESSED_TRIE_MAX_DEPTH + 1];
+    uint32_t idx;
+    int sp;
+    int d;
+    int i;
+
+    memset(st, 0, sizeof(struct path_compressed_trie_stats));
+    sp = 0;
+    if ( 0 != trie->root ) {
+        stack[sp] = trie->root;
+        depth[sp] = 1;
+        sp++;
+        st->avg_depth = 1.0;
+    }
+    while ( sp > 0 ) {
+        sp--;
+        idx = stack[sp];
+        d = depth[sp];
+        n = NODE(trie, idx);
+
+        st->nodes++;
+        st->depth[d]++;
+        if ( d > st->max_depth ) {
+            st->max_depth = d;
+        }
+        if ( 0 != n->child[0] || 0 != n->child[1] ) {
+            if ( n->valid ) {
+                st->internals++;
+            } else {
+                st->branches++;
+            }
+        } else {
+            if ( n->valid ) {
+                st->leaves++;
+            } else {
+                st->empty_leaves++;
+            }
+        }
+        if ( n->valid ) {
+            st->prefixes++;
+            st->prefixlen[n->prefixlen]++;
+        }
+
+        for ( i = 1; i >= 0; i-- ) {
+            if ( 0 != n->child[i] ) {
+                st->avg_depth += 1.0 / ((uint64_t)2 << n->prefixlen);
+                stack[sp] = n->child[i];
+                depth[sp] = d + 1;
+                sp++;
+            }
+        }
+    }
+    st->bytes = st->nodes
+        * (sizeof(struct path_compressed_trie_node) + sizeof(void *));
+    st->memory = path_compressed_trie_memory(trie);
+}
 
 /*
- * Initialize the data structure for path-compressed trie
+ * Initialize the multi-table trie of ntables tables (VRFs) sharing a node
+ * arena; the key of a lookup is the pair of the table ID and the address.
+ * The shared trie has no subtree locks, so the updates of the tables must
+ * not run concurrently with each other; the lookup caches do not apply to
+ * the tables.
  */
-struct path_compressed_trie *
-path_compressed_trie_init(struct path_compressed_trie *trie)
+struct path_compressed_trie_vrf *
+path_compressed_trie_vrf_init(struct path_compressed_trie_vrf *vrf,
+                              uint32_t ntables)
 {
-    if ( NULL == trie ) {
+    if ( NULL == vrf ) {
         /* Allocate new data structure */
-        trie = malloc(sizeof(struct path_compressed_trie));
-        if ( NULL == trie ) {
+        vrf = malloc(sizeof(struct path_compressed_trie_vrf));
+        if ( NULL == vrf ) {
             return NULL;
         }
-        trie->_allocated = 1;
+        vrf->_allocated = 1;
     } else {
-        trie->_allocated = 0;
+        vrf->_allocated = 0;
     }
 
-    /* Set NULL to the root node */
-    trie->root = NULL;
+    vrf->tables = calloc(ntables, sizeof(struct path_compressed_trie_table));
+    if ( NULL == vrf->tables ) {
+        if ( vrf->_allocated ) {
+            free(vrf);
+        }
+        return NULL;
+    }
+    vrf->ntables = ntables;
 
-    return trie;
+    /* The shared arena; the root of the trie itself is not used */
+    if ( NULL == path_compressed_trie_init(&vrf->trie) ) {
+        free(vrf->tables);
+        if ( vrf->_allocated ) {
+            free(vrf);
+        }
+        return NULL;
+    }
+
+    return vrf;
 }
 
 /*
- * Release the node and descendant nodes
+ * Release the multi-table trie
  */
-static void
-_free_nodes(struct path_compressed_trie_node *node)
+void
+path_compressed_trie_vrf_release(struct path_compressed_trie_vrf *vrf)
 {
-    if ( NULL != node ) {
-        _free_nodes(node->left);
-        _free_nodes(node->right);
-        free(node);
+    path_compressed_trie_release(&vrf->trie);
+    free(vrf->tables);
+    if ( vrf->_allocated ) {
+        free(vrf);
     }
 }
 
 /*
- * Release the path-compressed trie
+ * Lookup the data corresponding to the key in the table
  */
-void
-path_compressed_trie_release(struct path_compressed_trie *trie)
+void *
+path_compressed_trie_vrf_lookup(struct path_compressed_trie_vrf *vrf,
+                                uint32_t table, uint32_t key)
 {
-    _free_nodes(trie->root);
-    if ( trie->_allocated ) {
-        free(trie);
+    if ( table >= vrf->ntables ) {
+        return NULL;
     }
+
+    return vrf->trie.arena.data[
+        _pctrie_walk(vrf->trie.arena.nodes,
+                     LOAD_ACQUIRE(&vrf->tables[table].root), 0, key)];
 }
 
 /*
- * Recursive process of the lookup procedure
+ * Add a data value to the prefix in the table
  */
-static void *
-_lookup(struct path_compressed_trie_node *cur,
-        struct path_compressed_trie_node *cand, uint32_t key)
+int
+path_compressed_trie_vrf_add(struct path_compressed_trie_vrf *vrf,
+                             uint32_t table, uint32_t key, int prefixlen,
+                             void *data)
 {
-    struct path_compressed_trie_node *next;
+    struct path_compressed_trie_table *t;
+    size_t nlinked;
+    int ret;
 
-    /* Reaches at the leaf */
-    if ( NULL == cur ) {
-        return NULL != cand ? cand->data : NULL;
+    if ( table >= vrf->ntables ) {
+        return -1;
     }
-    if ( cur->bit < 0 ||
-         BIT_PREFIX(cur->key, cur->bit) != BIT_PREFIX(key, cur->bit) ) {
-        if ( BIT_PREFIX(cur->key, cur->prefixlen)
-             == BIT_PREFIX(key, cur->prefixlen) ) {
-            cand = cur;
-        }
-        return NULL != cand ? cand->data : NULL;
+    t = &vrf->tables[table];
+    ret = _add(&vrf->trie, &t->root, key, prefixlen, data, &nlinked);
+    if ( 0 == ret ) {
+        t->nprefixes++;
+        t->nnodes += nlinked;
+    }
+
+    return ret;
+}
+
+/*
+ * Delete the prefix from the table and return its data
+ */
+void *
+path_compressed_trie_vrf_delete(struct path_compressed_trie_vrf *vrf,
+                                uint32_t table, uint32_t key, int prefixlen)
+{
+    struct path_compressed_trie_table *t;
+    size_t nunlinked;
+    void *data;
+
+    if ( table >= vrf->ntables ) {
+        return NULL;
     }
-    if ( NULL != cur->data ) {
-        cand = cur;
+    t = &vrf->tables[table];
+    data = _delete(&vrf->trie, &t->root, key, prefixlen, &nunlinked);
+    if ( NULL != data ) {
+        t->nprefixes--;
+        t->nnodes -= nunlinked;
     }
+    _epoch_reclaim(&vrf->trie);
 
-    if ( BIT_TEST(key, cur->bit) ) {
-        /* Right */
-        next = cur->right;
-    } else {
-        /* Left */
-        next = cur->left;
+    return data;
+}
+
+/*
+ * Get the number of the prefixes and the nodes, and the bytes of the nodes
+ * in the table
+ */
+int
+path_compressed_trie_vrf_stats(struct path_compressed_trie_vrf *vrf,
+                               uint32_t table,
+                               struct path_compressed_trie_table_stats *st)
+{
+    if ( table >= vrf->ntables ) {
+        return -1;
     }
+    st->prefixes = vrf->tables[table].nprefixes;
+    st->nodes = vrf->tables[table].nnodes;
+    st->bytes = st->nodes
+        * (sizeof(struct path_compressed_trie_node) + sizeof(void *));
 
-    return _lookup(next, cand, key);
+    return 0;
 }
 
 /*
- * Lookup the data corresponding to the key specified by the argument
+ * Get the memory usage of the multi-table trie in bytes
  */
-void *
-path_compressed_trie_lookup(struct path_compressed_trie *trie, uint32_t key)
+size_t
+path_compressed_trie_vrf_memory(struct path_compressed_trie_vrf *vrf)
 {
-    return _lookup(trie->root, NULL, key);
+    return path_compressed_trie_memory(&vrf->trie)
+        - sizeof(struct path_compressed_trie)
+        + sizeof(struct path_compressed_trie_vrf)
+        + sizeof(struct path_compressed_trie_table) * vrf->ntables;
 }
 
 /*
- * Compute the difference
+ * Begin a transaction of the trie
  */
-static int
-_diff(uint32_t key0, int plen0, uint32_t key1, int plen1, int cache)
+struct path_compressed_trie_txn *
+path_compressed_trie_txn_begin(struct path_compressed_trie *trie)
 {
-    int i;
+    struct path_compressed_trie_txn *txn;
 
-    for ( i = cache; i <= plen0 && i <= plen1; i++ ) {
-        if ( BIT_TEST(key0, i) != BIT_TEST(key1, i) ) {
-            return i;
-        }
+    txn = malloc(sizeof(struct path_compressed_trie_txn));
+    if ( NULL == txn ) {
+        return NULL;
     }
+    memset(txn, 0, sizeof(struct path_compressed_trie_txn));
+    txn->trie = trie;
 
-    if ( plen0 == plen1 ) {
-        return -1;
-    } else if ( plen0 < plen1 ) {
-        return plen0;
-    } else {
-        return plen1;
-    }
+    return txn;
 }
 
 /*
- * Create a new node
+ * Stage an update of the prefix in the transaction: the data to announce the
+ * prefix (replacing the data if it exists), or NULL to withdraw it.  The
+ * trie is not modified until the commit, and the last update of a prefix
+ * takes effect.
  */
-static struct path_compressed_trie_node *
-_new_node(uint32_t key, int prefixlen, void *data)
+int
+path_compressed_trie_txn_apply(struct path_compressed_trie_txn *txn,
+                               uint32_t key, int prefixlen, void *data)
 {
-    struct path_compressed_trie_node *n;
+    struct path_compressed_trie_prefix_entry *updates;
+    size_t size;
 
-    n = malloc(sizeof(struct path_compressed_trie_node));
-    if ( NULL == n ) {
-        return NULL;
+    if ( prefixlen < 0 || prefixlen > 32 ) {
+        return -1;
     }
-    n->bit = -1;
-    n->left = NULL;
-    n->right = NULL;
-    n->key = key;
-    n->prefixlen = prefixlen;
-    n->data = data;
+    if ( txn->nupdates == txn->size ) {
+        size = txn->size ? txn->size * 2 : 1024;
+        updates = realloc(txn->updates,
+                          sizeof(struct path_compressed_trie_prefix_entry)
+                          * size);
+        if ( NULL == updates ) {
+            return -1;
+        }
+        txn->updates = updates;
+        txn->size = size;
+    }
+    txn->updates[txn->nupdates].key = key & PREFIX_MASK(prefixlen);
+    txn->updates[txn->nupdates].prefixlen = prefixlen;
+    txn->updates[txn->nupdates].data = data;
+    txn->nupdates++;
 
-    return n;
+    return 0;
 }
 
 /*
- * Add a data value (recursive)
+ * Append a node index to the array
  */
 static int
-_add(struct path_compressed_trie_node **cur, uint32_t key, int prefixlen,
-     void *data)
+_txn_push(uint32_t **a, size_t *n, size_t *size, uint32_t idx)
 {
-    struct path_compressed_trie_node *n;
-    struct path_compressed_trie_node *c;
-    int d;
+    uint32_t *na;
+    size_t nsize;
 
-    if ( NULL == *cur ) {
-        /* New node to the leaf */
-        n = _new_node(key, prefixlen, data);
-        if ( NULL == n ) {
+    if ( *n == *size ) {
+        nsize = *size ? *size * 2 : 1024;
+        na = realloc(*a, sizeof(uint32_t) * nsize);
+        if ( NULL == na ) {
             return -1;
         }
-        *cur = n;
+        *a = na;
+        *size = nsize;
+    }
+    (*a)[(*n)++] = idx;
+
+    return 0;
+}
+
+/*
+ * Allocate a node of the new version of the trie
+ */
+static uint32_t
+_txn_new_node(struct path_compressed_trie_txn *txn, uint32_t key,
+              int prefixlen, void *data)
+{
+    uint32_t idx;
 
+    idx = _new_node(txn->trie, key, prefixlen, data);
+    if ( 0 == idx ) {
         return 0;
     }
+    if ( _txn_push(&txn->staged, &txn->nstaged, &txn->staged_size,
+                   idx) < 0 ) {
+        _release_node(txn->trie, idx);
+        return 0;
+    }
+    NODE(txn->trie, idx)->flags = PATH_COMPRESSED_TRIE_NODE_STAGED;
 
-    /* Compare the prefixes */
-    d = _diff(key, prefixlen, (*cur)->key, (*cur)->prefixlen, 0);
-    if ( d < 0 ) {
-        /* Same prefixes for key and (*cur)->key */
-        return -1;
+    return idx;
+}
+
+/*
+ * Replace the published node at the link with its copy, unless it is a node
+ * of the new version already; the published nodes are never modified
+ */
+static uint32_t
+_txn_copy(struct path_compressed_trie_txn *txn, uint32_t *cur)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_node *o;
+    struct path_compressed_trie_node *n;
+    uint32_t idx;
+
+    trie = txn->trie;
+    o = NODE(trie, *cur);
+    if ( o->flags & PATH_COMPRESSED_TRIE_NODE_STAGED ) {
+        return *cur;
     }
-    if ( (*cur)->bit >= 0 ) {
-        if ( d == (*cur)->bit && d == prefixlen ) {
-            /* *cur is the node to insert. */
-            if ( NULL != (*cur)->data ) {
-                /* Already exists. */
-                return -1;
-            }
-            (*cur)->key = key;
-            (*cur)->prefixlen = prefixlen;
-            (*cur)->data = data;
-        } else if ( d < (*cur)->bit ) {
-            /* Insert to the parent of *cur */
-            if ( d == prefixlen ) {
-                n = _new_node(key, prefixlen, data);
-                if ( NULL == n ) {
-                    return -1;
-                }
-                n->bit = d;
-                if ( BIT_TEST((*cur)->key, d) ) {
-                    /* Right */
-                    n->right = *cur;
-                } else {
-                    /* Left */
-                    n->left = *cur;
-                }
-                *cur = n;
-            } else {
-                n = _new_node(BIT_PREFIX(key, d), d, NULL);
-                if ( NULL == n ) {
-                    return -1;
-                }
-                c = _new_node(key, prefixlen, data);
-                if ( NULL == n ) {
-                    free(n);
-                    return -1;
-                }
-                n->bit = d;
-                if ( BIT_TEST(key, d) ) {
-                    /* Right */
-                    n->left = *cur;
-                    n->right = c;
-                } else {
-                    /* Left */
-                    n->left = c;
-                    n->right = *cur;
-                }
-                *cur = n;
-            }
-        } else {
-            /* Traverse to a descendant node */
-            if ( BIT_TEST(key, (*cur)->bit) ) {
-                /* Right */
-                return _add(&(*cur)->right, key, prefixlen, data);
-            } else {
-                /* Left */
-                return _add(&(*cur)->left, key, prefixlen, data);
-            }
+    if ( _txn_push(&txn->replaced, &txn->nreplaced, &txn->replaced_size,
+                   *cur) < 0 ) {
+        return 0;
+    }
+    idx = _txn_new_node(txn, o->key, o->prefixlen,
+                        o->valid ? trie->arena.data[*cur] : NULL);
+    if ( 0 == idx ) {
+        txn->nreplaced--;
+        return 0;
+    }
+    n = NODE(trie, idx);
+    n->bit = o->bit;
+    n->child[0] = o->child[0];
+    n->child[1] = o->child[1];
+    n->flags |= o->flags & PATH_COMPRESSED_TRIE_NODE_PINNED;
+    *cur = idx;
+
+    return idx;
+}
+
+/*
+ * Pop the links of the last path down to the deepest node covering the
+ * prefix, and return the link to resume the traversal from
+ */
+static uint32_t *
+_txn_seek(struct path_compressed_trie_txn *txn, uint32_t *root, uint32_t key,
+          int prefixlen)
+{
+    struct path_compressed_trie_node *n;
+    uint32_t *cur;
+
+    while ( txn->sp > 0 ) {
+        cur = txn->path[--txn->sp];
+        n = NODE(txn->trie, *cur);
+        if ( 0 != *cur && n->prefixlen <= prefixlen
+             && !((key ^ n->key) & PREFIX_MASK(n->prefixlen)) ) {
+            return cur;
         }
-    } else {
-        /* *cur is a leaf. */
-        if ( d == prefixlen ) {
-            /* *cur is a descendant node of the new node */
-            n = _new_node(key, prefixlen, data);
-            if ( NULL == n ) {
+    }
+
+    return root;
+}
+
+/*
+ * Announce the prefix in the new version of the trie
+ */
+static int
+_txn_add(struct path_compressed_trie_txn *txn, uint32_t *root, uint32_t key,
+         int prefixlen, void *data)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_node *p;
+    uint32_t *cur;
+    uint32_t n;
+    uint32_t c;
+    int d;
+
+    trie = txn->trie;
+    cur = _txn_seek(txn, root, key, prefixlen);
+    for ( ;; ) {
+        if ( 0 == *cur ) {
+            /* New node to the leaf */
+            n = _txn_new_node(txn, key, prefixlen, data);
+            if ( 0 == n ) {
                 return -1;
             }
-            n->bit = d;
-            if ( BIT_TEST((*cur)->key, d) ) {
-                /* Right */
-                n->right = *cur;
-            } else {
-                /* Left */
-                n->left = *cur;
-            }
             *cur = n;
-        } else if ( d == (*cur)->prefixlen )  {
-            /* The new node is a descendant node of *cur */
-            n = _new_node(key, prefixlen, data);
-            if ( NULL == n ) {
-                return -1;
-            }
-            /* Assert */
-            if ( d != (*cur)->prefixlen ) {
-                fprintf(stderr, "Fatal error %s %d\n", __FILE__, __LINE__);
-                return -1;
-            }
-            (*cur)->bit = d;
-            if ( BIT_TEST(key, d) ) {
-                /* Right */
-                (*cur)->right = n;
-            } else {
-                /* Left */
-                (*cur)->left = n;
-            }
-        } else {
-            /* *cur and the new node are descendant nodes of another node. */
-            n = _new_node(BIT_PREFIX(key, d), d, NULL);
-            if ( NULL == n ) {
-                return -1;
-            }
-            c = _new_node(key, prefixlen, data);
-            if ( NULL == n ) {
-                free(n);
+            return 0;
+        }
+        p = NODE(trie, *cur);
+        d = _diff(key, prefixlen, p->key, p->prefixlen);
+        if ( d >= 0 && d < p->prefixlen ) {
+            break;
+        }
+
+        /* *cur covers the prefix */
+        if ( 0 == _txn_copy(txn, cur) ) {
+            return -1;
+        }
+        p = NODE(trie, *cur);
+        txn->path[txn->sp++] = cur;
+        if ( d < 0 ) {
+            /* Same prefixes for key and p->key */
+            trie->arena.data[*cur] = data;
+            p->valid = 1;
+            return 0;
+        }
+        if ( p->bit < 0 ) {
+            /* *cur is a leaf. */
+            n = _txn_new_node(txn, key, prefixlen, data);
+            if ( 0 == n ) {
                 return -1;
             }
-            n->bit = d;
-            if ( BIT_TEST(key, d) ) {
-                /* Right */
-                n->left = *cur;
-                n->right = c;
-            } else {
-                /* Left */
-                n->left = c;
-                n->right = *cur;
-            }
-            *cur = n;
+            p->bit = d;
+            p->child[NEXT_BIT(key, d)] = n;
+            return 0;
+        }
+        cur = &p->child[NEXT_BIT(key, p->bit)];
+    }
+
+    /* Insert to the parent of *cur */
+    if ( d == prefixlen ) {
+        /* *cur is a descendant node of the new node */
+        n = _txn_new_node(txn, key, prefixlen, data);
+        if ( 0 == n ) {
+            return -1;
+        }
+        NODE(trie, n)->bit = d;
+        NODE(trie, n)->child[NEXT_BIT(p->key, d)] = *cur;
+    } else {
+        /* *cur and the new node are descendant nodes of another node. */
+        n = _txn_new_node(txn, BIT_PREFIX(key, d), d, NULL);
+        c = _txn_new_node(txn, key, prefixlen, data);
+        if ( 0 == n || 0 == c ) {
+            return -1;
         }
+        NODE(trie, n)->bit = d;
+        NODE(trie, n)->child[NEXT_BIT(key, d)] = c;
+        NODE(trie, n)->child[NEXT_BIT(p->key, d)] = *cur;
     }
+    *cur = n;
 
     return 0;
 }
 
 /*
- * Add a data value to the key
+ * Withdraw the prefix from the new version of the trie
  */
-int
-path_compressed_trie_add(struct path_compressed_trie *trie, uint32_t key,
-                         int prefixlen, void *data)
+static int
+_txn_delete(struct path_compressed_trie_txn *txn, uint32_t *root,
+            uint32_t key, int prefixlen)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_node *p;
+    uint32_t *cur;
+
+    trie = txn->trie;
+    cur = _txn_seek(txn, root, key, prefixlen);
+    for ( ;; ) {
+        if ( 0 == *cur ) {
+            return 0;
+        }
+        p = NODE(trie, *cur);
+        if ( p->prefixlen > prefixlen
+             || ((key ^ p->key) & PREFIX_MASK(p->prefixlen)) ) {
+            return 0;
+        }
+        if ( p->prefixlen == prefixlen ) {
+            break;
+        }
+        if ( p->bit < 0 ) {
+            return 0;
+        }
+        if ( 0 == _txn_copy(txn, cur) ) {
+            return -1;
+        }
+        txn->path[txn->sp++] = cur;
+        cur = &NODE(trie, *cur)->child[NEXT_BIT(key, p->bit)];
+    }
+    if ( !p->valid ) {
+        return 0;
+    }
+    if ( 0 == _txn_copy(txn, cur) ) {
+        return -1;
+    }
+    p = NODE(trie, *cur);
+    p->valid = 0;
+    trie->arena.data[*cur] = NULL;
+
+    /* Unlink the node without data or replace it by its only child as
+       _delete() does, going on to the parent left without a child; the
+       unlinked nodes are released at the commit */
+    for ( ;; ) {
+        p = NODE(trie, *cur);
+        if ( p->valid || (p->flags & PATH_COMPRESSED_TRIE_NODE_PINNED)
+             || (0 != p->child[0] && 0 != p->child[1]) ) {
+            /* Remains */
+            txn->path[txn->sp++] = cur;
+            break;
+        }
+        p->flags &= ~PATH_COMPRESSED_TRIE_NODE_STAGED;
+        *cur = p->child[0] | p->child[1];
+        if ( 0 != *cur || 0 == txn->sp ) {
+            break;
+        }
+        cur = txn->path[--txn->sp];
+        p = NODE(trie, *cur);
+        if ( !(p->flags & PATH_COMPRESSED_TRIE_NODE_PINNED)
+             && 0 == p->child[0] && 0 == p->child[1] ) {
+            /* The parent becomes a leaf */
+            p->bit = -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Compare the staged updates in the pre-order of the trie, and then in the
+ * order of the staging
+ */
+static int
+_txn_update_cmp(const void *a, const void *b)
 {
-    return _add(&trie->root, key, prefixlen, data);
+    const struct path_compressed_trie_prefix_entry *x;
+    const struct path_compressed_trie_prefix_entry *y;
+    int ret;
+
+    x = *(const struct path_compressed_trie_prefix_entry *const *)a;
+    y = *(const struct path_compressed_trie_prefix_entry *const *)b;
+    ret = _entry_cmp(x, y);
+    if ( 0 != ret ) {
+        return ret;
+    }
+
+    return x < y ? -1 : (x > y);
 }
 
 /*
- * Delete the data value corresponding to the key and return the value
+ * Release the transaction
  */
-static void *
-_delete(struct path_compressed_trie_node **n,
-        struct path_compressed_trie_node *p, uint32_t key, int prefixlen)
+void
+path_compressed_trie_txn_abort(struct path_compressed_trie_txn *txn)
 {
-    void *data;
-    struct path_compressed_trie_node **c;
+    free(txn->updates);
+    free(txn->staged);
+    free(txn->replaced);
+    free(txn);
+}
 
-    if ( NULL == *n ) {
-        return NULL;
+/*
+ * Commit the transaction and release it; return the number of the updates
+ * applied.  The updates are applied in the pre-order of the trie in a single
+ * pass, resuming from the deepest node covering the next prefix on the last
+ * path.  The published nodes are never modified: the nodes on the updated
+ * paths are copied once, and the new version of the trie is published to the
+ * readers at once by replacing the root.  With a front table, the spare table
+ * is updated for the new version beforehand and replaces the front table
+ * with the root; it is synchronized to the new version once the readers of
+ * the former one are gone.  The replaced nodes are reclaimed through the
+ * epochs.  On failure, the trie is left unchanged.
+ */
+ssize_t
+path_compressed_trie_txn_commit(struct path_compressed_trie_txn *txn)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_prefix_entry **sorted;
+    struct path_compressed_trie_prefix_entry *u;
+    struct path_compressed_trie_front_entry *front;
+    uint32_t root;
+    uint32_t idx;
+    ssize_t n;
+    size_t i;
+    int ret;
+
+    trie = txn->trie;
+    sorted = malloc(sizeof(struct path_compressed_trie_prefix_entry *)
+                    * (txn->nupdates + 1));
+    if ( NULL == sorted ) {
+        path_compressed_trie_txn_abort(txn);
+        return -1;
     }
+    for ( i = 0; i < txn->nupdates; i++ ) {
+        sorted[i] = &txn->updates[i];
+    }
+    qsort(sorted, txn->nupdates,
+          sizeof(struct path_compressed_trie_prefix_entry *), _txn_update_cmp);
 
-    if ( BIT_PREFIX(key, prefixlen) == BIT_PREFIX((*n)->key, (*n)->prefixlen)
-         && prefixlen == (*n)->prefixlen ) {
-        /* n is the node corresponding to the set of key and prefix length */
-        data = (*n)->data;
-        if ( (*n)->bit < 0 ) {
-            /* n is a leaf. */
-            free(*n);
-            *n = NULL;
-            if ( NULL != p && NULL == p->left && NULL == p->right ) {
-                p->bit = -1;
-            }
+    /* Exclude all the concurrent writers */
+    _subtree_lock(trie, 0, 0, 1);
+
+    /* Spare front table, the same as the front table until the commit */
+    if ( NULL != trie->front && NULL == trie->front_spare ) {
+        front = malloc(sizeof(struct path_compressed_trie_front_entry)
+                       << trie->front_bits);
+        if ( NULL == front ) {
+            _subtree_lock(trie, 0, 0, 0);
+            free(sorted);
+            path_compressed_trie_txn_abort(txn);
+            return -1;
         }
+        memcpy(front, trie->front,
+               sizeof(struct path_compressed_trie_front_entry)
+               << trie->front_bits);
+        trie->front_spare = front;
+    }
 
-        return data;
+    root = trie->root;
+    n = 0;
+    ret = 0;
+    for ( i = 0; i < txn->nupdates && 0 == ret; i++ ) {
+        u = sorted[i];
+        if ( i + 1 < txn->nupdates && 0 == _entry_cmp(u, sorted[i + 1]) ) {
+            /* Superseded by the later update */
+            continue;
+        }
+        if ( NULL != u->data ) {
+            ret = _txn_add(txn, &root, u->key, u->prefixlen, u->data);
+        } else {
+            ret = _txn_delete(txn, &root, u->key, u->prefixlen);
+        }
+        n++;
     }
-    if ( (*n)->bit < 0 ) {
-        /* Reach at a leaf */
-        return NULL;
+    if ( ret < 0 ) {
+        /* Discard the new version */
+        for ( i = 0; i < txn->nstaged; i++ ) {
+            _release_node(trie, txn->staged[i]);
+        }
+        _subtree_lock(trie, 0, 0, 0);
+        free(sorted);
+        path_compressed_trie_txn_abort(txn);
+        return -1;
     }
 
-    if ( BIT_TEST(key, (*n)->bit) ) {
-        /* Right */
-        c = &(*n)->right;
-    } else {
-        /* Left */
-        c = &(*n)->left;
+    /* Release the nodes unlinked before the publication */
+    for ( i = 0; i < txn->nstaged; i++ ) {
+        idx = txn->staged[i];
+        if ( NODE(trie, idx)->flags & PATH_COMPRESSED_TRIE_NODE_STAGED ) {
+            NODE(trie, idx)->flags &= ~PATH_COMPRESSED_TRIE_NODE_STAGED;
+        } else {
+            _release_node(trie, idx);
+        }
     }
 
-    data = _delete(c, *n, key, prefixlen);
-    if ( NULL == data ) {
-        return NULL;
+    /* Front table entries of the new version in the spare table, which no
+       reader uses */
+    if ( NULL != trie->front ) {
+        for ( i = 0; i < txn->nupdates; i++ ) {
+            if ( i + 1 < txn->nupdates
+                 && 0 == _entry_cmp(sorted[i], sorted[i + 1]) ) {
+                continue;
+            }
+            _front_range(trie, trie->front_spare, root, sorted[i]->key,
+                         sorted[i]->prefixlen);
+        }
     }
 
-    if ( (*n)->bit < 0 && NULL == (*n)->data ) {
-        /* n is (becomes) a leaf without data. */
-        *n = NULL;
-        free(*n);
-        if ( NULL != p && NULL == p->left && NULL == p->right ) {
-            /* p becomes a leaf */
-            p->bit = -1;
+    /* Publish the new version with its front table, and retire the replaced
+       nodes */
+    STORE_RELEASE(&trie->root, root);
+    if ( NULL != trie->front ) {
+        front = trie->front;
+        STORE_RELEASE(&trie->front, trie->front_spare);
+        trie->front_spare = front;
+    }
+    for ( i = 0; i < txn->nreplaced; i++ ) {
+        _retire_node(trie, txn->replaced[i]);
+    }
+    _generation_bump(trie);
+
+    /* Bring the former front table to the new version once its readers are
+       gone, as the spare table of the next commit */
+    if ( NULL != trie->front ) {
+        path_compressed_trie_synchronize(trie);
+        for ( i = 0; i < txn->nupdates; i++ ) {
+            if ( i + 1 < txn->nupdates
+                 && 0 == _entry_cmp(sorted[i], sorted[i + 1]) ) {
+                continue;
+            }
+            _front_range(trie, trie->front_spare, root, sorted[i]->key,
+                         sorted[i]->prefixlen);
         }
     }
 
-    return data;
-}
+    _subtree_lock(trie, 0, 0, 0);
+    _epoch_reclaim(trie);
+    free(sorted);
+    path_compressed_trie_txn_abort(txn);
 
-/*
- * Delete the data value corresponding to the key and return it
- */
-void *
-path_compressed_trie_delete(struct path_compressed_trie *trie, uint32_t key,
-                            int prefixlen)
-{
-    return _delete(&trie->root, NULL, key, prefixlen);
+    return n;
 }
 
 /*
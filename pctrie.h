@@ -26,35 +26,526 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 /*
- * Node data structure of radix tree
+ * Node data structure of radix tree: 16 bytes with 32-bit node indices into
+ * the arena.  The data is kept in an array parallel to the nodes so that the
+ * lookup walk touches only the nodes.
  */
 struct path_compressed_trie_node {
-    int bit;
+    /* Key */
+    uint32_t key;
 
-    /* Left child */
-    struct path_compressed_trie_node *left;
+    /* Children (0: left, 1: right); 0 for no child */
+    uint32_t child[2];
 
-    /* Right child */
-    struct path_compressed_trie_node *right;
+    /* Branching bit (-1 for a leaf) and prefix length */
+    int8_t bit;
+    uint8_t prefixlen;
 
-    /* Key */
+    /* Non-zero if data is associated with the node */
+    uint8_t valid;
+
+    /* Flags of the node (PATH_COMPRESSED_TRIE_NODE_*) */
+    uint8_t flags;
+};
+
+/*
+ * Flags of a node: never removed (the top levels of the trie with the
+ * concurrent writers), and copied by the transaction being committed
+ */
+#define PATH_COMPRESSED_TRIE_NODE_PINNED    0x1
+#define PATH_COMPRESSED_TRIE_NODE_STAGED    0x2
+
+/*
+ * Flags for path_compressed_trie_init_flags(): direct-index front table
+ * indexed by the top 16 or 24 bits of the key
+ */
+#define PATH_COMPRESSED_TRIE_FRONT_16       0x1
+#define PATH_COMPRESSED_TRIE_FRONT_24       0x2
+
+/*
+ * Flag for path_compressed_trie_init_flags(): allow concurrent writers.  The
+ * pinned levels make the trie non-empty, so path_compressed_trie_build() adds
+ * the prefixes one by one instead of the linear build.
+ */
+#define PATH_COMPRESSED_TRIE_CONCURRENT     0x4
+
+/*
+ * Number of the top bits of the key to select the subtree lock of the
+ * concurrent writers; the levels above are pre-built and pinned
+ */
+#define PATH_COMPRESSED_TRIE_LOCK_BITS      8
+/*
+ * Number of lookups in flight in a batched lookup
+ */
+#define PATH_COMPRESSED_TRIE_BATCH_WIDTH    16
+
+/*
+ * Instruction sets of the vectorized lookup
+ */
+#define PATH_COMPRESSED_TRIE_SIMD_AUTO      0
+#define PATH_COMPRESSED_TRIE_SIMD_SCALAR    1
+#define PATH_COMPRESSED_TRIE_SIMD_AVX2      2
+#define PATH_COMPRESSED_TRIE_SIMD_AVX512    3
+
+/*
+ * Maximum number of nodes in an arena; the address space for them is
+ * reserved at initialization and committed slab by slab
+ */
+#ifndef PATH_COMPRESSED_TRIE_MAX_NODES
+#define PATH_COMPRESSED_TRIE_MAX_NODES      (1UL << 24)
+#endif
+
+/*
+ * Number of nodes committed at a time
+ */
+#define PATH_COMPRESSED_TRIE_SLAB_NODES     16384
+
+/*
+ * Node arena: nodes are carved from contiguous slabs and addressed by 32-bit
+ * indices (the index 0 is reserved for NULL), and released nodes are kept in
+ * a free list for reuse
+ */
+struct path_compressed_trie_arena {
+    /* Nodes and the corresponding data indexed by the node index */
+    struct path_compressed_trie_node *nodes;
+    void **data;
+
+    /* Number of committed and carved nodes */
+    uint32_t committed;
+    uint32_t carved;
+
+    /* Free list of the released nodes (linked through child[0]) */
+    uint32_t free;
+
+    /* Statistics */
+    size_t nused;
+    size_t nfree;
+    uint64_t allocs;
+    uint64_t frees;
+};
+
+/*
+ * Statistics of the node arena
+ */
+struct path_compressed_trie_arena_stats {
+    /* Number of slabs */
+    size_t slabs;
+    /* Node capacity of the slabs */
+    size_t capacity;
+    /* Nodes in use */
+    size_t used;
+    /* Nodes in the free list */
+    size_t free;
+    /* Nodes retired and waiting for the readers to leave */
+    size_t retired;
+    /* Bytes committed for the nodes and data */
+    size_t bytes;
+    /* Cumulative number of node allocations and releases */
+    uint64_t allocs;
+    uint64_t frees;
+};
+
+/*
+ * Maximum depth of the trie: the prefix lengths strictly increase along the
+ * paths from the root
+ */
+#define PATH_COMPRESSED_TRIE_MAX_DEPTH      33
+
+/*
+ * Shape statistics of the trie
+ */
+struct path_compressed_trie_stats {
+    /* Nodes reachable from the root by kind */
+    size_t nodes;
+    size_t leaves;
+    size_t internals;
+    /* Internal nodes without data (branching nodes), and leaves without data
+       (the pinned levels) */
+    size_t branches;
+    size_t empty_leaves;
+    /* Number of the prefixes */
+    size_t prefixes;
+    /* Number of the nodes at each depth (1 for the root) */
+    size_t depth[PATH_COMPRESSED_TRIE_MAX_DEPTH + 1];
+    /* Number of the prefixes of each length */
+    size_t prefixlen[33];
+    /* Bytes of the reachable nodes and their data, and of the whole trie */
+    size_t bytes;
+    size_t memory;
+    /* Number of the nodes visited by the lookup walk from the root, averaged
+       over the address space, and the worst case */
+    double avg_depth;
+    int max_depth;
+};
+
+/*
+ * Entry of the front table: the node to resume the walk from (0 if the result
+ * is final) and the node of the longest prefix covering the entry
+ */
+struct path_compressed_trie_front_entry {
+    uint32_t node;
+    uint32_t cand;
+} __attribute__((aligned(8)));
+
+/*
+ * Maximum number of reader threads registered at a time
+ */
+#define PATH_COMPRESSED_TRIE_MAX_READERS    64
+
+/*
+ * Reader slot of the epoch-based reclamation, one per reader thread on its
+ * own cache line
+ */
+struct path_compressed_trie_reader {
+    /* Global epoch observed on entering, 0 while quiescent */
+    uint64_t epoch;
+    int used;
+} __attribute__((aligned(64)));
+
+/*
+ * Spinlock on its own cache line
+ */
+struct path_compressed_trie_lock {
+    int locked;
+} __attribute__((aligned(64)));
+
+/*
+ * Nodes retired in an epoch
+ */
+struct path_compressed_trie_limbo {
+    uint32_t *nodes;
+    size_t n;
+    size_t size;
+};
+
+/*
+ * Epoch-based reclamation: a node unlinked by the writer is released to the
+ * arena once the global epoch advanced twice, i.e., once no reader can hold
+ * it any longer
+ */
+struct path_compressed_trie_epoch {
+    uint64_t global;
+    struct path_compressed_trie_reader *readers;
+    /* Number of the reader slots ever used */
+    int nreaders;
+    struct path_compressed_trie_limbo limbo[3];
+    size_t retired;
+};
+
+/*
+ * Data structure for radix tree
+ */
+struct path_compressed_trie {
+    uint32_t root;
+    struct path_compressed_trie_arena arena;
+
+    /* Front table (NULL if disabled) and the number of the bits to index it,
+       and the spare table that a transaction fills before publishing it with
+       the new root (NULL until the first commit) */
+    struct path_compressed_trie_front_entry *front;
+    struct path_compressed_trie_front_entry *front_spare;
+    int front_bits;
+
+    /* Generation bumped by every update to invalidate the lookup caches */
+    uint64_t generation;
+
+    /* Reclamation of the nodes deleted under the concurrent readers */
+    struct path_compressed_trie_epoch epoch;
+
+    /* Subtree locks of the concurrent writers (NULL for a single writer)
+       followed by the lock of the arena and the epochs shared by them */
+    struct path_compressed_trie_lock *locks;
+
+    int _allocated;
+};
+
+/*
+ * Table of the multi-table trie
+ */
+struct path_compressed_trie_table {
+    uint32_t root;
+    /* Number of the prefixes and the nodes in the table */
+    size_t nprefixes;
+    size_t nnodes;
+};
+
+/*
+ * Multi-table trie (VRFs): the tables share the node arena of the trie and
+ * are selected by the table ID in the array of the roots
+ */
+struct path_compressed_trie_vrf {
+    struct path_compressed_trie trie;
+    struct path_compressed_trie_table *tables;
+    uint32_t ntables;
+    int _allocated;
+};
+
+/*
+ * Statistics of a table of the multi-table trie
+ */
+struct path_compressed_trie_table_stats {
+    size_t prefixes;
+    size_t nodes;
+    /* Bytes of the nodes and data */
+    size_t bytes;
+};
+
+/*
+ * Prefix and its data for path_compressed_trie_build()
+ */
+struct path_compressed_trie_prefix_entry {
     uint32_t key;
     int prefixlen;
+    void *data;
+};
 
-    /* Data */
+/*
+ * Transaction staging the updates of the trie (the prefix entries with the
+ * data, or NULL for the withdrawals) and publishing them at once
+ */
+struct path_compressed_trie_txn {
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_prefix_entry *updates;
+    size_t nupdates;
+    size_t size;
+
+    /* Nodes allocated and replaced by the commit */
+    uint32_t *staged;
+    size_t nstaged;
+    size_t staged_size;
+    uint32_t *replaced;
+    size_t nreplaced;
+    size_t replaced_size;
+
+    /* Links from the root to the last updated prefix */
+    uint32_t *path[34];
+    int sp;
+};
+
+/*
+ * Immutable snapshot of the trie compiled into a single contiguous block with
+ * the nodes in the van Emde Boas layout
+ */
+struct path_compressed_trie_snapshot {
+    struct path_compressed_trie_node *nodes;
+    void **data;
+    uint32_t root;
+    /* Number of nodes including the reserved NULL node */
+    uint32_t nnodes;
+    /* Size of the block in bytes */
+    size_t size;
+};
+
+/*
+ * Binary image of the trie mapped from a file
+ */
+struct path_compressed_trie_image {
+    /* Mapped file */
+    const void *base;
+    size_t size;
+    /* Nodes and data in the file */
+    const struct path_compressed_trie_node *nodes;
+    const uint64_t *data;
+    uint32_t root;
+    uint32_t nnodes;
+};
+
+/*
+ * Entry of the lookup cache: the key and its data cached in the cache epoch
+ * of the tag
+ */
+struct path_compressed_trie_cache_entry {
+    uint32_t key;
+    uint32_t tag;
     void *data;
 };
 
 /*
- * Data structure for radix tree
+ * Lookup cache of a thread in front of the trie: 2-way set-associative sets
+ * of the entries (the most recently used first), invalidated as a whole when
+ * the generation of the trie changes
  */
-struct path_compressed_trie {
-    struct path_compressed_trie_node *root;
+struct path_compressed_trie_cache {
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_cache_entry *entries;
+    /* Number of the bits of the set index */
+    int bits;
+
+    /* Generation of the trie last seen, and the tag of the valid entries */
+    uint64_t generation;
+    uint32_t tag;
+
+    /* Counters */
+    uint64_t hits;
+    uint64_t misses;
+};
+
+/*
+ * Node of the path-compressed trie of 128-bit keys (32 bytes); the key is
+ * kept in two 64-bit words, the most significant one first, so that a 64-bit
+ * key is the one with the second word 0
+ */
+struct path_compressed_trie6_node {
+    uint64_t key[2];
+    uint32_t child[2];
+    uint8_t prefixlen;
+    uint8_t valid;
+    uint8_t _reserved[6];
+};
+
+/*
+ * Path-compressed trie of 128-bit keys with prefix lengths up to 128 for IPv6
+ */
+struct path_compressed_trie6 {
+    uint32_t root;
+
+    /* Nodes and data in the arena reserved as path_compressed_trie_arena */
+    struct path_compressed_trie6_node *nodes;
+    void **data;
+    uint32_t committed;
+    uint32_t carved;
+    uint32_t free;
+    size_t nused;
+
+    /* Number of the prefixes */
+    size_t nprefixes;
+
     int _allocated;
 };
 
+/*
+ * Default fill factor to choose the strides of the level-compressed trie
+ */
+#define PATH_COMPRESSED_TRIE_LC_FILL        0.5
+
+/*
+ * Skip record of the level-compressed trie: compares the bits skipped over
+ * and continues to the match entry or the miss entry
+ */
+struct path_compressed_trie_lc_skip {
+    uint32_t key;
+    int prefixlen;
+    uint32_t match;
+    uint32_t miss;
+};
+
+/*
+ * Level-compressed (multibit) trie compiled from the path-compressed trie
+ */
+struct path_compressed_trie_lc {
+    /* Root entry */
+    uint32_t root;
+
+    /* Entries of the multibit nodes */
+    uint32_t *entries;
+    size_t nentries;
+
+    /* Skip records */
+    struct path_compressed_trie_lc_skip *skips;
+    size_t nskips;
+
+    /* Data */
+    void **data;
+    size_t ndata;
+
+    /* Number of multibit nodes and the total size in bytes */
+    size_t nnodes;
+    size_t size;
+};
+
+/*
+ * Keys in a node of the search tree of the interval map (a cache line), and
+ * the maximum number of the levels of the tree
+ */
+#define PATH_COMPRESSED_TRIE_INTERVAL_KEYS      16
+#define PATH_COMPRESSED_TRIE_INTERVAL_LEVELS    8
+
+/*
+ * Interval map compiled from the path-compressed trie: the sorted first
+ * addresses of the intervals of the address space with the same longest
+ * matching prefix, searched through a static k-ary tree of cache-line nodes
+ */
+struct path_compressed_trie_interval {
+    /* Nodes of the tree from the root level to the level 0 of the
+       boundaries, with the keys offset by 2^31 to compare them as signed */
+    uint32_t *keys;
+    /* First node and the number of the nodes of the levels */
+    uint32_t off[PATH_COMPRESSED_TRIE_INTERVAL_LEVELS];
+    uint32_t nnodes[PATH_COMPRESSED_TRIE_INTERVAL_LEVELS];
+    int nlevels;
+
+    /* Data of the intervals */
+    void **data;
+    size_t nbounds;
+
+    /* Instruction set of the search and the total size in bytes */
+    int isa;
+    size_t size;
+};
+
+/*
+ * Bits resolved by the direct-pointing top level of the Poptrie, and the
+ * numbers of the nodes and the leaves reserved for it
+ */
+#define PATH_COMPRESSED_TRIE_POPTRIE_DIRECT_BITS    16
+#define PATH_COMPRESSED_TRIE_POPTRIE_MAX_NODES      (1UL << 22)
+#define PATH_COMPRESSED_TRIE_POPTRIE_MAX_LEAVES     (1UL << 24)
+
+/*
+ * Internal node of the Poptrie resolving 6 bits: the children and the runs of
+ * the leaves of the same data are indexed by the population counts of the
+ * bitmaps below the slot
+ */
+struct path_compressed_trie_poptrie_node {
+    /* Slots with a child */
+    uint64_t vector;
+    /* Slots starting a run of the leaves */
+    uint64_t leafvec;
+    /* First leaf and the first child */
+    uint32_t base0;
+    uint32_t base1;
+};
+
+/*
+ * Poptrie compiled from the path-compressed trie
+ */
+struct path_compressed_trie_poptrie {
+    /* Trie compiled */
+    struct path_compressed_trie *trie;
+
+    /* Direct-pointing entries: an index to the data (tagged in the most
+       significant bit) or a node */
+    uint32_t *dir;
+
+    /* Nodes and leaves (indices to the data) reserved at the build, and the
+       free lists of the blocks by the number of the elements */
+    struct path_compressed_trie_poptrie_node *nodes;
+    uint32_t *leaves;
+    uint32_t ncarved;
+    uint32_t lcarved;
+    size_t nnodes;
+    size_t nleaves;
+    uint32_t nfree[65];
+    uint32_t lfree[65];
+
+    /* Distinct data and their hash table; the data index 0 is NULL.  The
+       references from the leaves and the direct-pointing entries are counted
+       to compact the table when the dead data grow. */
+    void **data;
+    uint32_t *refs;
+    uint32_t ndata;
+    uint32_t nlive;
+    uint32_t data_size;
+    uint32_t *hash;
+    uint32_t hash_size;
+
+    /* Lookup with the popcnt instruction */
+    int popcnt;
+};
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -62,13 +553,152 @@ extern "C" {
     /* in pctrie.c */
     struct path_compressed_trie *
     path_compressed_trie_init(struct path_compressed_trie *);
+    struct path_compressed_trie *
+    path_compressed_trie_init_flags(struct path_compressed_trie *, int);
     void path_compressed_trie_release(struct path_compressed_trie *);
+    size_t path_compressed_trie_memory(struct path_compressed_trie *);
+    struct path_compressed_trie_reader *
+    path_compressed_trie_reader_register(struct path_compressed_trie *);
+    void
+    path_compressed_trie_reader_unregister(struct path_compressed_trie *,
+                                           struct path_compressed_trie_reader
+                                           *);
+    void
+    path_compressed_trie_reader_enter(struct path_compressed_trie *,
+                                      struct path_compressed_trie_reader *);
+    void path_compressed_trie_reader_exit(struct path_compressed_trie_reader *);
+    void path_compressed_trie_synchronize(struct path_compressed_trie *);
     void * path_compressed_trie_lookup(struct path_compressed_trie *, uint32_t);
+    void
+    path_compressed_trie_lookup_batch(struct path_compressed_trie *,
+                                      const uint32_t *, void **, size_t);
     int
     path_compressed_trie_add(struct path_compressed_trie *, uint32_t, int,
                              void *);
+    int
+    path_compressed_trie_build(struct path_compressed_trie *,
+                               const struct path_compressed_trie_prefix_entry *,
+                               size_t);
     void *
     path_compressed_trie_delete(struct path_compressed_trie *, uint32_t, int);
+    void
+    path_compressed_trie_arena_stats(struct path_compressed_trie *,
+                                     struct path_compressed_trie_arena_stats *);
+    void
+    path_compressed_trie_stats(struct path_compressed_trie *,
+                               struct path_compressed_trie_stats *);
+    struct path_compressed_trie_vrf *
+    path_compressed_trie_vrf_init(struct path_compressed_trie_vrf *, uint32_t);
+    void path_compressed_trie_vrf_release(struct path_compressed_trie_vrf *);
+    void *
+    path_compressed_trie_vrf_lookup(struct path_compressed_trie_vrf *,
+                                    uint32_t, uint32_t);
+    int
+    path_compressed_trie_vrf_add(struct path_compressed_trie_vrf *, uint32_t,
+                                 uint32_t, int, void *);
+    void *
+    path_compressed_trie_vrf_delete(struct path_compressed_trie_vrf *,
+                                    uint32_t, uint32_t, int);
+    int
+    path_compressed_trie_vrf_stats(struct path_compressed_trie_vrf *,
+                                   uint32_t,
+                                   struct path_compressed_trie_table_stats *);
+    size_t path_compressed_trie_vrf_memory(struct path_compressed_trie_vrf *);
+    struct path_compressed_trie_txn *
+    path_compressed_trie_txn_begin(struct path_compressed_trie *);
+    int
+    path_compressed_trie_txn_apply(struct path_compressed_trie_txn *, uint32_t,
+                                   int, void *);
+    ssize_t path_compressed_trie_txn_commit(struct path_compressed_trie_txn *);
+    void path_compressed_trie_txn_abort(struct path_compressed_trie_txn *);
+
+    /* in pctrie_simd.c */
+    int path_compressed_trie_simd_set(int);
+    int path_compressed_trie_simd_get(void);
+    void
+    path_compressed_trie_lookup_simd(struct path_compressed_trie *,
+                                     const uint32_t *, void **, size_t);
+
+    /* in pctrie_snapshot.c */
+    struct path_compressed_trie_snapshot *
+    path_compressed_trie_freeze(struct path_compressed_trie *);
+    void
+    path_compressed_trie_snapshot_release(struct path_compressed_trie_snapshot
+                                          *);
+    void *
+    path_compressed_trie_snapshot_lookup(struct path_compressed_trie_snapshot
+                                         *, uint32_t);
+
+    /* in pctrie_lc.c */
+    struct path_compressed_trie_lc *
+    path_compressed_trie_lc_build(struct path_compressed_trie *, double);
+    void path_compressed_trie_lc_release(struct path_compressed_trie_lc *);
+    void *
+    path_compressed_trie_lc_lookup(struct path_compressed_trie_lc *, uint32_t);
+
+    /* in pctrie_interval.c */
+    struct path_compressed_trie_interval *
+    path_compressed_trie_interval_build(struct path_compressed_trie *);
+    void
+    path_compressed_trie_interval_release(struct path_compressed_trie_interval
+                                          *);
+    void *
+    path_compressed_trie_interval_lookup(struct path_compressed_trie_interval
+                                         *, uint32_t);
+
+    /* in pctrie_poptrie.c */
+    struct path_compressed_trie_poptrie *
+    path_compressed_trie_poptrie_build(struct path_compressed_trie *);
+    void
+    path_compressed_trie_poptrie_release(struct path_compressed_trie_poptrie
+                                         *);
+    int
+    path_compressed_trie_poptrie_update(struct path_compressed_trie_poptrie *,
+                                        uint32_t, int);
+    void *
+    path_compressed_trie_poptrie_lookup(struct path_compressed_trie_poptrie *,
+                                        uint32_t);
+    size_t
+    path_compressed_trie_poptrie_memory(struct path_compressed_trie_poptrie *);
+
+    /* in pctrie_cache.c */
+    struct path_compressed_trie_cache *
+    path_compressed_trie_cache_init(struct path_compressed_trie *, size_t);
+    void
+    path_compressed_trie_cache_release(struct path_compressed_trie_cache *);
+    void *
+    path_compressed_trie_cache_lookup(struct path_compressed_trie_cache *,
+                                      uint32_t);
+
+    /* in pctrie_image.c */
+    int path_compressed_trie_save(struct path_compressed_trie *, const char *);
+    struct path_compressed_trie_image *path_compressed_trie_map(const char *);
+    void path_compressed_trie_unmap(struct path_compressed_trie_image *);
+    void *
+    path_compressed_trie_image_lookup(struct path_compressed_trie_image *,
+                                      uint32_t);
+
+    /* in pctrie6.c */
+    struct path_compressed_trie6 *
+    path_compressed_trie6_init(struct path_compressed_trie6 *);
+    void path_compressed_trie6_release(struct path_compressed_trie6 *);
+    void *
+    path_compressed_trie6_lookup(struct path_compressed_trie6 *,
+                                 const uint64_t *);
+    int
+    path_compressed_trie6_add(struct path_compressed_trie6 *, const uint64_t *,
+                              int, void *);
+    void *
+    path_compressed_trie6_delete(struct path_compressed_trie6 *,
+                                 const uint64_t *, int);
+    size_t path_compressed_trie6_memory(struct path_compressed_trie6 *);
+
+    /* in pctrie_rib.c */
+    struct path_compressed_trie_prefix_entry *
+    path_compressed_trie_rib_parse(const char *, size_t *, int);
+    ssize_t
+    path_compressed_trie_rib_load(struct path_compressed_trie *, const char *,
+                                  int);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,396 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "pctrie.h"
+
+#define NODE6(trie, i)      (&(trie)->nodes[(i)])
+
+/* Mask of the bits of a 64-bit word covered by the prefix of b bits from the
+   word (0 <= b, saturated to 64) */
+#define WORD_MASK(b)                                                    \
+    ((b) >= 64 ? ~0ULL : ((b) <= 0 ? 0ULL : ~0ULL << (64 - (b))))
+
+/* Bit next to the prefix of b bits (b < 128) */
+#define NEXT_BIT6(k, b)     (((k)[(b) >> 6] >> (63 - ((b) & 63))) & 1)
+
+/*
+ * Check if the key matches the prefix, word by word
+ */
+static __inline__ int
+_match(const uint64_t *key, const uint64_t *prefix, int prefixlen)
+{
+    return 0 == (((key[0] ^ prefix[0]) & WORD_MASK(prefixlen))
+                 | ((key[1] ^ prefix[1]) & WORD_MASK(prefixlen - 64)));
+}
+
+/*
+ * Position of the first bit differing between the keys (128 if none) with
+ * XOR and count-leading-zeros on the words
+ */
+static __inline__ int
+_diverge(const uint64_t *k0, const uint64_t *k1)
+{
+    uint64_t x;
+
+    x = k0[0] ^ k1[0];
+    if ( 0 != x ) {
+        return __builtin_clzll(x);
+    }
+    x = k0[1] ^ k1[1];
+    if ( 0 != x ) {
+        return 64 + __builtin_clzll(x);
+    }
+
+    return 128;
+}
+
+/*
+ * Commit a new slab of the arena
+ */
+static int
+_grow(struct path_compressed_trie6 *trie)
+{
+    size_t n;
+
+    n = PATH_COMPRESSED_TRIE_SLAB_NODES;
+    if ( trie->committed + n > PATH_COMPRESSED_TRIE_MAX_NODES ) {
+        return -1;
+    }
+    if ( 0 != mprotect(trie->nodes + trie->committed,
+                       sizeof(struct path_compressed_trie6_node) * n,
+                       PROT_READ | PROT_WRITE) ) {
+        return -1;
+    }
+    if ( 0 != mprotect(trie->data + trie->committed, sizeof(void *) * n,
+                       PROT_READ | PROT_WRITE) ) {
+        return -1;
+    }
+    trie->committed += n;
+
+    return 0;
+}
+
+/*
+ * Allocate a node
+ */
+static uint32_t
+_new_node(struct path_compressed_trie6 *trie, const uint64_t *key,
+          int prefixlen, void *data)
+{
+    struct path_compressed_trie6_node *n;
+    uint32_t idx;
+
+    if ( 0 != trie->free ) {
+        /* Reuse a released node */
+        idx = trie->free;
+        trie->free = NODE6(trie, idx)->child[0];
+    } else {
+        if ( trie->carved == trie->committed ) {
+            if ( _grow(trie) < 0 ) {
+                return 0;
+            }
+        }
+        idx = trie->carved++;
+    }
+    trie->nused++;
+
+    /* The key is stored masked by the prefix length */
+    n = NODE6(trie, idx);
+    n->key[0] = key[0] & WORD_MASK(prefixlen);
+    n->key[1] = key[1] & WORD_MASK(prefixlen - 64);
+    n->child[0] = 0;
+    n->child[1] = 0;
+    n->prefixlen = prefixlen;
+    n->valid = (NULL != data);
+    trie->data[idx] = data;
+
+    return idx;
+}
+
+/*
+ * Release a node
+ */
+static void
+_free_node(struct path_compressed_trie6 *trie, uint32_t idx)
+{
+    NODE6(trie, idx)->child[0] = trie->free;
+    trie->data[idx] = NULL;
+    trie->free = idx;
+    trie->nused--;
+}
+
+/*
+ * Initialize the path-compressed trie of 128-bit keys
+ */
+struct path_compressed_trie6 *
+path_compressed_trie6_init(struct path_compressed_trie6 *trie)
+{
+    if ( NULL == trie ) {
+        /* Allocate new data structure */
+        trie = malloc(sizeof(struct path_compressed_trie6));
+        if ( NULL == trie ) {
+            return NULL;
+        }
+        trie->_allocated = 1;
+    } else {
+        trie->_allocated = 0;
+    }
+    trie->root = 0;
+    trie->committed = 0;
+    trie->carved = 1;
+    trie->free = 0;
+    trie->nused = 0;
+    trie->nprefixes = 0;
+
+    /* Reserve the address space of the arena and commit the first slab */
+    trie->nodes = mmap(NULL, sizeof(struct path_compressed_trie6_node)
+                       * PATH_COMPRESSED_TRIE_MAX_NODES, PROT_NONE,
+                       MAP_PRIVATE | MAP_ANON, -1, 0);
+    trie->data = mmap(NULL, sizeof(void *) * PATH_COMPRESSED_TRIE_MAX_NODES,
+                      PROT_NONE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if ( MAP_FAILED == trie->nodes || MAP_FAILED == trie->data
+         || _grow(trie) < 0 ) {
+        if ( MAP_FAILED != trie->nodes ) {
+            munmap(trie->nodes, sizeof(struct path_compressed_trie6_node)
+                   * PATH_COMPRESSED_TRIE_MAX_NODES);
+        }
+        if ( MAP_FAILED != trie->data ) {
+            munmap(trie->data, sizeof(void *)
+                   * PATH_COMPRESSED_TRIE_MAX_NODES);
+        }
+        if ( trie->_allocated ) {
+            free(trie);
+        }
+        return NULL;
+    }
+
+    return trie;
+}
+
+/*
+ * Release the trie
+ */
+void
+path_compressed_trie6_release(struct path_compressed_trie6 *trie)
+{
+    munmap(trie->nodes, sizeof(struct path_compressed_trie6_node)
+           * PATH_COMPRESSED_TRIE_MAX_NODES);
+    munmap(trie->data, sizeof(void *) * PATH_COMPRESSED_TRIE_MAX_NODES);
+    if ( trie->_allocated ) {
+        free(trie);
+    }
+}
+
+/*
+ * Lookup the data corresponding to the key (key[0] holds the most significant
+ * 64 bits)
+ */
+void *
+path_compressed_trie6_lookup(struct path_compressed_trie6 *trie,
+                             const uint64_t *key)
+{
+    const struct path_compressed_trie6_node *n;
+    uint32_t idx;
+    uint32_t cand;
+
+    cand = 0;
+    idx = trie->root;
+    while ( 0 != idx ) {
+        n = NODE6(trie, idx);
+        if ( !_match(key, n->key, n->prefixlen) ) {
+            break;
+        }
+        if ( n->valid ) {
+            cand = idx;
+        }
+        if ( n->prefixlen >= 128 ) {
+            break;
+        }
+        idx = n->child[NEXT_BIT6(key, n->prefixlen)];
+    }
+
+    /* The data of the index 0 is NULL */
+    return trie->data[cand];
+}
+
+/*
+ * Add a data value to the prefix
+ */
+int
+path_compressed_trie6_add(struct path_compressed_trie6 *trie,
+                          const uint64_t *key, int prefixlen, void *data)
+{
+    struct path_compressed_trie6_node *n;
+    uint32_t *cur;
+    uint32_t x;
+    uint32_t b;
+    int d;
+
+    if ( prefixlen < 0 || prefixlen > 128 ) {
+        return -1;
+    }
+
+    cur = &trie->root;
+    while ( 0 != *cur ) {
+        n = NODE6(trie, *cur);
+        d = _diverge(key, n->key);
+        if ( d > prefixlen ) {
+            d = prefixlen;
+        }
+        if ( d >= n->prefixlen ) {
+            /* The node covers the prefix */
+            if ( prefixlen == n->prefixlen ) {
+                if ( n->valid ) {
+                    /* Already exists */
+                    return -1;
+                }
+                trie->data[*cur] = data;
+                n->valid = (NULL != data);
+                trie->nprefixes += (NULL != data);
+                return 0;
+            }
+            cur = &n->child[NEXT_BIT6(key, n->prefixlen)];
+            continue;
+        }
+
+        x = _new_node(trie, key, prefixlen, data);
+        if ( 0 == x ) {
+            return -1;
+        }
+        if ( d == prefixlen ) {
+            /* The new node covers the node */
+            NODE6(trie, x)->child[NEXT_BIT6(n->key, prefixlen)] = *cur;
+            *cur = x;
+        } else {
+            /* Branch at the first differing bit */
+            b = _new_node(trie, key, d, NULL);
+            if ( 0 == b ) {
+                _free_node(trie, x);
+                return -1;
+            }
+            NODE6(trie, b)->child[NEXT_BIT6(key, d)] = x;
+            NODE6(trie, b)->child[NEXT_BIT6(n->key, d)] = *cur;
+            *cur = b;
+        }
+        trie->nprefixes += (NULL != data);
+
+        return 0;
+    }
+
+    x = _new_node(trie, key, prefixlen, data);
+    if ( 0 == x ) {
+        return -1;
+    }
+    *cur = x;
+    trie->nprefixes += (NULL != data);
+
+    return 0;
+}
+
+/*
+ * Delete the prefix and return its data.  The node is removed if it has at
+ * most one child, and so is its parent left as a branching node without data
+ * and with a single child.
+ */
+void *
+path_compressed_trie6_delete(struct path_compressed_trie6 *trie,
+                             const uint64_t *key, int prefixlen)
+{
+    struct path_compressed_trie6_node *n;
+    struct path_compressed_trie6_node *p;
+    uint32_t *cur;
+    uint32_t *parent;
+    uint32_t idx;
+    void *data;
+
+    if ( prefixlen < 0 || prefixlen > 128 ) {
+        return NULL;
+    }
+
+    /* Find the node keeping the link to its parent */
+    parent = NULL;
+    cur = &trie->root;
+    while ( 0 != *cur ) {
+        n = NODE6(trie, *cur);
+        if ( n->prefixlen > prefixlen || !_match(key, n->key, n->prefixlen) ) {
+            return NULL;
+        }
+        if ( n->prefixlen == prefixlen ) {
+            break;
+        }
+        parent = cur;
+        cur = &n->child[NEXT_BIT6(key, n->prefixlen)];
+    }
+    if ( 0 == *cur || !NODE6(trie, *cur)->valid ) {
+        return NULL;
+    }
+    idx = *cur;
+    n = NODE6(trie, idx);
+    data = trie->data[idx];
+    trie->data[idx] = NULL;
+    n->valid = 0;
+    trie->nprefixes--;
+
+    if ( 0 != n->child[0] && 0 != n->child[1] ) {
+        /* Remains as a branching node */
+        return data;
+    }
+    /* Replace the node with its child (if any) */
+    *cur = n->child[0] | n->child[1];
+    _free_node(trie, idx);
+
+    if ( NULL != parent && 0 == *cur ) {
+        /* The parent may be left with a single child */
+        p = NODE6(trie, *parent);
+        if ( !p->valid ) {
+            idx = *parent;
+            *parent = p->child[0] | p->child[1];
+            _free_node(trie, idx);
+        }
+    }
+
+    return data;
+}
+
+/*
+ * Get the memory usage of the trie in bytes
+ */
+size_t
+path_compressed_trie6_memory(struct path_compressed_trie6 *trie)
+{
+    return sizeof(struct path_compressed_trie6) + trie->committed
+        * (sizeof(struct path_compressed_trie6_node) + sizeof(void *));
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,143 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pctrie.h"
+#include "pctrie_internal.h"
+
+/* Number of the ways of a set */
+#define CACHE_WAYS          2
+
+/*
+ * Initialize a lookup cache of about the number of the entries (rounded up
+ * to a power of two) in front of the trie.  A cache is used by a single
+ * thread; each thread looking up the trie has its own one.
+ */
+struct path_compressed_trie_cache *
+path_compressed_trie_cache_init(struct path_compressed_trie *trie,
+                                size_t nentries)
+{
+    struct path_compressed_trie_cache *cache;
+    int bits;
+
+    bits = 0;
+    while ( ((size_t)CACHE_WAYS << bits) < nentries && bits < 24 ) {
+        bits++;
+    }
+
+    cache = malloc(sizeof(struct path_compressed_trie_cache));
+    if ( NULL == cache ) {
+        return NULL;
+    }
+    cache->entries = calloc((size_t)CACHE_WAYS << bits,
+                            sizeof(struct path_compressed_trie_cache_entry));
+    if ( NULL == cache->entries ) {
+        free(cache);
+        return NULL;
+    }
+    cache->trie = trie;
+    cache->bits = bits;
+    /* The cleared entries of the tag 0 never hit */
+    cache->generation = LOAD_ACQUIRE(&trie->generation);
+    cache->tag = 1;
+    cache->hits = 0;
+    cache->misses = 0;
+
+    return cache;
+}
+
+/*
+ * Release the lookup cache
+ */
+void
+path_compressed_trie_cache_release(struct path_compressed_trie_cache *cache)
+{
+    free(cache->entries);
+    free(cache);
+}
+
+/*
+ * Lookup the data corresponding to the key through the cache.  The entries
+ * cached before an update of the trie are invalidated at once by moving to
+ * the next tag when the generation of the trie changes; the entries are
+ * cleared only when the tag wraps around.
+ */
+void *
+path_compressed_trie_cache_lookup(struct path_compressed_trie_cache *cache,
+                                  uint32_t key)
+{
+    struct path_compressed_trie_cache_entry *set;
+    struct path_compressed_trie_cache_entry e;
+    uint64_t generation;
+    uint32_t idx;
+
+    /* The generation is loaded before the walk, so that the result of the
+       walk racing with an update is tagged as stale */
+    generation = LOAD_ACQUIRE(&cache->trie->generation);
+    if ( generation != cache->generation ) {
+        cache->generation = generation;
+        cache->tag++;
+        if ( 0 == cache->tag ) {
+            memset(cache->entries, 0,
+                   sizeof(struct path_compressed_trie_cache_entry)
+                   * ((size_t)CACHE_WAYS << cache->bits));
+            cache->tag = 1;
+        }
+    }
+
+    /* Multiplicative hash of the key to the set */
+    idx = cache->bits ? (key * 2654435761U) >> (32 - cache->bits) : 0;
+    set = &cache->entries[(size_t)CACHE_WAYS * idx];
+    if ( set[0].key == key && set[0].tag == cache->tag ) {
+        cache->hits++;
+        return set[0].data;
+    }
+    if ( set[1].key == key && set[1].tag == cache->tag ) {
+        /* Move to the most recently used way */
+        cache->hits++;
+        e = set[1];
+        set[1] = set[0];
+        set[0] = e;
+        return e.data;
+    }
+
+    /* Evict the least recently used way */
+    cache->misses++;
+    set[1] = set[0];
+    set[0].key = key;
+    set[0].tag = cache->tag;
+    set[0].data = path_compressed_trie_lookup(cache->trie, key);
+
+    return set[0].data;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
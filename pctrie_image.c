@@ -0,0 +1,301 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pctrie.h"
+#include "pctrie_internal.h"
+
+/*
+ * Binary image of the trie:
+ *   header (IMAGE_HEADER_SIZE bytes)
+ *   nodes of the snapshot in the van Emde Boas layout (16 bytes each), whose
+ *   children are the indices in the node array
+ *   data of the nodes as 64-bit integers
+ * All the fields are in the host byte order; the magic does not match on a
+ * host of the other byte order.
+ */
+#define IMAGE_MAGIC         0x4549525443504e49ULL   /* "INPCTRIE" */
+#define IMAGE_VERSION       1
+#define IMAGE_HEADER_SIZE   64
+
+struct _image_header {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    /* Number of the nodes including the NULL node, and the root */
+    uint32_t nnodes;
+    uint32_t root;
+    /* Offsets of the node and data arrays, and the size of the image */
+    uint64_t nodes_off;
+    uint64_t data_off;
+    uint64_t size;
+    /* Checksum of the image following the header */
+    uint64_t checksum;
+};
+
+/*
+ * Fletcher-style checksum over 32-bit words
+ */
+static uint64_t
+_checksum(const void *buf, size_t len)
+{
+    const uint32_t *w;
+    uint64_t a;
+    uint64_t b;
+    size_t i;
+
+    w = buf;
+    a = 1;
+    b = 0;
+    for ( i = 0; i < len / 4; i++ ) {
+        a += w[i];
+        b += a;
+    }
+
+    return (b << 32) ^ a ^ (len << 1);
+}
+
+/*
+ * Verify the nodes so that the walk on them stays in the node array and
+ * terminates: the children are in the array, and the prefix of a child is
+ * longer than the one of the parent (and the branching bit is past it)
+ */
+static int
+_verify_nodes(const struct path_compressed_trie_node *nodes, uint32_t nnodes)
+{
+    const struct path_compressed_trie_node *n;
+    const struct path_compressed_trie_node *c;
+    uint32_t i;
+    int k;
+
+    for ( i = 1; i < nnodes; i++ ) {
+        n = &nodes[i];
+        if ( n->prefixlen > 32 || n->bit < -1 || n->bit > 32
+             || (n->bit >= 0 && n->bit != n->prefixlen) ) {
+            return -1;
+        }
+        for ( k = 0; k < 2; k++ ) {
+            if ( 0 == n->child[k] ) {
+                continue;
+            }
+            if ( n->child[k] >= nnodes ) {
+                return -1;
+            }
+            c = &nodes[n->child[k]];
+            if ( c->prefixlen <= n->prefixlen || c->bit > 32
+                 || (c->bit >= 0 && c->bit <= n->bit) ) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Save the binary image of the trie to the file.  The image is written to a
+ * temporary file and renamed so that the file is replaced atomically.  The
+ * data are saved as 64-bit integers (e.g., next hops), not as pointers.
+ */
+int
+path_compressed_trie_save(struct path_compressed_trie *trie, const char *path)
+{
+    struct path_compressed_trie_snapshot *snap;
+    struct _image_header hdr;
+    char tmp[4096];
+    uint64_t *data;
+    size_t nsize;
+    size_t dsize;
+    uint32_t i;
+    FILE *fp;
+    int ret;
+
+    if ( (size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp) ) {
+        return -1;
+    }
+
+    /* Compact the nodes into the snapshot */
+    snap = path_compressed_trie_freeze(trie);
+    if ( NULL == snap ) {
+        return -1;
+    }
+    nsize = sizeof(struct path_compressed_trie_node) * snap->nnodes;
+    dsize = sizeof(uint64_t) * snap->nnodes;
+    data = malloc(dsize);
+    if ( NULL == data ) {
+        path_compressed_trie_snapshot_release(snap);
+        return -1;
+    }
+    for ( i = 0; i < snap->nnodes; i++ ) {
+        data[i] = (uint64_t)(uintptr_t)snap->data[i];
+    }
+
+    /* Header; the checksum covers the node and data arrays */
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.magic = IMAGE_MAGIC;
+    hdr.version = IMAGE_VERSION;
+    hdr.header_size = IMAGE_HEADER_SIZE;
+    hdr.nnodes = snap->nnodes;
+    hdr.root = snap->root;
+    hdr.nodes_off = IMAGE_HEADER_SIZE;
+    hdr.data_off = IMAGE_HEADER_SIZE + nsize;
+    hdr.size = IMAGE_HEADER_SIZE + nsize + dsize;
+    hdr.checksum = _checksum(snap->nodes, nsize)
+        ^ (_checksum(data, dsize) * 31);
+
+    ret = -1;
+    fp = fopen(tmp, "wb");
+    if ( NULL != fp ) {
+        if ( 1 == fwrite(&hdr, sizeof(hdr), 1, fp)
+             && 0 == fseek(fp, IMAGE_HEADER_SIZE, SEEK_SET)
+             && 1 == fwrite(snap->nodes, nsize, 1, fp)
+             && 1 == fwrite(data, dsize, 1, fp) ) {
+            ret = 0;
+        }
+        if ( 0 != fclose(fp) ) {
+            ret = -1;
+        }
+        if ( 0 == ret && 0 != rename(tmp, path) ) {
+            ret = -1;
+        }
+        if ( ret < 0 ) {
+            unlink(tmp);
+        }
+    }
+    free(data);
+    path_compressed_trie_snapshot_release(snap);
+
+    return ret;
+}
+
+/*
+ * Map the binary image saved by path_compressed_trie_save().  The header, the
+ * checksum and the links of the nodes are verified, and the lookups run on the
+ * mapped file without parsing or copying.
+ */
+struct path_compressed_trie_image *
+path_compressed_trie_map(const char *path)
+{
+    struct path_compressed_trie_image *img;
+    const struct _image_header *hdr;
+    struct stat st;
+    const uint8_t *base;
+    size_t nsize;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    if ( 0 != fstat(fd, &st) || (size_t)st.st_size < IMAGE_HEADER_SIZE ) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if ( MAP_FAILED == base ) {
+        return NULL;
+    }
+
+    /* Verify the header */
+    hdr = (const struct _image_header *)base;
+    nsize = sizeof(struct path_compressed_trie_node) * (size_t)hdr->nnodes;
+    if ( IMAGE_MAGIC != hdr->magic || IMAGE_VERSION != hdr->version
+         || IMAGE_HEADER_SIZE != hdr->header_size
+         || hdr->size != (uint64_t)st.st_size || hdr->nnodes < 1
+         || hdr->root >= hdr->nnodes
+         || IMAGE_HEADER_SIZE != hdr->nodes_off
+         || hdr->data_off != hdr->nodes_off + nsize
+         || hdr->size != hdr->data_off + sizeof(uint64_t) * hdr->nnodes ) {
+        munmap((void *)base, st.st_size);
+        return NULL;
+    }
+
+    /* Verify the checksum */
+    if ( hdr->checksum
+         != (_checksum(base + hdr->nodes_off, nsize)
+             ^ (_checksum(base + hdr->data_off,
+                          sizeof(uint64_t) * hdr->nnodes) * 31)) ) {
+        munmap((void *)base, st.st_size);
+        return NULL;
+    }
+
+    /* Verify the nodes walked by the lookups */
+    if ( _verify_nodes((const struct path_compressed_trie_node *)
+                       (base + hdr->nodes_off), hdr->nnodes) < 0 ) {
+        munmap((void *)base, st.st_size);
+        return NULL;
+    }
+
+    img = malloc(sizeof(struct path_compressed_trie_image));
+    if ( NULL == img ) {
+        munmap((void *)base, st.st_size);
+        return NULL;
+    }
+    img->base = base;
+    img->size = st.st_size;
+    img->nodes = (const struct path_compressed_trie_node *)
+        (base + hdr->nodes_off);
+    img->data = (const uint64_t *)(base + hdr->data_off);
+    img->root = hdr->root;
+    img->nnodes = hdr->nnodes;
+
+    return img;
+}
+
+/*
+ * Unmap the image
+ */
+void
+path_compressed_trie_unmap(struct path_compressed_trie_image *img)
+{
+    munmap((void *)img->base, img->size);
+    free(img);
+}
+
+/*
+ * Lookup the data corresponding to the key in the image
+ */
+void *
+path_compressed_trie_image_lookup(struct path_compressed_trie_image *img,
+                                  uint32_t key)
+{
+    return (void *)(uintptr_t)
+        img->data[_pctrie_walk(img->nodes, img->root, 0, key)];
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
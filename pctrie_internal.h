@@ -0,0 +1,78 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef _PATH_COMPRESSED_TRIE_INTERNAL_H
+#define _PATH_COMPRESSED_TRIE_INTERNAL_H
+
+#include <stdint.h>
+#include "pctrie.h"
+
+#define BIT_TEST(k, b)  ((k) & (0x80000000ULL >> (b)))
+#define BIT_PREFIX(k, b)    (((uint64_t)(k) >> (32 - (b))) << (32 - (b)))
+#define PREFIX_MASK(b)      ((uint32_t)(0xffffffff00000000ULL >> (b)))
+
+/* Bit next to the prefix, i.e., the bit to select the child */
+#define NEXT_BIT(k, b)      ((uint32_t)(((uint64_t)(k) << (b)) >> 31) & 1)
+
+/* Publish a field modified by the writer to the concurrent readers, and read
+   it on the reader side */
+#define STORE_RELEASE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define LOAD_ACQUIRE(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+
+/*
+ * Walk down the nodes from idx and return the index of the node with the
+ * longest matching prefix (cand if not found below idx)
+ */
+static __inline__ uint32_t
+_pctrie_walk(const struct path_compressed_trie_node *nodes, uint32_t idx,
+             uint32_t cand, uint32_t key)
+{
+    const struct path_compressed_trie_node *cur;
+
+    while ( 0 != idx ) {
+        cur = &nodes[idx];
+        if ( (key ^ cur->key) & PREFIX_MASK(cur->prefixlen) ) {
+            break;
+        }
+        /* The prefix of the current node matches the key */
+        if ( LOAD_ACQUIRE(&cur->valid) ) {
+            cand = idx;
+        }
+        /* Select the child by the bit next to the prefix (the branching bit
+           of an internal node); no child at a leaf */
+        idx = LOAD_ACQUIRE(&cur->child[NEXT_BIT(key, cur->prefixlen)]);
+    }
+
+    return cand;
+}
+
+#endif /* _PATH_COMPRESSED_TRIE_INTERNAL_H */
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,370 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pctrie.h"
+#include "pctrie_internal.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PCTRIE_INTERVAL_X86 1
+#include <immintrin.h>
+#endif
+
+/*
+ * The boundaries are the first addresses of the intervals, the first one
+ * being 0, and a key is looked up by the last boundary not greater than the
+ * key.  The boundaries are split into the nodes of the level 0, and a node of
+ * the level l + 1 holds the first keys of its children but the first one, so
+ * that the number of the keys not greater than the key in a node is the child
+ * to descend to.  The unused keys are padded with the largest key.
+ */
+#define INTERVAL_KEYS       PATH_COMPRESSED_TRIE_INTERVAL_KEYS
+#define INTERVAL_FANOUT     (PATH_COMPRESSED_TRIE_INTERVAL_KEYS + 1)
+#define INTERVAL_BIAS       0x80000000U
+#define INTERVAL_ALIGN      64
+
+/*
+ * Working data to build the interval map
+ */
+struct _interval_build {
+    uint32_t *bounds;
+    void **data;
+    size_t n;
+};
+
+/*
+ * Start an interval of the data at the address, merging the intervals of
+ * the same data and replacing an empty interval at the same address
+ */
+static void
+_interval_emit(struct _interval_build *bd, uint64_t addr, void *data)
+{
+    if ( addr > 0xffffffffULL ) {
+        /* Beyond the address space */
+        return;
+    }
+    if ( bd->n > 0 && bd->bounds[bd->n - 1] == addr ) {
+        bd->n--;
+    }
+    if ( bd->n > 0 && bd->data[bd->n - 1] == data ) {
+        return;
+    }
+    bd->bounds[bd->n] = addr;
+    bd->data[bd->n] = data;
+    bd->n++;
+}
+
+/*
+ * Sweep the prefixes in the order of the key (then the prefix length) with a
+ * pre-order traversal, keeping the stack of the prefixes covering the current
+ * address
+ */
+static int
+_interval_collect(struct _interval_build *bd,
+                  struct path_compressed_trie *trie)
+{
+    struct path_compressed_trie_node *n;
+    uint32_t stack[64];
+    uint64_t end[PATH_COMPRESSED_TRIE_MAX_DEPTH + 1];
+    void *data[PATH_COMPRESSED_TRIE_MAX_DEPTH + 1];
+    uint64_t start;
+    uint32_t idx;
+    size_t size;
+    int sp;
+    int cp;
+
+    /* A prefix adds at most two boundaries */
+    size = 2 * trie->arena.nused + 1;
+    bd->bounds = malloc(sizeof(uint32_t) * size);
+    bd->data = malloc(sizeof(void *) * size);
+    if ( NULL == bd->bounds || NULL == bd->data ) {
+        return -1;
+    }
+    bd->n = 0;
+    _interval_emit(bd, 0, NULL);
+
+    cp = 0;
+    sp = 0;
+    if ( 0 != trie->root ) {
+        stack[sp++] = trie->root;
+    }
+    while ( sp > 0 ) {
+        idx = stack[--sp];
+        n = &trie->arena.nodes[idx];
+        if ( n->valid ) {
+            /* Close the prefixes ending before this one */
+            start = n->key & PREFIX_MASK(n->prefixlen);
+            while ( cp > 0 && end[cp - 1] < start ) {
+                cp--;
+                _interval_emit(bd, end[cp] + 1, cp > 0 ? data[cp - 1] : NULL);
+            }
+            end[cp] = start | (0xffffffffULL >> n->prefixlen);
+            data[cp] = trie->arena.data[idx];
+            cp++;
+            _interval_emit(bd, start, trie->arena.data[idx]);
+        }
+        /* Visit the left child first */
+        if ( 0 != n->child[1] ) {
+            stack[sp++] = n->child[1];
+        }
+        if ( 0 != n->child[0] ) {
+            stack[sp++] = n->child[0];
+        }
+    }
+    while ( cp > 0 ) {
+        cp--;
+        _interval_emit(bd, end[cp] + 1, cp > 0 ? data[cp - 1] : NULL);
+    }
+
+    return 0;
+}
+
+/*
+ * Build the interval map from the trie
+ */
+struct path_compressed_trie_interval *
+path_compressed_trie_interval_build(struct path_compressed_trie *trie)
+{
+    struct path_compressed_trie_interval *im;
+    struct _interval_build bd;
+    uint32_t *keys;
+    uint32_t *first;
+    uint32_t total;
+    uint32_t c;
+    size_t i;
+    size_t j;
+    int l;
+
+    im = malloc(sizeof(struct path_compressed_trie_interval));
+    if ( NULL == im ) {
+        return NULL;
+    }
+    memset(im, 0, sizeof(struct path_compressed_trie_interval));
+    memset(&bd, 0, sizeof(struct _interval_build));
+    if ( _interval_collect(&bd, trie) < 0 ) {
+        free(bd.bounds);
+        free(bd.data);
+        free(im);
+        return NULL;
+    }
+    im->data = bd.data;
+    im->nbounds = bd.n;
+
+    /* Number of the nodes of the levels */
+    im->nnodes[0] = (bd.n + INTERVAL_KEYS - 1) / INTERVAL_KEYS;
+    for ( l = 0; im->nnodes[l] > 1; l++ ) {
+        if ( l + 1 >= PATH_COMPRESSED_TRIE_INTERVAL_LEVELS ) {
+            free(bd.bounds);
+            path_compressed_trie_interval_release(im);
+            return NULL;
+        }
+        im->nnodes[l + 1] = (im->nnodes[l] + INTERVAL_FANOUT - 1)
+            / INTERVAL_FANOUT;
+    }
+    im->nlevels = l + 1;
+    total = 0;
+    for ( l = im->nlevels - 1; l >= 0; l-- ) {
+        im->off[l] = total;
+        total += im->nnodes[l];
+    }
+    if ( 0 != posix_memalign((void **)&im->keys, INTERVAL_ALIGN,
+                             sizeof(uint32_t) * INTERVAL_KEYS * total) ) {
+        im->keys = NULL;
+        free(bd.bounds);
+        path_compressed_trie_interval_release(im);
+        return NULL;
+    }
+
+    /* Level 0: the boundaries */
+    keys = im->keys + (size_t)im->off[0] * INTERVAL_KEYS;
+    for ( i = 0; i < (size_t)im->nnodes[0] * INTERVAL_KEYS; i++ ) {
+        keys[i] = (i < bd.n ? bd.bounds[i] : 0xffffffffU) ^ INTERVAL_BIAS;
+    }
+
+    /* Upper levels from the first keys of the nodes of the level below,
+       computed in place in the boundaries */
+    first = bd.bounds;
+    for ( i = 0; i < im->nnodes[0]; i++ ) {
+        first[i] = keys[i * INTERVAL_KEYS];
+    }
+    for ( l = 1; l < im->nlevels; l++ ) {
+        keys = im->keys + (size_t)im->off[l] * INTERVAL_KEYS;
+        for ( i = 0; i < im->nnodes[l]; i++ ) {
+            for ( j = 0; j < INTERVAL_KEYS; j++ ) {
+                c = i * INTERVAL_FANOUT + j + 1;
+                keys[i * INTERVAL_KEYS + j] = c < im->nnodes[l - 1]
+                    ? first[c] : 0xffffffffU ^ INTERVAL_BIAS;
+            }
+            first[i] = first[i * INTERVAL_FANOUT];
+        }
+    }
+    free(bd.bounds);
+
+    im->isa = path_compressed_trie_simd_get();
+    im->size = sizeof(uint32_t) * INTERVAL_KEYS * total
+        + sizeof(void *) * im->nbounds;
+
+    return im;
+}
+
+/*
+ * Release the interval map
+ */
+void
+path_compressed_trie_interval_release(struct path_compressed_trie_interval *im)
+{
+    free(im->keys);
+    free(im->data);
+    free(im);
+}
+
+/*
+ * Number of the keys not greater than the key x (offset by 2^31) in a node
+ */
+static __inline__ uint32_t
+_count_scalar(const uint32_t *keys, int32_t x)
+{
+    uint32_t c;
+    int i;
+
+    c = 0;
+    for ( i = 0; i < INTERVAL_KEYS; i++ ) {
+        c += ((int32_t)keys[i] <= x);
+    }
+
+    return c;
+}
+
+#if PCTRIE_INTERVAL_X86
+__attribute__((target("avx2,popcnt")))
+static __inline__ uint32_t
+_count_avx2(const uint32_t *keys, __m256i vx)
+{
+    __m256i gt0;
+    __m256i gt1;
+    uint32_t m;
+
+    gt0 = _mm256_cmpgt_epi32(_mm256_load_si256((const __m256i *)keys), vx);
+    gt1 = _mm256_cmpgt_epi32(_mm256_load_si256((const __m256i *)(keys + 8)),
+                             vx);
+    m = (uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(gt0))
+        | ((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps(gt1)) << 8);
+
+    return INTERVAL_KEYS - __builtin_popcount(m);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static __inline__ uint32_t
+_count_avx512(const uint32_t *keys, __m512i vx)
+{
+    return __builtin_popcount(
+        _mm512_cmple_epi32_mask(_mm512_load_si512((const void *)keys), vx));
+}
+#endif
+
+/*
+ * Descend the levels with the count of the keys not greater than the key in
+ * the nodes, and return the data of the boundary in the node of the level 0.
+ * The count exceeds the last child (or boundary) only on the padding, i.e.,
+ * for the largest key, and is then clamped to it.
+ */
+#define INTERVAL_SEARCH(im, count, x)                                   \
+    do {                                                                \
+        uint32_t _node;                                                 \
+        uint32_t _last;                                                 \
+        size_t _i;                                                      \
+        int _l;                                                         \
+                                                                        \
+        _node = 0;                                                      \
+        for ( _l = (im)->nlevels - 1; _l > 0; _l-- ) {                  \
+            _node = _node * INTERVAL_FANOUT                             \
+                + count((im)->keys + (size_t)((im)->off[_l] + _node)    \
+                        * INTERVAL_KEYS, (x));                          \
+            _last = (im)->nnodes[_l - 1] - 1;                           \
+            _node = _node < _last ? _node : _last;                      \
+        }                                                               \
+        _i = (size_t)_node * INTERVAL_KEYS                              \
+            + count((im)->keys + (size_t)((im)->off[0] + _node)         \
+                    * INTERVAL_KEYS, (x)) - 1;                          \
+        _i = _i < (im)->nbounds ? _i : (im)->nbounds - 1;               \
+        return (im)->data[_i];                                          \
+    } while ( 0 )
+
+static void *
+_lookup_scalar(struct path_compressed_trie_interval *im, uint32_t key)
+{
+    INTERVAL_SEARCH(im, _count_scalar, (int32_t)(key ^ INTERVAL_BIAS));
+}
+
+#if PCTRIE_INTERVAL_X86
+__attribute__((target("avx2,popcnt")))
+static void *
+_lookup_avx2(struct path_compressed_trie_interval *im, uint32_t key)
+{
+    __m256i vx;
+
+    vx = _mm256_set1_epi32(key ^ INTERVAL_BIAS);
+    INTERVAL_SEARCH(im, _count_avx2, vx);
+}
+
+__attribute__((target("avx512f,popcnt")))
+static void *
+_lookup_avx512(struct path_compressed_trie_interval *im, uint32_t key)
+{
+    __m512i vx;
+
+    vx = _mm512_set1_epi32(key ^ INTERVAL_BIAS);
+    INTERVAL_SEARCH(im, _count_avx512, vx);
+}
+#endif
+
+/*
+ * Lookup the data corresponding to the key in the interval map with the
+ * instruction set selected when it was built
+ */
+void *
+path_compressed_trie_interval_lookup(struct path_compressed_trie_interval *im,
+                                     uint32_t key)
+{
+    switch ( im->isa ) {
+#if PCTRIE_INTERVAL_X86
+    case PATH_COMPRESSED_TRIE_SIMD_AVX512:
+        return _lookup_avx512(im, key);
+    case PATH_COMPRESSED_TRIE_SIMD_AVX2:
+        return _lookup_avx2(im, key);
+#endif
+    default:
+        return _lookup_scalar(im, key);
+    }
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
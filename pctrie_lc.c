@@ -0,0 +1,437 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pctrie.h"
+#include "pctrie_internal.h"
+
+/*
+ * An entry is a 32-bit word tagged in the two most significant bits:
+ *   leaf: index to the data (the best matching prefix is pushed to leaves)
+ *   node: stride - 1 (4 bits) and the base index of the 2^stride entries
+ *   skip: index to a skip record that compares the bits skipped over
+ */
+#define LC_LEAF             0
+#define LC_NODE             1
+#define LC_SKIP             2
+#define LC_TYPE(e)          ((e) >> 30)
+#define LC_INDEX(e)         ((e) & 0x3fffffff)
+#define LC_ENTRY(t, i)      (((uint32_t)(t) << 30) | (i))
+#define LC_NODE_STRIDE(e)   ((((e) >> 26) & 0xf) + 1)
+#define LC_NODE_BASE(e)     ((e) & 0x3ffffff)
+#define LC_NODE_ENTRY(s, b) \
+    (LC_ENTRY(LC_NODE, 0) | ((uint32_t)((s) - 1) << 26) | (b))
+#define LC_NODE_BASE_MAX    (1UL << 26)
+
+/* Maximum strides of the root and the other nodes */
+#define LC_ROOT_STRIDE_MAX  16
+#define LC_STRIDE_MAX       8
+
+/*
+ * Prefix to build the trie from
+ */
+struct _lc_prefix {
+    uint32_t key;
+    int prefixlen;
+    /* Index to the data */
+    uint32_t data;
+};
+
+/*
+ * Working data to build the level-compressed trie
+ */
+struct _lc_build {
+    struct path_compressed_trie_lc *lc;
+    struct _lc_prefix *prefixes;
+    size_t n;
+    double fill;
+    size_t entries_size;
+    size_t skips_size;
+};
+
+/*
+ * Collect the prefixes from the trie in the order of the key (then the prefix
+ * length) with a pre-order traversal
+ */
+static int
+_lc_collect(struct _lc_build *bd, struct path_compressed_trie *trie)
+{
+    struct path_compressed_trie_node *n;
+    uint32_t stack[64];
+    int sp;
+    uint32_t idx;
+    size_t nvalid;
+
+    /* Count the prefixes */
+    nvalid = trie->arena.nused;
+    bd->prefixes = malloc(sizeof(struct _lc_prefix) * (nvalid + 1));
+    bd->lc->data = malloc(sizeof(void *) * (nvalid + 1));
+    if ( NULL == bd->prefixes || NULL == bd->lc->data ) {
+        return -1;
+    }
+    /* The data index 0 is NULL */
+    bd->lc->data[0] = NULL;
+    bd->lc->ndata = 1;
+    bd->n = 0;
+
+    sp = 0;
+    if ( 0 != trie->root ) {
+        stack[sp++] = trie->root;
+    }
+    while ( sp > 0 ) {
+        idx = stack[--sp];
+        n = &trie->arena.nodes[idx];
+        if ( n->valid ) {
+            bd->prefixes[bd->n].key = n->key & PREFIX_MASK(n->prefixlen);
+            bd->prefixes[bd->n].prefixlen = n->prefixlen;
+            bd->prefixes[bd->n].data = bd->lc->ndata;
+            bd->lc->data[bd->lc->ndata] = trie->arena.data[idx];
+            bd->lc->ndata++;
+            bd->n++;
+        }
+        /* Visit the left child first */
+        if ( 0 != n->child[1] ) {
+            stack[sp++] = n->child[1];
+        }
+        if ( 0 != n->child[0] ) {
+            stack[sp++] = n->child[0];
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Allocate entries
+ */
+static int64_t
+_lc_alloc_entries(struct _lc_build *bd, size_t n)
+{
+    uint32_t *entries;
+    size_t size;
+    size_t base;
+
+    if ( bd->lc->nentries + n > LC_NODE_BASE_MAX ) {
+        return -1;
+    }
+    if ( bd->lc->nentries + n > bd->entries_size ) {
+        size = bd->entries_size ? bd->entries_size * 2 : 65536;
+        while ( size < bd->lc->nentries + n ) {
+            size *= 2;
+        }
+        entries = realloc(bd->lc->entries, sizeof(uint32_t) * size);
+        if ( NULL == entries ) {
+            return -1;
+        }
+        bd->lc->entries = entries;
+        bd->entries_size = size;
+    }
+    base = bd->lc->nentries;
+    bd->lc->nentries += n;
+
+    return base;
+}
+
+/*
+ * Allocate a skip record
+ */
+static int64_t
+_lc_alloc_skip(struct _lc_build *bd)
+{
+    struct path_compressed_trie_lc_skip *skips;
+    size_t size;
+
+    if ( bd->lc->nskips + 1 > bd->skips_size ) {
+        size = bd->skips_size ? bd->skips_size * 2 : 4096;
+        skips = realloc(bd->lc->skips,
+                        sizeof(struct path_compressed_trie_lc_skip) * size);
+        if ( NULL == skips ) {
+            return -1;
+        }
+        bd->lc->skips = skips;
+        bd->skips_size = size;
+    }
+
+    return bd->lc->nskips++;
+}
+
+/*
+ * Choose the stride of the node at the depth d: the largest one with which at
+ * least the fill factor of the entries are occupied by the prefixes
+ */
+static int
+_lc_stride(struct _lc_build *bd, size_t lo, size_t hi, int d)
+{
+    struct _lc_prefix *p;
+    size_t occupied;
+    uint32_t first;
+    uint32_t last;
+    uint32_t end;
+    size_t j;
+    int smax;
+    int s;
+
+    smax = 0 == d ? LC_ROOT_STRIDE_MAX : LC_STRIDE_MAX;
+    if ( smax > 32 - d ) {
+        smax = 32 - d;
+    }
+    for ( s = smax; s > 1; s-- ) {
+        /* Count the entries covered by the prefixes */
+        occupied = 0;
+        end = 0;
+        for ( j = lo; j < hi; j++ ) {
+            p = &bd->prefixes[j];
+            first = (uint32_t)(p->key << d) >> (32 - s);
+            if ( p->prefixlen >= d + s ) {
+                last = first + 1;
+            } else {
+                last = first + (1U << (d + s - p->prefixlen));
+            }
+            if ( last > end ) {
+                occupied += last - (first > end ? first : end);
+                end = last;
+            }
+        }
+        if ( occupied >= bd->fill * (1U << s) ) {
+            break;
+        }
+    }
+
+    return s;
+}
+
+/*
+ * Build the entry for the region of the keys sharing the first d bits with
+ * the prefixes in [lo, hi); best is the data index of the longest prefix
+ * covering the region
+ */
+static int
+_lc_region(struct _lc_build *bd, size_t lo, size_t hi, int d, uint32_t best,
+           uint32_t *entry)
+{
+    struct _lc_prefix *p;
+    uint32_t *slots;
+    uint32_t e;
+    uint32_t first;
+    uint32_t last;
+    uint32_t i;
+    int64_t base;
+    int64_t sidx;
+    size_t j;
+    size_t k;
+    int minplen;
+    int c;
+    int s;
+
+    /* Absorb the prefix covering the whole region */
+    while ( lo < hi && bd->prefixes[lo].prefixlen <= d ) {
+        best = bd->prefixes[lo].data;
+        lo++;
+    }
+    if ( lo == hi ) {
+        /* No more specific prefix */
+        *entry = LC_ENTRY(LC_LEAF, best);
+        return 0;
+    }
+
+    /* Compute the bits shared by all the prefixes */
+    minplen = 32;
+    for ( j = lo; j < hi; j++ ) {
+        if ( bd->prefixes[j].prefixlen < minplen ) {
+            minplen = bd->prefixes[j].prefixlen;
+        }
+    }
+    e = bd->prefixes[lo].key ^ bd->prefixes[hi - 1].key;
+    c = 0 == e ? 32 : __builtin_clz(e);
+    if ( c > minplen ) {
+        c = minplen;
+    }
+    if ( c > d ) {
+        /* Skip over the shared bits */
+        sidx = _lc_alloc_skip(bd);
+        if ( sidx < 0 ) {
+            return -1;
+        }
+        if ( _lc_region(bd, lo, hi, c, best, &e) < 0 ) {
+            return -1;
+        }
+        bd->lc->skips[sidx].key = bd->prefixes[lo].key & PREFIX_MASK(c);
+        bd->lc->skips[sidx].prefixlen = c;
+        bd->lc->skips[sidx].match = e;
+        bd->lc->skips[sidx].miss = LC_ENTRY(LC_LEAF, best);
+        *entry = LC_ENTRY(LC_SKIP, sidx);
+        return 0;
+    }
+
+    /* Branch on the bits of the stride */
+    s = _lc_stride(bd, lo, hi, d);
+    base = _lc_alloc_entries(bd, (size_t)1 << s);
+    if ( base < 0 ) {
+        return -1;
+    }
+    bd->lc->nnodes++;
+    slots = malloc(sizeof(uint32_t) << s);
+    if ( NULL == slots ) {
+        return -1;
+    }
+    for ( i = 0; i < (1U << s); i++ ) {
+        slots[i] = best;
+    }
+
+    /* Push the prefixes up to the depth d + s to the entries; the prefixes
+       are sorted so that the longer ones overwrite the shorter ones */
+    for ( j = lo; j < hi; j++ ) {
+        p = &bd->prefixes[j];
+        if ( p->prefixlen > d + s ) {
+            continue;
+        }
+        first = (uint32_t)(p->key << d) >> (32 - s);
+        last = first + (1U << (d + s - p->prefixlen));
+        for ( i = first; i < last; i++ ) {
+            slots[i] = p->data;
+        }
+    }
+    for ( i = 0; i < (1U << s); i++ ) {
+        bd->lc->entries[base + i] = LC_ENTRY(LC_LEAF, slots[i]);
+    }
+
+    /* Build the children from the runs of the longer prefixes */
+    for ( j = lo; j < hi; j = k ) {
+        p = &bd->prefixes[j];
+        if ( p->prefixlen <= d + s ) {
+            k = j + 1;
+            continue;
+        }
+        i = (uint32_t)(p->key << d) >> (32 - s);
+        for ( k = j + 1; k < hi; k++ ) {
+            if ( ((uint32_t)(bd->prefixes[k].key << d) >> (32 - s)) != i ) {
+                break;
+            }
+        }
+        if ( _lc_region(bd, j, k, d + s, slots[i], &e) < 0 ) {
+            free(slots);
+            return -1;
+        }
+        bd->lc->entries[base + i] = e;
+    }
+    free(slots);
+
+    *entry = LC_NODE_ENTRY(s, base);
+
+    return 0;
+}
+
+/*
+ * Build a level-compressed trie from the path-compressed trie.  A node
+ * branches on as many bits as keep at least the fraction fill of its entries
+ * occupied by prefixes (0 for the default fill factor).
+ */
+struct path_compressed_trie_lc *
+path_compressed_trie_lc_build(struct path_compressed_trie *trie, double fill)
+{
+    struct path_compressed_trie_lc *lc;
+    struct _lc_build bd;
+
+    lc = malloc(sizeof(struct path_compressed_trie_lc));
+    if ( NULL == lc ) {
+        return NULL;
+    }
+    memset(lc, 0, sizeof(struct path_compressed_trie_lc));
+
+    memset(&bd, 0, sizeof(struct _lc_build));
+    bd.lc = lc;
+    bd.fill = fill > 0 ? fill : PATH_COMPRESSED_TRIE_LC_FILL;
+
+    if ( _lc_collect(&bd, trie) < 0
+         || _lc_region(&bd, 0, bd.n, 0, 0, &lc->root) < 0 ) {
+        free(bd.prefixes);
+        path_compressed_trie_lc_release(lc);
+        return NULL;
+    }
+    free(bd.prefixes);
+
+    lc->size = sizeof(uint32_t) * lc->nentries
+        + sizeof(struct path_compressed_trie_lc_skip) * lc->nskips
+        + sizeof(void *) * lc->ndata;
+
+    return lc;
+}
+
+/*
+ * Release the level-compressed trie
+ */
+void
+path_compressed_trie_lc_release(struct path_compressed_trie_lc *lc)
+{
+    free(lc->entries);
+    free(lc->skips);
+    free(lc->data);
+    free(lc);
+}
+
+/*
+ * Lookup the data corresponding to the key in the level-compressed trie
+ */
+void *
+path_compressed_trie_lc_lookup(struct path_compressed_trie_lc *lc,
+                               uint32_t key)
+{
+    struct path_compressed_trie_lc_skip *sk;
+    uint32_t e;
+    int depth;
+    int s;
+
+    e = lc->root;
+    depth = 0;
+    for ( ;; ) {
+        switch ( LC_TYPE(e) ) {
+        case LC_NODE:
+            s = LC_NODE_STRIDE(e);
+            e = lc->entries[LC_NODE_BASE(e) + ((key << depth) >> (32 - s))];
+            depth += s;
+            break;
+        case LC_SKIP:
+            sk = &lc->skips[LC_INDEX(e)];
+            if ( (key ^ sk->key) & PREFIX_MASK(sk->prefixlen) ) {
+                e = sk->miss;
+            } else {
+                e = sk->match;
+            }
+            depth = sk->prefixlen;
+            break;
+        default:
+            return lc->data[LC_INDEX(e)];
+        }
+    }
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,694 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include "pctrie.h"
+#include "pctrie_internal.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define PCTRIE_POPTRIE_X86  1
+#endif
+
+#define POPTRIE_S           PATH_COMPRESSED_TRIE_POPTRIE_DIRECT_BITS
+#define POPTRIE_LEAF        0x80000000U
+#define POPTRIE_NODES_SIZE                                              \
+    (sizeof(struct path_compressed_trie_poptrie_node)                   \
+     * PATH_COMPRESSED_TRIE_POPTRIE_MAX_NODES)
+#define POPTRIE_LEAVES_SIZE                                             \
+    (sizeof(uint32_t) * PATH_COMPRESSED_TRIE_POPTRIE_MAX_LEAVES)
+
+/* 6 bits of the key from the bit off, padded with zeros beyond the key */
+#define POPTRIE_CHUNK(k, off)                                           \
+    ((uint32_t)((((uint64_t)(k) << 32) << (off)) >> 58))
+
+/* Slots up to the slot v of a bitmap */
+#define POPTRIE_UPTO(v)     ((2ULL << (v)) - 1)
+
+/* Dead data compacted when more than the live ones and this */
+#define POPTRIE_DEAD_MIN    256
+
+/* Hash of the data */
+#define POPTRIE_HASH(d)                                                 \
+    ((uint32_t)(((uint64_t)(uintptr_t)(d) * 0x9e3779b97f4a7c15ULL) >> 32))
+
+/*
+ * Index of the data; the distinct data are added to the table
+ */
+static int64_t
+_poptrie_data(struct path_compressed_trie_poptrie *pt, void *data)
+{
+    uint32_t *hash;
+    uint32_t *refs;
+    void **table;
+    uint32_t size;
+    uint32_t h;
+    uint32_t i;
+
+    if ( NULL == data ) {
+        return 0;
+    }
+    for ( i = POPTRIE_HASH(data) & (pt->hash_size - 1); 0 != pt->hash[i];
+          i = (i + 1) & (pt->hash_size - 1) ) {
+        if ( pt->data[pt->hash[i]] == data ) {
+            return pt->hash[i];
+        }
+    }
+
+    /* Add the data, keeping the hash table at most half full */
+    if ( pt->ndata == pt->data_size ) {
+        table = realloc(pt->data, sizeof(void *) * pt->data_size * 2);
+        if ( NULL == table ) {
+            return -1;
+        }
+        pt->data = table;
+        refs = realloc(pt->refs, sizeof(uint32_t) * pt->data_size * 2);
+        if ( NULL == refs ) {
+            return -1;
+        }
+        pt->refs = refs;
+        pt->data_size *= 2;
+    }
+    if ( (pt->ndata + 1) * 2 > pt->hash_size ) {
+        size = pt->hash_size * 2;
+        hash = calloc(size, sizeof(uint32_t));
+        if ( NULL == hash ) {
+            return -1;
+        }
+        for ( h = 1; h < pt->ndata; h++ ) {
+            for ( i = POPTRIE_HASH(pt->data[h]) & (size - 1); 0 != hash[i];
+                  i = (i + 1) & (size - 1) ) {
+            }
+            hash[i] = h;
+        }
+        free(pt->hash);
+        pt->hash = hash;
+        pt->hash_size = size;
+        for ( i = POPTRIE_HASH(data) & (size - 1); 0 != hash[i];
+              i = (i + 1) & (size - 1) ) {
+        }
+    }
+    pt->data[pt->ndata] = data;
+    pt->refs[pt->ndata] = 0;
+    pt->hash[i] = pt->ndata;
+
+    return pt->ndata++;
+}
+
+/*
+ * Reference and unreference the data index
+ */
+static __inline__ void
+_poptrie_ref(struct path_compressed_trie_poptrie *pt, uint32_t d)
+{
+    if ( 0 != d && 0 == pt->refs[d]++ ) {
+        pt->nlive++;
+    }
+}
+
+static __inline__ void
+_poptrie_unref(struct path_compressed_trie_poptrie *pt, uint32_t d)
+{
+    if ( 0 != d && 0 == --pt->refs[d] ) {
+        pt->nlive--;
+    }
+}
+
+/*
+ * Rewrite the data indices of the leaves below the node with the map
+ */
+static void
+_poptrie_remap(struct path_compressed_trie_poptrie *pt, uint32_t idx,
+               const uint32_t *map)
+{
+    struct path_compressed_trie_poptrie_node *n;
+    uint32_t nc;
+    uint32_t nl;
+    uint32_t k;
+
+    n = &pt->nodes[idx];
+    nc = __builtin_popcountll(n->vector);
+    nl = __builtin_popcountll(n->leafvec);
+    for ( k = 0; k < nl; k++ ) {
+        pt->leaves[n->base0 + k] = map[pt->leaves[n->base0 + k]];
+    }
+    for ( k = 0; k < nc; k++ ) {
+        _poptrie_remap(pt, n->base1 + k, map);
+    }
+}
+
+/*
+ * Compact the data table when the dead data, which no leaf refers to any
+ * longer, are more than the live ones, and rebuild the hash table.  The
+ * tables are left as they are if the map cannot be allocated.
+ */
+static void
+_poptrie_compact(struct path_compressed_trie_poptrie *pt)
+{
+    uint32_t *map;
+    uint32_t dead;
+    uint32_t d;
+    uint32_t i;
+    uint32_t t;
+
+    dead = pt->ndata - 1 - pt->nlive;
+    if ( dead < POPTRIE_DEAD_MIN || dead <= pt->nlive ) {
+        return;
+    }
+    map = malloc(sizeof(uint32_t) * pt->ndata);
+    if ( NULL == map ) {
+        return;
+    }
+    map[0] = 0;
+    for ( i = 1, d = 1; i < pt->ndata; i++ ) {
+        if ( 0 != pt->refs[i] ) {
+            pt->data[d] = pt->data[i];
+            pt->refs[d] = pt->refs[i];
+            map[i] = d++;
+        }
+    }
+    pt->ndata = d;
+    for ( t = 0; t < (1U << POPTRIE_S); t++ ) {
+        if ( pt->dir[t] & POPTRIE_LEAF ) {
+            pt->dir[t] = POPTRIE_LEAF | map[pt->dir[t] & ~POPTRIE_LEAF];
+        } else {
+            _poptrie_remap(pt, pt->dir[t], map);
+        }
+    }
+    free(map);
+
+    memset(pt->hash, 0, sizeof(uint32_t) * pt->hash_size);
+    for ( d = 1; d < pt->ndata; d++ ) {
+        for ( i = POPTRIE_HASH(pt->data[d]) & (pt->hash_size - 1);
+              0 != pt->hash[i]; i = (i + 1) & (pt->hash_size - 1) ) {
+        }
+        pt->hash[i] = d;
+    }
+}
+
+/*
+ * Allocate a block of n nodes
+ */
+static int64_t
+_poptrie_alloc_nodes(struct path_compressed_trie_poptrie *pt, uint32_t n)
+{
+    uint32_t base;
+
+    if ( 0 == n ) {
+        return 0;
+    }
+    if ( 0 != pt->nfree[n] ) {
+        /* Reuse a released block */
+        base = pt->nfree[n];
+        pt->nfree[n] = pt->nodes[base].base1;
+    } else {
+        if ( pt->ncarved + n > PATH_COMPRESSED_TRIE_POPTRIE_MAX_NODES ) {
+            return -1;
+        }
+        base = pt->ncarved;
+        pt->ncarved += n;
+    }
+    pt->nnodes += n;
+
+    return base;
+}
+
+/*
+ * Allocate a block of n leaves
+ */
+static int64_t
+_poptrie_alloc_leaves(struct path_compressed_trie_poptrie *pt, uint32_t n)
+{
+    uint32_t base;
+
+    if ( 0 == n ) {
+        return 0;
+    }
+    if ( 0 != pt->lfree[n] ) {
+        base = pt->lfree[n];
+        pt->lfree[n] = pt->leaves[base];
+    } else {
+        if ( pt->lcarved + n > PATH_COMPRESSED_TRIE_POPTRIE_MAX_LEAVES ) {
+            return -1;
+        }
+        base = pt->lcarved;
+        pt->lcarved += n;
+    }
+    pt->nleaves += n;
+
+    return base;
+}
+
+/*
+ * Release the blocks of the children and the leaves below the node
+ */
+static void
+_poptrie_free(struct path_compressed_trie_poptrie *pt, uint32_t idx)
+{
+    struct path_compressed_trie_poptrie_node *n;
+    uint32_t nc;
+    uint32_t nl;
+    uint32_t k;
+
+    n = &pt->nodes[idx];
+    nc = __builtin_popcountll(n->vector);
+    nl = __builtin_popcountll(n->leafvec);
+    for ( k = 0; k < nc; k++ ) {
+        _poptrie_free(pt, n->base1 + k);
+    }
+    for ( k = 0; k < nl; k++ ) {
+        _poptrie_unref(pt, pt->leaves[n->base0 + k]);
+    }
+    if ( nc > 0 ) {
+        pt->nodes[n->base1].base1 = pt->nfree[nc];
+        pt->nfree[nc] = n->base1;
+        pt->nnodes -= nc;
+    }
+    if ( nl > 0 ) {
+        pt->leaves[n->base0] = pt->lfree[nl];
+        pt->lfree[nl] = n->base0;
+        pt->nleaves -= nl;
+    }
+}
+
+/*
+ * Walk down the trie from the node idx for the block of the addresses of the
+ * prefix (key, len).  The longest prefix not longer than len covering the
+ * block is kept in cand, and idx is left at the node to resume from for the
+ * sub-blocks, or 0 if no prefix is longer than len in the block.
+ */
+static void
+_poptrie_walk(struct path_compressed_trie *trie, uint32_t *idx,
+              uint32_t *cand, uint32_t key, int len)
+{
+    struct path_compressed_trie_node *n;
+
+    while ( 0 != *idx ) {
+        n = &trie->arena.nodes[*idx];
+        if ( (key ^ n->key)
+             & PREFIX_MASK(n->prefixlen < len ? n->prefixlen : len) ) {
+            /* Disjoint */
+            *idx = 0;
+            break;
+        }
+        if ( n->prefixlen >= len ) {
+            if ( n->prefixlen == len ) {
+                if ( n->valid ) {
+                    *cand = *idx;
+                }
+                if ( 0 == n->child[0] && 0 == n->child[1] ) {
+                    *idx = 0;
+                }
+            }
+            break;
+        }
+        if ( n->valid ) {
+            *cand = *idx;
+        }
+        *idx = n->child[NEXT_BIT(key, n->prefixlen)];
+    }
+}
+
+/*
+ * Build the node at the index for the block of the addresses of the prefix
+ * (key, off) from the state of the walk on the trie.  The node is left
+ * consistent on failure, so that the subtree can be released.
+ */
+static int
+_poptrie_node(struct path_compressed_trie_poptrie *pt, uint32_t nidx,
+              uint32_t key, int off, uint32_t idx, uint32_t cand)
+{
+    struct path_compressed_trie_poptrie_node *n;
+    uint32_t sidx[64];
+    uint32_t scand[64];
+    uint32_t skey[64];
+    int64_t sdata[64];
+    uint64_t vector;
+    uint64_t leafvec;
+    int64_t base0;
+    int64_t base1;
+    int64_t prev;
+    uint32_t nl;
+    uint32_t k;
+    int len;
+    int v;
+
+    n = &pt->nodes[nidx];
+    memset(n, 0, sizeof(struct path_compressed_trie_poptrie_node));
+
+    /* Slots; those beyond the key share the address of the slot 4i */
+    len = off + 6 <= 32 ? off + 6 : 32;
+    vector = 0;
+    leafvec = 0;
+    prev = -1;
+    nl = 0;
+    for ( v = 0; v < 64; v++ ) {
+        skey[v] = off + 6 <= 32 ? key | ((uint32_t)v << (26 - off))
+            : key | ((uint32_t)v >> (off + 6 - 32));
+        sidx[v] = idx;
+        scand[v] = cand;
+        _poptrie_walk(pt->trie, &sidx[v], &scand[v], skey[v], len);
+        if ( 0 != sidx[v] ) {
+            vector |= 1ULL << v;
+            continue;
+        }
+        sdata[v] = _poptrie_data(pt, pt->trie->arena.data[scand[v]]);
+        if ( sdata[v] < 0 ) {
+            return -1;
+        }
+        if ( sdata[v] != prev ) {
+            leafvec |= 1ULL << v;
+            prev = sdata[v];
+            nl++;
+        }
+    }
+
+    base0 = _poptrie_alloc_leaves(pt, nl);
+    if ( base0 < 0 ) {
+        return -1;
+    }
+    for ( v = 0, k = 0; v < 64; v++ ) {
+        if ( leafvec & (1ULL << v) ) {
+            pt->leaves[base0 + k++] = sdata[v];
+            _poptrie_ref(pt, sdata[v]);
+        }
+    }
+    n->leafvec = leafvec;
+    n->base0 = base0;
+    base1 = _poptrie_alloc_nodes(pt, __builtin_popcountll(vector));
+    if ( base1 < 0 ) {
+        return -1;
+    }
+    n->vector = vector;
+    n->base1 = base1;
+
+    /* Children initialized empty before built */
+    for ( k = 0; k < __builtin_popcountll(vector); k++ ) {
+        memset(&pt->nodes[base1 + k], 0,
+               sizeof(struct path_compressed_trie_poptrie_node));
+    }
+    for ( v = 0, k = 0; v < 64; v++ ) {
+        if ( vector & (1ULL << v) ) {
+            if ( _poptrie_node(pt, base1 + k++, skey[v], off + 6, sidx[v],
+                               scand[v]) < 0 ) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Release the subtree of the direct-pointing entry
+ */
+static void
+_poptrie_direct_free(struct path_compressed_trie_poptrie *pt, uint32_t e)
+{
+    if ( e & POPTRIE_LEAF ) {
+        _poptrie_unref(pt, e & ~POPTRIE_LEAF);
+        return;
+    }
+    _poptrie_free(pt, e);
+    pt->nodes[e].base1 = pt->nfree[1];
+    pt->nfree[1] = e;
+    pt->nnodes--;
+}
+
+/*
+ * Compute the direct-pointing entry t
+ */
+static int64_t
+_poptrie_direct(struct path_compressed_trie_poptrie *pt, uint32_t t)
+{
+    uint32_t key;
+    uint32_t idx;
+    uint32_t cand;
+    int64_t d;
+    int64_t x;
+
+    key = t << (32 - POPTRIE_S);
+    idx = pt->trie->root;
+    cand = 0;
+    _poptrie_walk(pt->trie, &idx, &cand, key, POPTRIE_S);
+    if ( 0 == idx ) {
+        d = _poptrie_data(pt, pt->trie->arena.data[cand]);
+        if ( d < 0 ) {
+            return -1;
+        }
+        _poptrie_ref(pt, d);
+        return POPTRIE_LEAF | d;
+    }
+
+    x = _poptrie_alloc_nodes(pt, 1);
+    if ( x < 0 ) {
+        return -1;
+    }
+    if ( _poptrie_node(pt, x, key, POPTRIE_S, idx, cand) < 0 ) {
+        _poptrie_direct_free(pt, x);
+        return -1;
+    }
+
+    return x;
+}
+
+/*
+ * Build the Poptrie from the trie
+ */
+struct path_compressed_trie_poptrie *
+path_compressed_trie_poptrie_build(struct path_compressed_trie *trie)
+{
+    struct path_compressed_trie_poptrie *pt;
+    int64_t e;
+    uint32_t t;
+
+    pt = malloc(sizeof(struct path_compressed_trie_poptrie));
+    if ( NULL == pt ) {
+        return NULL;
+    }
+    memset(pt, 0, sizeof(struct path_compressed_trie_poptrie));
+    pt->trie = trie;
+
+    /* The node and leaf index 0 are reserved for the end of the free lists;
+       the pages are committed when the blocks are carved */
+    pt->ncarved = 1;
+    pt->lcarved = 1;
+    pt->nodes = mmap(NULL, POPTRIE_NODES_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    pt->leaves = mmap(NULL, POPTRIE_LEAVES_SIZE, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANON | MAP_NORESERVE, -1, 0);
+    pt->dir = malloc(sizeof(uint32_t) << POPTRIE_S);
+    pt->data_size = 256;
+    pt->data = malloc(sizeof(void *) * pt->data_size);
+    pt->refs = malloc(sizeof(uint32_t) * pt->data_size);
+    pt->hash_size = 512;
+    pt->hash = calloc(pt->hash_size, sizeof(uint32_t));
+    if ( MAP_FAILED == pt->nodes || MAP_FAILED == pt->leaves
+         || NULL == pt->dir || NULL == pt->data || NULL == pt->refs
+         || NULL == pt->hash ) {
+        path_compressed_trie_poptrie_release(pt);
+        return NULL;
+    }
+    pt->data[0] = NULL;
+    pt->refs[0] = 0;
+    pt->ndata = 1;
+
+    for ( t = 0; t < (1U << POPTRIE_S); t++ ) {
+        e = _poptrie_direct(pt, t);
+        if ( e < 0 ) {
+            path_compressed_trie_poptrie_release(pt);
+            return NULL;
+        }
+        pt->dir[t] = e;
+    }
+#if PCTRIE_POPTRIE_X86
+    pt->popcnt = __builtin_cpu_supports("popcnt");
+#else
+    pt->popcnt = 0;
+#endif
+
+    return pt;
+}
+
+/*
+ * Release the Poptrie
+ */
+void
+path_compressed_trie_poptrie_release(struct path_compressed_trie_poptrie *pt)
+{
+    if ( NULL != pt->nodes && MAP_FAILED != pt->nodes ) {
+        munmap(pt->nodes, POPTRIE_NODES_SIZE);
+    }
+    if ( NULL != pt->leaves && MAP_FAILED != pt->leaves ) {
+        munmap(pt->leaves, POPTRIE_LEAVES_SIZE);
+    }
+    free(pt->dir);
+    free(pt->data);
+    free(pt->refs);
+    free(pt->hash);
+    free(pt);
+}
+
+/*
+ * Refresh the direct-pointing entries covering the prefix after it is added
+ * to or deleted from the trie.  The subtrees of the entries are all rebuilt
+ * from the trie before they replace the former ones, whose blocks are then
+ * released, and the data no longer referred to are compacted; the lookups
+ * must not run concurrently.  The entries are left unchanged on failure.
+ */
+int
+path_compressed_trie_poptrie_update(struct path_compressed_trie_poptrie *pt,
+                                    uint32_t key, int prefixlen)
+{
+    uint32_t *dir;
+    uint32_t single;
+    uint32_t first;
+    uint32_t last;
+    uint32_t old;
+    uint32_t t;
+    int64_t e;
+
+    if ( prefixlen < 0 || prefixlen > 32 ) {
+        return -1;
+    }
+    first = (key & PREFIX_MASK(prefixlen)) >> (32 - POPTRIE_S);
+    last = prefixlen >= POPTRIE_S
+        ? first : first | ((1U << (POPTRIE_S - prefixlen)) - 1);
+    if ( first == last ) {
+        dir = &single;
+    } else {
+        dir = malloc(sizeof(uint32_t) * (last - first + 1));
+        if ( NULL == dir ) {
+            return -1;
+        }
+    }
+
+    /* Build the new entries aside */
+    for ( t = first; t <= last; t++ ) {
+        e = _poptrie_direct(pt, t);
+        if ( e < 0 ) {
+            while ( t-- > first ) {
+                _poptrie_direct_free(pt, dir[t - first]);
+            }
+            if ( dir != &single ) {
+                free(dir);
+            }
+            return -1;
+        }
+        dir[t - first] = e;
+    }
+
+    /* Replace the entries and release the former ones */
+    for ( t = first; t <= last; t++ ) {
+        old = pt->dir[t];
+        pt->dir[t] = dir[t - first];
+        _poptrie_direct_free(pt, old);
+    }
+    if ( dir != &single ) {
+        free(dir);
+    }
+    _poptrie_compact(pt);
+
+    return 0;
+}
+
+/*
+ * Descend the nodes with the population counts of the bitmaps below the slot
+ * of the key
+ */
+static __inline__ __attribute__((always_inline)) void *
+_poptrie_lookup(struct path_compressed_trie_poptrie *pt, uint32_t key)
+{
+    const struct path_compressed_trie_poptrie_node *n;
+    uint32_t e;
+    uint32_t v;
+    int off;
+
+    e = pt->dir[key >> (32 - POPTRIE_S)];
+    if ( e & POPTRIE_LEAF ) {
+        return pt->data[e & ~POPTRIE_LEAF];
+    }
+    n = &pt->nodes[e];
+    off = POPTRIE_S;
+    v = POPTRIE_CHUNK(key, off);
+    while ( n->vector & (1ULL << v) ) {
+        n = &pt->nodes[n->base1 - 1
+                       + __builtin_popcountll(n->vector & POPTRIE_UPTO(v))];
+        off += 6;
+        v = POPTRIE_CHUNK(key, off);
+    }
+
+    return pt->data[pt->leaves[n->base0 - 1
+                               + __builtin_popcountll(n->leafvec
+                                                      & POPTRIE_UPTO(v))]];
+}
+
+#if PCTRIE_POPTRIE_X86
+__attribute__((target("popcnt")))
+static void *
+_poptrie_lookup_popcnt(struct path_compressed_trie_poptrie *pt, uint32_t key)
+{
+    return _poptrie_lookup(pt, key);
+}
+#endif
+
+/*
+ * Lookup the data corresponding to the key in the Poptrie
+ */
+void *
+path_compressed_trie_poptrie_lookup(struct path_compressed_trie_poptrie *pt,
+                                    uint32_t key)
+{
+#if PCTRIE_POPTRIE_X86
+    if ( pt->popcnt ) {
+        return _poptrie_lookup_popcnt(pt, key);
+    }
+#endif
+
+    return _poptrie_lookup(pt, key);
+}
+
+/*
+ * Get the memory usage of the Poptrie in bytes (the blocks carved)
+ */
+size_t
+path_compressed_trie_poptrie_memory(struct path_compressed_trie_poptrie *pt)
+{
+    return sizeof(struct path_compressed_trie_poptrie)
+        + (sizeof(uint32_t) << POPTRIE_S)
+        + sizeof(struct path_compressed_trie_poptrie_node) * pt->ncarved
+        + sizeof(uint32_t) * pt->lcarved
+        + (sizeof(void *) + sizeof(uint32_t)) * pt->data_size
+        + sizeof(uint32_t) * pt->hash_size;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
@@ -0,0 +1,306 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pctrie.h"
+
+/*
+ * Length of the shortest valid line, "0.0.0.0/0 0.0.0.0" with the newline, to
+ * bound the number of the entries in a chunk
+ */
+#define RIB_LINE_MIN        18
+
+/*
+ * Chunk of the RIB parsed by a thread
+ */
+struct _rib_chunk {
+    pthread_t th;
+    const char *p;
+    const char *end;
+    /* Entries parsed */
+    struct path_compressed_trie_prefix_entry *entries;
+    size_t n;
+};
+
+/*
+ * Parse a decimal number of up to the digits
+ */
+static __inline__ const char *
+_parse_dec(const char *p, const char *end, int digits, uint32_t *v)
+{
+    int d;
+
+    *v = 0;
+    for ( d = 0; d < digits && p < end && *p >= '0' && *p <= '9'; d++ ) {
+        *v = *v * 10 + (uint32_t)(*p - '0');
+        p++;
+    }
+    if ( 0 == d ) {
+        return NULL;
+    }
+
+    return p;
+}
+
+/*
+ * Parse a dotted-quad IPv4 address
+ */
+static __inline__ const char *
+_parse_quad(const char *p, const char *end, uint32_t *addr)
+{
+    uint32_t v;
+    int i;
+
+    *addr = 0;
+    for ( i = 0; i < 4; i++ ) {
+        if ( i > 0 ) {
+            if ( p >= end || '.' != *p ) {
+                return NULL;
+            }
+            p++;
+        }
+        p = _parse_dec(p, end, 3, &v);
+        if ( NULL == p || v > 255 ) {
+            return NULL;
+        }
+        *addr = (*addr << 8) | v;
+    }
+
+    return p;
+}
+
+/*
+ * Parse a line of "a.b.c.d/len nexthop"; return the end of the line
+ */
+static __inline__ const char *
+_parse_line(const char *p, const char *end,
+            struct path_compressed_trie_prefix_entry *e, int *valid)
+{
+    const char *eol;
+    uint32_t addr;
+    uint32_t len;
+    uint32_t nexthop;
+
+    eol = memchr(p, '\n', end - p);
+    if ( NULL == eol ) {
+        eol = end;
+    }
+    *valid = 0;
+
+    while ( p < eol && (' ' == *p || '\t' == *p) ) {
+        p++;
+    }
+    p = _parse_quad(p, eol, &addr);
+    if ( NULL == p || p >= eol || '/' != *p ) {
+        return eol;
+    }
+    p = _parse_dec(p + 1, eol, 2, &len);
+    if ( NULL == p || len > 32 || p >= eol || (' ' != *p && '\t' != *p) ) {
+        return eol;
+    }
+    while ( p < eol && (' ' == *p || '\t' == *p) ) {
+        p++;
+    }
+    p = _parse_quad(p, eol, &nexthop);
+    if ( NULL == p ) {
+        return eol;
+    }
+
+    e->key = addr;
+    e->prefixlen = len;
+    e->data = (void *)(uint64_t)nexthop;
+    *valid = 1;
+
+    return eol;
+}
+
+/*
+ * Parse a chunk of the RIB into the entries
+ */
+static void *
+_parse_chunk(void *arg)
+{
+    struct _rib_chunk *c;
+    const char *p;
+    int valid;
+
+    c = arg;
+    c->n = 0;
+    p = c->p;
+    while ( p < c->end ) {
+        p = _parse_line(p, c->end, &c->entries[c->n], &valid);
+        c->n += valid;
+        p++;
+    }
+
+    return NULL;
+}
+
+/*
+ * Parse a RIB dump file of "a.b.c.d/len nexthop" lines into the prefix
+ * entries with the next hops as the data.  The file is mapped and split into
+ * the chunks at the line boundaries, and the chunks are parsed in parallel by
+ * nthreads threads (the number of the online processors if 0).  The lines
+ * not in the format are skipped.
+ */
+struct path_compressed_trie_prefix_entry *
+path_compressed_trie_rib_parse(const char *path, size_t *n, int nthreads)
+{
+    struct path_compressed_trie_prefix_entry *entries;
+    struct _rib_chunk *chunks;
+    struct stat st;
+    const char *buf;
+    const char *p;
+    size_t off;
+    int fd;
+    int i;
+
+    fd = open(path, O_RDONLY);
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    if ( 0 != fstat(fd, &st) ) {
+        close(fd);
+        return NULL;
+    }
+    *n = 0;
+    if ( 0 == st.st_size ) {
+        close(fd);
+        return malloc(sizeof(struct path_compressed_trie_prefix_entry));
+    }
+    buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if ( MAP_FAILED == buf ) {
+        return NULL;
+    }
+    (void)madvise((void *)buf, st.st_size, MADV_SEQUENTIAL);
+
+    if ( nthreads <= 0 ) {
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+        if ( nthreads <= 0 ) {
+            nthreads = 1;
+        }
+    }
+    if ( (off_t)nthreads > st.st_size / RIB_LINE_MIN + 1 ) {
+        nthreads = st.st_size / RIB_LINE_MIN + 1;
+    }
+    chunks = calloc(nthreads, sizeof(struct _rib_chunk));
+    entries = malloc(sizeof(struct path_compressed_trie_prefix_entry)
+                     * (st.st_size / RIB_LINE_MIN + nthreads));
+    if ( NULL == chunks || NULL == entries ) {
+        free(chunks);
+        free(entries);
+        munmap((void *)buf, st.st_size);
+        return NULL;
+    }
+
+    /* Split into the chunks at the line boundaries; each chunk writes its
+       entries to its own region of the array */
+    p = buf;
+    off = 0;
+    for ( i = 0; i < nthreads; i++ ) {
+        chunks[i].p = p;
+        if ( i == nthreads - 1 ) {
+            p = buf + st.st_size;
+        } else {
+            p = buf + (size_t)st.st_size * (i + 1) / nthreads;
+            if ( p < chunks[i].p ) {
+                p = chunks[i].p;
+            }
+            p = memchr(p, '\n', buf + st.st_size - p);
+            p = NULL == p ? buf + st.st_size : p + 1;
+        }
+        chunks[i].end = p;
+        chunks[i].entries = entries + off;
+        off += (chunks[i].end - chunks[i].p) / RIB_LINE_MIN + 1;
+    }
+
+    /* Parse the chunks; the first one in the calling thread */
+    for ( i = 1; i < nthreads; i++ ) {
+        if ( 0 != pthread_create(&chunks[i].th, NULL, _parse_chunk,
+                                 &chunks[i]) ) {
+            /* Parse it in the calling thread instead */
+            chunks[i].th = pthread_self();
+            _parse_chunk(&chunks[i]);
+        }
+    }
+    _parse_chunk(&chunks[0]);
+    for ( i = 1; i < nthreads; i++ ) {
+        if ( !pthread_equal(chunks[i].th, pthread_self()) ) {
+            pthread_join(chunks[i].th, NULL);
+        }
+    }
+    munmap((void *)buf, st.st_size);
+
+    /* Compact the entries in the order of the file */
+    for ( i = 0; i < nthreads; i++ ) {
+        memmove(entries + *n, chunks[i].entries,
+                sizeof(struct path_compressed_trie_prefix_entry)
+                * chunks[i].n);
+        *n += chunks[i].n;
+    }
+    free(chunks);
+
+    return entries;
+}
+
+/*
+ * Load a RIB dump file into the trie through the bulk build; return the
+ * number of the prefixes loaded
+ */
+ssize_t
+path_compressed_trie_rib_load(struct path_compressed_trie *trie,
+                              const char *path, int nthreads)
+{
+    struct path_compressed_trie_prefix_entry *entries;
+    size_t n;
+    int ret;
+
+    entries = path_compressed_trie_rib_parse(path, &n, nthreads);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    ret = path_compressed_trie_build(trie, entries, n);
+    free(entries);
+    if ( ret < 0 ) {
+        return -1;
+    }
+
+    return n;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
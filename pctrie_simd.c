@@ -0,0 +1,308 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include "pctrie.h"
+
+/*
+ * The x86 kernels compute the gather offsets in 32-bit signed integers, i.e.,
+ * four 32-bit words per node
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) \
+    && PATH_COMPRESSED_TRIE_MAX_NODES <= (1UL << 29)
+#define PCTRIE_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+/* Word offsets of the node fields; the last word packs bit, prefixlen and
+   valid in its bytes */
+#define NODE_WORD_KEY       0
+#define NODE_WORD_CHILD     1
+#define NODE_WORD_ATTR      3
+#define ATTR_PREFIXLEN(a)   (((a) >> 8) & 0xff)
+#define ATTR_VALID          0x10000
+
+/* Selected instruction set */
+static int _isa = PATH_COMPRESSED_TRIE_SIMD_AUTO;
+
+/*
+ * Scalar fallback
+ */
+static void
+_lookup_scalar(struct path_compressed_trie *trie, const uint32_t *keys,
+               void **out, size_t n)
+{
+    path_compressed_trie_lookup_batch(trie, keys, out, n);
+}
+
+#if PCTRIE_SIMD_X86
+/*
+ * Lookup 8 keys in parallel with AVX2
+ */
+__attribute__((target("avx2")))
+static void
+_lookup_avx2(struct path_compressed_trie *trie, const uint32_t *keys,
+             void **out, size_t n)
+{
+    const int *base;
+    __m256i zero;
+    __m256i ones;
+    __m256i c32;
+    __m256i cff;
+    __m256i cvalid;
+    __m256i vkey;
+    __m256i vidx;
+    __m256i vcand;
+    __m256i voff;
+    __m256i nkey;
+    __m256i attr;
+    __m256i plen;
+    __m256i pmask;
+    __m256i match;
+    __m256i valid;
+    __m256i nbit;
+    __m256i active;
+    uint32_t cand[8];
+    size_t i;
+    int l;
+
+    base = (const int *)trie->arena.nodes;
+    zero = _mm256_setzero_si256();
+    ones = _mm256_set1_epi32(-1);
+    c32 = _mm256_set1_epi32(32);
+    cff = _mm256_set1_epi32(0xff);
+    cvalid = _mm256_set1_epi32(ATTR_VALID);
+
+    for ( i = 0; i + 8 <= n; i += 8 ) {
+        vkey = _mm256_loadu_si256((const __m256i *)(keys + i));
+        vidx = _mm256_set1_epi32(trie->root);
+        vcand = zero;
+        active = _mm256_andnot_si256(_mm256_cmpeq_epi32(vidx, zero), ones);
+
+        while ( !_mm256_testz_si256(active, active) ) {
+            /* Fetch the key and the attributes of the current nodes */
+            voff = _mm256_slli_epi32(vidx, 2);
+            nkey = _mm256_mask_i32gather_epi32(zero, base + NODE_WORD_KEY,
+                                               voff, active, 4);
+            attr = _mm256_mask_i32gather_epi32(zero, base + NODE_WORD_ATTR,
+                                               voff, active, 4);
+            plen = _mm256_and_si256(_mm256_srli_epi32(attr, 8), cff);
+
+            /* Compare the prefixes; the shift by 32 yields the zero mask */
+            pmask = _mm256_sllv_epi32(ones, _mm256_sub_epi32(c32, plen));
+            match = _mm256_and_si256(_mm256_xor_si256(vkey, nkey), pmask);
+            match = _mm256_and_si256(_mm256_cmpeq_epi32(match, zero), active);
+
+            /* Update the candidates */
+            valid = _mm256_cmpeq_epi32(_mm256_and_si256(attr, cvalid), cvalid);
+            vcand = _mm256_blendv_epi8(vcand, vidx,
+                                       _mm256_and_si256(match, valid));
+
+            /* Descend to the child selected by the bit next to the prefix */
+            nbit = _mm256_srli_epi32(_mm256_sllv_epi32(vkey, plen), 31);
+            vidx = _mm256_mask_i32gather_epi32(zero, base + NODE_WORD_CHILD,
+                                               _mm256_add_epi32(voff, nbit),
+                                               match, 4);
+            active = _mm256_andnot_si256(_mm256_cmpeq_epi32(vidx, zero), ones);
+        }
+
+        _mm256_storeu_si256((__m256i *)cand, vcand);
+        for ( l = 0; l < 8; l++ ) {
+            out[i + l] = trie->arena.data[cand[l]];
+        }
+    }
+
+    /* Remaining keys */
+    for ( ; i < n; i++ ) {
+        out[i] = path_compressed_trie_lookup(trie, keys[i]);
+    }
+}
+
+/*
+ * Lookup 16 keys in parallel with AVX-512
+ */
+__attribute__((target("avx512f")))
+static void
+_lookup_avx512(struct path_compressed_trie *trie, const uint32_t *keys,
+               void **out, size_t n)
+{
+    const int *base;
+    __m512i zero;
+    __m512i ones;
+    __m512i c32;
+    __m512i cff;
+    __m512i cvalid;
+    __m512i vkey;
+    __m512i vidx;
+    __m512i vcand;
+    __m512i voff;
+    __m512i nkey;
+    __m512i attr;
+    __m512i plen;
+    __m512i nbit;
+    __mmask16 active;
+    __mmask16 match;
+    __mmask16 valid;
+    uint32_t cand[16];
+    size_t i;
+    int l;
+
+    base = (const int *)trie->arena.nodes;
+    zero = _mm512_setzero_si512();
+    ones = _mm512_set1_epi32(-1);
+    c32 = _mm512_set1_epi32(32);
+    cff = _mm512_set1_epi32(0xff);
+    cvalid = _mm512_set1_epi32(ATTR_VALID);
+
+    for ( i = 0; i + 16 <= n; i += 16 ) {
+        vkey = _mm512_loadu_si512((const void *)(keys + i));
+        vidx = _mm512_set1_epi32(trie->root);
+        vcand = zero;
+        active = _mm512_test_epi32_mask(vidx, vidx);
+
+        while ( active ) {
+            /* Fetch the key and the attributes of the current nodes */
+            voff = _mm512_slli_epi32(vidx, 2);
+            nkey = _mm512_mask_i32gather_epi32(zero, active, voff,
+                                               base + NODE_WORD_KEY, 4);
+            attr = _mm512_mask_i32gather_epi32(zero, active, voff,
+                                               base + NODE_WORD_ATTR, 4);
+            plen = _mm512_and_si512(_mm512_srli_epi32(attr, 8), cff);
+
+            /* Compare the prefixes; the shift by 32 yields the zero mask */
+            match = _mm512_mask_testn_epi32_mask(
+                active, _mm512_xor_si512(vkey, nkey),
+                _mm512_sllv_epi32(ones, _mm512_sub_epi32(c32, plen)));
+
+            /* Update the candidates */
+            valid = _mm512_mask_test_epi32_mask(match, attr, cvalid);
+            vcand = _mm512_mask_mov_epi32(vcand, valid, vidx);
+
+            /* Descend to the child selected by the bit next to the prefix */
+            nbit = _mm512_srli_epi32(_mm512_sllv_epi32(vkey, plen), 31);
+            vidx = _mm512_mask_i32gather_epi32(zero, match,
+                                               _mm512_add_epi32(voff, nbit),
+                                               base + NODE_WORD_CHILD, 4);
+            active = _mm512_test_epi32_mask(vidx, vidx);
+        }
+
+        _mm512_storeu_si512((void *)cand, vcand);
+        for ( l = 0; l < 16; l++ ) {
+            out[i + l] = trie->arena.data[cand[l]];
+        }
+    }
+
+    /* Remaining keys */
+    for ( ; i < n; i++ ) {
+        out[i] = path_compressed_trie_lookup(trie, keys[i]);
+    }
+}
+#endif
+
+/*
+ * Check if the instruction set is supported by the CPU
+ */
+static int
+_isa_supported(int isa)
+{
+    switch ( isa ) {
+    case PATH_COMPRESSED_TRIE_SIMD_SCALAR:
+        return 1;
+#if PCTRIE_SIMD_X86
+    case PATH_COMPRESSED_TRIE_SIMD_AVX2:
+        return __builtin_cpu_supports("avx2");
+    case PATH_COMPRESSED_TRIE_SIMD_AVX512:
+        return __builtin_cpu_supports("avx512f");
+#endif
+    default:
+        return 0;
+    }
+}
+
+/*
+ * Select the instruction set of the vectorized lookup; AUTO selects the
+ * widest one supported by the CPU
+ */
+int
+path_compressed_trie_simd_set(int isa)
+{
+    if ( PATH_COMPRESSED_TRIE_SIMD_AUTO == isa ) {
+        if ( _isa_supported(PATH_COMPRESSED_TRIE_SIMD_AVX512) ) {
+            isa = PATH_COMPRESSED_TRIE_SIMD_AVX512;
+        } else if ( _isa_supported(PATH_COMPRESSED_TRIE_SIMD_AVX2) ) {
+            isa = PATH_COMPRESSED_TRIE_SIMD_AVX2;
+        } else {
+            isa = PATH_COMPRESSED_TRIE_SIMD_SCALAR;
+        }
+    }
+    if ( !_isa_supported(isa) ) {
+        return -1;
+    }
+    _isa = isa;
+
+    return 0;
+}
+
+/*
+ * Get the selected instruction set
+ */
+int
+path_compressed_trie_simd_get(void)
+{
+    if ( PATH_COMPRESSED_TRIE_SIMD_AUTO == _isa ) {
+        path_compressed_trie_simd_set(PATH_COMPRESSED_TRIE_SIMD_AUTO);
+    }
+
+    return _isa;
+}
+
+/*
+ * Lookup a batch of keys with the vectorized kernel
+ */
+void
+path_compressed_trie_lookup_simd(struct path_compressed_trie *trie,
+                                 const uint32_t *keys, void **out, size_t n)
+{
+    switch ( path_compressed_trie_simd_get() ) {
+#if PCTRIE_SIMD_X86
+    case PATH_COMPRESSED_TRIE_SIMD_AVX512:
+        _lookup_avx512(trie, keys, out, n);
+        break;
+    case PATH_COMPRESSED_TRIE_SIMD_AVX2:
+        _lookup_avx2(trie, keys, out, n);
+        break;
+#endif
+    default:
+        _lookup_scalar(trie, keys, out, n);
+    }
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
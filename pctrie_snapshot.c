@@ -0,0 +1,218 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "pctrie.h"
+#include "pctrie_internal.h"
+
+/* Alignment of the snapshot block and the node array in it */
+#define SNAPSHOT_ALIGN      64
+#define ALIGN_UP(x, a)      (((x) + (a) - 1) & ~((size_t)(a) - 1))
+
+/*
+ * Working data to build a snapshot
+ */
+struct _freeze {
+    const struct path_compressed_trie_node *nodes;
+    /* Height of the subtree rooted at each node (indexed by the node index) */
+    uint8_t *height;
+    /* New index of each node (indexed by the node index) */
+    uint32_t *map;
+    /* Nodes in the layout order */
+    uint32_t *order;
+    uint32_t n;
+};
+
+/*
+ * Compute the heights of the subtrees
+ */
+static int
+_height(struct _freeze *fz, uint32_t idx)
+{
+    int h0;
+    int h1;
+
+    if ( 0 == idx ) {
+        return 0;
+    }
+    h0 = _height(fz, fz->nodes[idx].child[0]);
+    h1 = _height(fz, fz->nodes[idx].child[1]);
+    fz->height[idx] = 1 + (h0 > h1 ? h0 : h1);
+
+    return fz->height[idx];
+}
+
+static void _layout(struct _freeze *, uint32_t, int);
+
+/*
+ * Lay out the bottom subtrees rooted at the depth of the top subtree
+ */
+static void
+_layout_bottom(struct _freeze *fz, uint32_t idx, int depth, int htop, int hbot)
+{
+    if ( 0 == idx ) {
+        return;
+    }
+    if ( depth == htop ) {
+        _layout(fz, idx, hbot);
+        return;
+    }
+    _layout_bottom(fz, fz->nodes[idx].child[0], depth + 1, htop, hbot);
+    _layout_bottom(fz, fz->nodes[idx].child[1], depth + 1, htop, hbot);
+}
+
+/*
+ * Lay out the subtree rooted at idx and truncated at the height h in the van
+ * Emde Boas order: the top half of the subtree first, then each of the bottom
+ * subtrees, recursively.  A root-to-leaf path of height h thus crosses
+ * O(log_B h) blocks for any block size B.
+ */
+static void
+_layout(struct _freeze *fz, uint32_t idx, int h)
+{
+    int htop;
+
+    if ( 0 == idx ) {
+        return;
+    }
+    if ( h > fz->height[idx] ) {
+        h = fz->height[idx];
+    }
+    if ( 1 == h ) {
+        fz->map[idx] = fz->n;
+        fz->order[fz->n] = idx;
+        fz->n++;
+        return;
+    }
+    htop = h / 2;
+    _layout(fz, idx, htop);
+    _layout_bottom(fz, idx, 0, htop, h - htop);
+}
+
+/*
+ * Compile the trie into an immutable snapshot in a single contiguous block
+ */
+struct path_compressed_trie_snapshot *
+path_compressed_trie_freeze(struct path_compressed_trie *trie)
+{
+    struct path_compressed_trie_snapshot *snap;
+    struct path_compressed_trie_node *n;
+    struct _freeze fz;
+    size_t nnodes;
+    size_t off_nodes;
+    size_t off_data;
+    size_t size;
+    uint32_t i;
+    uint32_t idx;
+    int k;
+
+    /* Prepare the working data */
+    nnodes = trie->arena.carved;
+    fz.nodes = trie->arena.nodes;
+    fz.height = malloc(sizeof(uint8_t) * nnodes);
+    fz.map = malloc(sizeof(uint32_t) * nnodes);
+    fz.order = malloc(sizeof(uint32_t) * nnodes);
+    if ( NULL == fz.height || NULL == fz.map || NULL == fz.order ) {
+        free(fz.height);
+        free(fz.map);
+        free(fz.order);
+        return NULL;
+    }
+    /* The index 0 is reserved for NULL */
+    fz.map[0] = 0;
+    fz.order[0] = 0;
+    fz.n = 1;
+
+    /* Compute the layout */
+    _layout(&fz, trie->root, _height(&fz, trie->root));
+
+    /* Allocate the block: the snapshot, the nodes and the data */
+    off_nodes = ALIGN_UP(sizeof(struct path_compressed_trie_snapshot),
+                         SNAPSHOT_ALIGN);
+    off_data = off_nodes + sizeof(struct path_compressed_trie_node) * fz.n;
+    size = ALIGN_UP(off_data + sizeof(void *) * fz.n, SNAPSHOT_ALIGN);
+    if ( 0 != posix_memalign((void **)&snap, SNAPSHOT_ALIGN, size) ) {
+        free(fz.height);
+        free(fz.map);
+        free(fz.order);
+        return NULL;
+    }
+    snap->nodes = (struct path_compressed_trie_node *)((uint8_t *)snap
+                                                       + off_nodes);
+    snap->data = (void **)((uint8_t *)snap + off_data);
+    snap->root = fz.n > 1 ? 1 : 0;
+    snap->nnodes = fz.n;
+    snap->size = size;
+
+    /* Copy the nodes and the data in the layout order */
+    memset(&snap->nodes[0], 0, sizeof(struct path_compressed_trie_node));
+    snap->data[0] = NULL;
+    for ( i = 1; i < fz.n; i++ ) {
+        idx = fz.order[i];
+        n = &snap->nodes[i];
+        memcpy(n, &trie->arena.nodes[idx],
+               sizeof(struct path_compressed_trie_node));
+        for ( k = 0; k < 2; k++ ) {
+            n->child[k] = fz.map[n->child[k]];
+        }
+        snap->data[i] = trie->arena.data[idx];
+    }
+
+    free(fz.height);
+    free(fz.map);
+    free(fz.order);
+
+    return snap;
+}
+
+/*
+ * Release the snapshot
+ */
+void
+path_compressed_trie_snapshot_release(struct path_compressed_trie_snapshot
+                                      *snap)
+{
+    free(snap);
+}
+
+/*
+ * Lookup the data corresponding to the key in the snapshot
+ */
+void *
+path_compressed_trie_snapshot_lookup(struct path_compressed_trie_snapshot
+                                     *snap, uint32_t key)
+{
+    /* The data of the index 0 is NULL */
+    return snap->data[_pctrie_walk(snap->nodes, snap->root, 0, key)];
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */
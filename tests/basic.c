@@ -24,8 +24,16 @@
 #include "../pctrie.h"
 #include "radix.h"
 #include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
 #include <sys/time.h>
 
+#define BIT_TEST(k, b)  ((k) & (0x80000000ULL >> (b)))
+#define BIT_PREFIX(k, b)    (((uint64_t)(k) >> (32 - (b))) << (32 - (b)))
+
 /* Macro for testing */
 #define TEST_FUNC(str, func, ret)                \
     do {                                         \
@@ -39,6 +47,21 @@
         printf("\n");                            \
     } while ( 0 )
 
+/* Number of keys looked up at once by the batched lookups */
+#define TEST_BURST_SIZE         256
+#define TEST_KEY_BUFFER_SIZE    (1 << 20)
+
+/* Number of the lookups timed by an engine in the performance tests */
+#define TEST_PERF_LOOKUPS       (1LL << 24)
+
+/* Concurrent test: prefixes churned by the writer under 240.0.0.0/8 */
+#define TEST_CHURN_BASE         0xf0000000U
+#define TEST_CHURN_PREFIXES     4096
+#define TEST_CHURN_ROUNDS       64
+
+/* Churn test: rounds of the announcements and withdrawals of the full route */
+#define TEST_FULL_CHURN_ROUNDS  16
+
 #define TEST_PROGRESS()                              \
     do {                                             \
         printf(".");                                 \
@@ -79,6 +102,264 @@ getmicrotime(void)
     return microsec;
 }
 
+/*
+ * Load the linx RIB into the trie and the radix tree (if not NULL)
+ */
+static ssize_t
+_load_linx(struct path_compressed_trie *trie, struct radix_tree *radix)
+{
+    FILE *fp;
+    char buf[4096];
+    int prefix[4];
+    int prefixlen;
+    int nexthop[4];
+    int ret;
+    uint32_t addr1;
+    uint64_t addr2;
+    ssize_t i;
+
+    /* Load from the linx file */
+    fp = fopen("tests/linx-rib.20141217.0000-p46.txt", "r");
+    if ( NULL == fp ) {
+        return -1;
+    }
+
+    /* Load the full route */
+    i = 0;
+    while ( !feof(fp) ) {
+        if ( !fgets(buf, sizeof(buf), fp) ) {
+            continue;
+        }
+        ret = sscanf(buf, "%d.%d.%d.%d/%d %d.%d.%d.%d", &prefix[0], &prefix[1],
+                     &prefix[2], &prefix[3], &prefixlen, &nexthop[0],
+                     &nexthop[1], &nexthop[2], &nexthop[3]);
+        if ( ret < 0 ) {
+            fclose(fp);
+            return -1;
+        }
+
+        /* Convert to u32 */
+        addr1 = ((uint32_t)prefix[0] << 24) + ((uint32_t)prefix[1] << 16)
+            + ((uint32_t)prefix[2] << 8) + (uint32_t)prefix[3];
+        addr2 = ((uint32_t)nexthop[0] << 24) + ((uint32_t)nexthop[1] << 16)
+            + ((uint32_t)nexthop[2] << 8) + (uint32_t)nexthop[3];
+
+        /* Add an entry */
+        ret = path_compressed_trie_add(trie, addr1, prefixlen,
+                                       (void *)(uint64_t)addr2);
+        if ( ret < 0 ) {
+            fclose(fp);
+            return -1;
+        }
+        if ( NULL != radix ) {
+            ret = radix_tree_add(radix, addr1, prefixlen,
+                                 (void *)(uint64_t)addr2);
+            if ( ret < 0 ) {
+                fclose(fp);
+                return -1;
+            }
+        }
+        if ( 0 == i % 10000 ) {
+            TEST_PROGRESS();
+        }
+        i++;
+    }
+
+    /* Close */
+    fclose(fp);
+
+    return i;
+}
+
+/*
+ * Read a RIB file into an array of the prefix entries with fgets() and
+ * sscanf()
+ */
+static struct path_compressed_trie_prefix_entry *
+_read_rib(const char *path, size_t *n)
+{
+    struct path_compressed_trie_prefix_entry *entries;
+    struct path_compressed_trie_prefix_entry *e;
+    FILE *fp;
+    char buf[4096];
+    int prefix[4];
+    int prefixlen;
+    int nexthop[4];
+    size_t size;
+    int ret;
+
+    fp = fopen(path, "r");
+    if ( NULL == fp ) {
+        return NULL;
+    }
+    size = 1 << 20;
+    entries = malloc(sizeof(struct path_compressed_trie_prefix_entry) * size);
+    if ( NULL == entries ) {
+        fclose(fp);
+        return NULL;
+    }
+    *n = 0;
+    while ( fgets(buf, sizeof(buf), fp) ) {
+        ret = sscanf(buf, "%d.%d.%d.%d/%d %d.%d.%d.%d", &prefix[0], &prefix[1],
+                     &prefix[2], &prefix[3], &prefixlen, &nexthop[0],
+                     &nexthop[1], &nexthop[2], &nexthop[3]);
+        if ( 9 != ret ) {
+            continue;
+        }
+        if ( *n == size ) {
+            size *= 2;
+            e = realloc(entries,
+                        sizeof(struct path_compressed_trie_prefix_entry)
+                        * size);
+            if ( NULL == e ) {
+                free(entries);
+                fclose(fp);
+                return NULL;
+            }
+            entries = e;
+        }
+        e = &entries[(*n)++];
+        e->key = ((uint32_t)prefix[0] << 24) + ((uint32_t)prefix[1] << 16)
+            + ((uint32_t)prefix[2] << 8) + (uint32_t)prefix[3];
+        e->prefixlen = prefixlen;
+        e->data = (void *)(uint64_t)(((uint32_t)nexthop[0] << 24)
+                                     + ((uint32_t)nexthop[1] << 16)
+                                     + ((uint32_t)nexthop[2] << 8)
+                                     + (uint32_t)nexthop[3]);
+    }
+    fclose(fp);
+
+    return entries;
+}
+
+/*
+ * Read the linx RIB into an array of the prefix entries
+ */
+static struct path_compressed_trie_prefix_entry *
+_read_linx(size_t *n)
+{
+    return _read_rib("tests/linx-rib.20141217.0000-p46.txt", n);
+}
+
+static int
+_u32_cmp(const void *a, const void *b)
+{
+    uint32_t x;
+    uint32_t y;
+
+    x = *(const uint32_t *)a;
+    y = *(const uint32_t *)b;
+
+    return x < y ? -1 : (x > y);
+}
+
+/*
+ * Sorted and unique boundary addresses of the prefixes: the first and the
+ * last addresses of each prefix and their neighbours outside it, with the
+ * first and the last addresses of the space.  The longest prefix match only
+ * changes on these addresses.
+ */
+static uint32_t *
+_boundary_keys(const struct path_compressed_trie_prefix_entry *entries,
+               size_t n, size_t *m)
+{
+    uint32_t *keys;
+    uint32_t lo;
+    uint32_t hi;
+    size_t i;
+    size_t k;
+
+    keys = malloc(sizeof(uint32_t) * (n * 4 + 2));
+    if ( NULL == keys ) {
+        return NULL;
+    }
+    k = 0;
+    keys[k++] = 0;
+    keys[k++] = 0xffffffffU;
+    for ( i = 0; i < n; i++ ) {
+        lo = BIT_PREFIX(entries[i].key, entries[i].prefixlen);
+        hi = lo | (uint32_t)(0xffffffffULL >> entries[i].prefixlen);
+        keys[k++] = lo - 1;
+        keys[k++] = lo;
+        keys[k++] = hi;
+        keys[k++] = hi + 1;
+    }
+    qsort(keys, k, sizeof(uint32_t), _u32_cmp);
+    for ( i = 0, *m = 0; i < k; i++ ) {
+        if ( 0 == *m || keys[*m - 1] != keys[i] ) {
+            keys[(*m)++] = keys[i];
+        }
+    }
+
+    return keys;
+}
+
+/*
+ * Check if two subtrees have the same structure and data
+ */
+static int
+_trie_equal(struct path_compressed_trie *t0, uint32_t i0,
+            struct path_compressed_trie *t1, uint32_t i1)
+{
+    struct path_compressed_trie_node *n0;
+    struct path_compressed_trie_node *n1;
+
+    if ( 0 == i0 || 0 == i1 ) {
+        return i0 == i1;
+    }
+    n0 = &t0->arena.nodes[i0];
+    n1 = &t1->arena.nodes[i1];
+    if ( n0->prefixlen != n1->prefixlen || n0->bit != n1->bit
+         || BIT_PREFIX(n0->key, n0->prefixlen)
+         != BIT_PREFIX(n1->key, n1->prefixlen)
+         || n0->valid != n1->valid
+         || (n0->valid && t0->arena.data[i0] != t1->arena.data[i1]) ) {
+        return 0;
+    }
+
+    return _trie_equal(t0, n0->child[0], t1, n1->child[0])
+        && _trie_equal(t0, n0->child[1], t1, n1->child[1]);
+}
+
+/*
+ * Reference lookup: the original recursive lookup procedure that rebuilds the
+ * prefixes with shifts at every node
+ */
+static void *
+_lookup_reference(struct path_compressed_trie *trie, uint32_t idx,
+                  uint32_t cand, uint32_t key)
+{
+    struct path_compressed_trie_node *cur;
+    uint32_t next;
+
+    /* Reaches at the leaf */
+    if ( 0 == idx ) {
+        return trie->arena.data[cand];
+    }
+    cur = &trie->arena.nodes[idx];
+    if ( cur->bit < 0 ||
+         BIT_PREFIX(cur->key, cur->bit) != BIT_PREFIX(key, cur->bit) ) {
+        if ( BIT_PREFIX(cur->key, cur->prefixlen)
+             == BIT_PREFIX(key, cur->prefixlen) ) {
+            cand = idx;
+        }
+        return trie->arena.data[cand];
+    }
+    if ( cur->valid ) {
+        cand = idx;
+    }
+
+    if ( BIT_TEST(key, cur->bit) ) {
+        /* Right */
+        next = cur->child[1];
+    } else {
+        /* Left */
+        next = cur->child[0];
+    }
+
+    return _lookup_reference(trie, next, cand, key);
+}
+
 /*
  * Initialization test
  */
@@ -162,125 +443,81 @@ test_lookup(void)
     return 0;
 }
 
+/*
+ * Node arena test
+ */
 static int
-test_lookup_linx(void)
+test_arena(void)
 {
     struct path_compressed_trie *trie;
-    struct radix_tree *radix;
-    FILE *fp;
-    char buf[4096];
-    int prefix[4];
-    int prefixlen;
-    int nexthop[4];
+    struct path_compressed_trie_arena_stats st;
+    uint32_t i;
     int ret;
-    uint32_t addr1;
-    uint64_t addr2;
-    ssize_t i;
-    double t0;
-    double t1;
-    uint32_t a;
-    uint64_t res0;
-    uint64_t res1;
-
-    /* Load from the linx file */
-    fp = fopen("tests/linx-rib.20141217.0000-p46.txt", "r");
-    if ( NULL == fp ) {
-        return -1;
-    }
 
     /* Initialize */
     trie = path_compressed_trie_init(NULL);
     if ( NULL == trie ) {
         return -1;
     }
-    radix = radix_tree_init(NULL);
-    if ( NULL == radix ) {
-        return -1;
-    }
 
-    /* Load the full route */
-    i = 0;
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%d.%d.%d.%d/%d %d.%d.%d.%d", &prefix[0], &prefix[1],
-                     &prefix[2], &prefix[3], &prefixlen, &nexthop[0],
-                     &nexthop[1], &nexthop[2], &nexthop[3]);
+    /* Insert /24 prefixes */
+    for ( i = 0; i < 1024; i++ ) {
+        ret = path_compressed_trie_add(trie, 0x0a000000 + (i << 8), 24,
+                                       (void *)(uint64_t)(i + 1));
         if ( ret < 0 ) {
             return -1;
         }
+    }
+    path_compressed_trie_arena_stats(trie, &st);
+    if ( 1 != st.slabs || 0 == st.used || 0 != st.free ) {
+        return -1;
+    }
 
-        /* Convert to u32 */
-        addr1 = ((uint32_t)prefix[0] << 24) + ((uint32_t)prefix[1] << 16)
-            + ((uint32_t)prefix[2] << 8) + (uint32_t)prefix[3];
-        addr2 = ((uint32_t)nexthop[0] << 24) + ((uint32_t)nexthop[1] << 16)
-            + ((uint32_t)nexthop[2] << 8) + (uint32_t)nexthop[3];
+    TEST_PROGRESS();
 
-        /* Add an entry */
-        ret = path_compressed_trie_add(trie, addr1, prefixlen,
-                                       (void *)(uint64_t)addr2);
-        if ( ret < 0 ) {
-            return -1;
-        }
-        ret = radix_tree_add(radix, addr1, prefixlen, (void *)(uint64_t)addr2);
-        if ( ret < 0 ) {
+    /* Delete all the prefixes; all the nodes are returned to the arena */
+    for ( i = 0; i < 1024; i++ ) {
+        if ( (void *)(uint64_t)(i + 1)
+             != path_compressed_trie_delete(trie, 0x0a000000 + (i << 8), 24) ) {
             return -1;
         }
-        if ( 0 == i % 10000 ) {
-            TEST_PROGRESS();
-        }
-        i++;
+    }
+    path_compressed_trie_arena_stats(trie, &st);
+    if ( 0 != st.used || st.free != st.allocs ) {
+        return -1;
     }
 
-    t0 = getmicrotime();
+    TEST_PROGRESS();
 
-    for ( i = 0; i < 0x100000000LL; i++ ) {
-        if ( 0 == i % 0x10000000ULL ) {
-            TEST_PROGRESS();
-        }
-        a = i;
-        res0 = (uint64_t)path_compressed_trie_lookup(trie, a);
-        res1 = (uint64_t)radix_tree_lookup(radix, a);
-        if ( res0 != res1 ) {
+    /* Insert again; the released nodes are reused */
+    for ( i = 0; i < 1024; i++ ) {
+        ret = path_compressed_trie_add(trie, 0x0a000000 + (i << 8), 24,
+                                       (void *)(uint64_t)(i + 1));
+        if ( ret < 0 ) {
             return -1;
         }
     }
-    t1 = getmicrotime();
+    path_compressed_trie_arena_stats(trie, &st);
+    if ( 1 != st.slabs || 0 != st.free ) {
+        return -1;
+    }
 
     /* Release */
     path_compressed_trie_release(trie);
-    radix_tree_release(radix);
-
-    /* Close */
-    fclose(fp);
 
     return 0;
 }
 
+/*
+ * Snapshot test
+ */
 static int
-test_lookup_linx_performance(void)
+test_snapshot(void)
 {
     struct path_compressed_trie *trie;
-    FILE *fp;
-    char buf[4096];
-    int prefix[4];
-    int prefixlen;
-    int nexthop[4];
+    struct path_compressed_trie_snapshot *snap;
+    uint32_t i;
     int ret;
-    uint32_t addr1;
-    uint64_t addr2;
-    ssize_t i;
-    uint64_t res;
-    double t0;
-    double t1;
-    uint32_t a;
-
-    /* Load from the linx file */
-    fp = fopen("tests/linx-rib.20141217.0000-p46.txt", "r");
-    if ( NULL == fp ) {
-        return -1;
-    }
 
     /* Initialize */
     trie = path_compressed_trie_init(NULL);
@@ -288,79 +525,3220 @@ test_lookup_linx_performance(void)
         return -1;
     }
 
-    /* Load the full route */
-    i = 0;
-    while ( !feof(fp) ) {
-        if ( !fgets(buf, sizeof(buf), fp) ) {
-            continue;
-        }
-        ret = sscanf(buf, "%d.%d.%d.%d/%d %d.%d.%d.%d", &prefix[0], &prefix[1],
-                     &prefix[2], &prefix[3], &prefixlen, &nexthop[0],
-                     &nexthop[1], &nexthop[2], &nexthop[3]);
-        if ( ret < 0 ) {
-            return -1;
-        }
+    /* Empty snapshot */
+    snap = path_compressed_trie_freeze(trie);
+    if ( NULL == snap ) {
+        return -1;
+    }
+    if ( NULL != path_compressed_trie_snapshot_lookup(snap, 0x0a000000) ) {
+        return -1;
+    }
+    path_compressed_trie_snapshot_release(snap);
 
-        /* Convert to u32 */
-        addr1 = ((uint32_t)prefix[0] << 24) + ((uint32_t)prefix[1] << 16)
-            + ((uint32_t)prefix[2] << 8) + (uint32_t)prefix[3];
-        addr2 = ((uint32_t)nexthop[0] << 24) + ((uint32_t)nexthop[1] << 16)
-            + ((uint32_t)nexthop[2] << 8) + (uint32_t)nexthop[3];
+    TEST_PROGRESS();
 
-        /* Add an entry */
-        ret = path_compressed_trie_add(trie, addr1, prefixlen,
-                                       (void *)(uint64_t)addr2);
+    /* Insert nested prefixes */
+    for ( i = 0; i < 1024; i++ ) {
+        ret = path_compressed_trie_add(trie, 0x0a000000 + (i << 12),
+                                       20 + (i & 3), (void *)(uint64_t)(i + 1));
         if ( ret < 0 ) {
             return -1;
         }
-        if ( 0 == i % 10000 ) {
-            TEST_PROGRESS();
+    }
+    ret = path_compressed_trie_add(trie, 0x0a000000, 8, (void *)1024);
+    if ( ret < 0 ) {
+        return -1;
+    }
+    snap = path_compressed_trie_freeze(trie);
+    if ( NULL == snap ) {
+        return -1;
+    }
+    for ( i = 0; i < 0x1000000; i += 0x100 ) {
+        if ( path_compressed_trie_lookup(trie, 0x0a000000 + i)
+             != path_compressed_trie_snapshot_lookup(snap, 0x0a000000 + i) ) {
+            return -1;
         }
-        i++;
     }
 
-    t0 = getmicrotime();
+    TEST_PROGRESS();
+
+    /* The snapshot is not affected by the updates of the trie */
+    if ( (void *)1024 != path_compressed_trie_delete(trie, 0x0a000000, 8) ) {
+        return -1;
+    }
+    if ( (void *)1024
+         != path_compressed_trie_snapshot_lookup(snap, 0x0affffff) ) {
+        return -1;
+    }
+    path_compressed_trie_snapshot_release(snap);
+
+    /* Release */
+    path_compressed_trie_release(trie);
+
+    return 0;
+}
+
+/*
+ * Compare the lookups of the trie with the front table against the trie
+ * without it
+ */
+static int
+_front_check(struct path_compressed_trie *trie,
+             struct path_compressed_trie *ref)
+{
+    uint32_t keys[TEST_BURST_SIZE];
+    void *out[TEST_BURST_SIZE];
+    uint32_t a;
+    ssize_t i;
+    ssize_t j;
+
+    /* Whole 10.0.0.0/8 and random keys */
+    for ( i = 0; i < 0x1000000; i += 0x10 ) {
+        a = 0x0a000000 + i;
+        if ( path_compressed_trie_lookup(trie, a)
+             != path_compressed_trie_lookup(ref, a) ) {
+            return -1;
+        }
+    }
+    for ( i = 0; i < 0x100000; i += TEST_BURST_SIZE ) {
+        for ( j = 0; j < TEST_BURST_SIZE; j++ ) {
+            keys[j] = xor128();
+        }
+        path_compressed_trie_lookup_batch(trie, keys, out, TEST_BURST_SIZE);
+        for ( j = 0; j < TEST_BURST_SIZE; j++ ) {
+            if ( path_compressed_trie_lookup(trie, keys[j])
+                 != path_compressed_trie_lookup(ref, keys[j])
+                 || out[j] != path_compressed_trie_lookup(ref, keys[j]) ) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Add a prefix to both the tries
+ */
+static int
+_front_add(struct path_compressed_trie *trie, struct path_compressed_trie *ref,
+           uint32_t key, int prefixlen, uint64_t data)
+{
+    if ( path_compressed_trie_add(trie, key, prefixlen, (void *)data) < 0 ) {
+        return -1;
+    }
+    if ( path_compressed_trie_add(ref, key, prefixlen, (void *)data) < 0 ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Front table test
+ */
+static int
+test_front(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie *ref;
+    static const int flags[] = { PATH_COMPRESSED_TRIE_FRONT_16,
+                                 PATH_COMPRESSED_TRIE_FRONT_24 };
+    size_t f;
+    uint32_t i;
+    int ret;
+
+    for ( f = 0; f < sizeof(flags) / sizeof(flags[0]); f++ ) {
+        /* Initialize */
+        trie = path_compressed_trie_init_flags(NULL, flags[f]);
+        if ( NULL == trie ) {
+            return -1;
+        }
+        ref = path_compressed_trie_init(NULL);
+        if ( NULL == ref ) {
+            return -1;
+        }
+
+        /* Insert the prefixes from the shortest to the longest */
+        ret = _front_add(trie, ref, 0x00000000, 1, 1);
+        ret |= _front_add(trie, ref, 0x0a000000, 8, 2);
+        for ( i = 0; i < 64; i++ ) {
+            ret |= _front_add(trie, ref, 0x0a000000 + (i << 18), 14, 16 + i);
+        }
+        for ( i = 0; i < 256; i++ ) {
+            ret |= _front_add(trie, ref, 0x0a000000 + (i << 12), 20 + (i & 3),
+                              256 + i);
+        }
+        for ( i = 0; i < 256; i++ ) {
+            ret |= _front_add(trie, ref, 0x0a100000 + (i << 8), 24, 1024 + i);
+            ret |= _front_add(trie, ref, 0x0a200000 + (i << 4), 28, 2048 + i);
+            ret |= _front_add(trie, ref, 0x0a300000 + i * 0x1001, 32,
+                              4096 + i);
+        }
+        if ( ret < 0 ) {
+            return -1;
+        }
+        if ( _front_check(trie, ref) < 0 ) {
+            return -1;
+        }
+
+        TEST_PROGRESS();
+
+        /* Delete a part of the prefixes including the covering ones */
+        for ( i = 0; i < 256; i += 3 ) {
+            if ( path_compressed_trie_delete(trie, 0x0a100000 + (i << 8), 24)
+                 != path_compressed_trie_delete(ref, 0x0a100000 + (i << 8),
+                                                24) ) {
+                return -1;
+            }
+            if ( path_compressed_trie_delete(trie, 0x0a300000 + i * 0x1001, 32)
+                 != path_compressed_trie_delete(ref, 0x0a300000 + i * 0x1001,
+                                                32) ) {
+                return -1;
+            }
+        }
+        if ( (void *)2 != path_compressed_trie_delete(trie, 0x0a000000, 8)
+             || (void *)2 != path_compressed_trie_delete(ref, 0x0a000000, 8) ) {
+            return -1;
+        }
+        if ( _front_check(trie, ref) < 0 ) {
+            return -1;
+        }
+
+        /* Churn of the short prefixes covering the whole front table */
+        for ( i = 0; i < 8; i++ ) {
+            if ( path_compressed_trie_add(trie, 0, 0, (void *)3) < 0
+                 || (void *)3 != path_compressed_trie_delete(trie, 0, 0)
+                 || path_compressed_trie_add(trie, 0x0a000000, 8,
+                                             (void *)2) < 0
+                 || (void *)2 != path_compressed_trie_delete(trie, 0x0a000000,
+                                                             8) ) {
+                return -1;
+            }
+        }
+        if ( _front_check(trie, ref) < 0 ) {
+            return -1;
+        }
+
+        /* The front table is included in the memory usage */
+        if ( path_compressed_trie_memory(trie)
+             < path_compressed_trie_memory(ref)
+             + (sizeof(struct path_compressed_trie_front_entry)
+                << trie->front_bits) ) {
+            return -1;
+        }
+
+        TEST_PROGRESS();
+
+        /* Release */
+        path_compressed_trie_release(trie);
+        path_compressed_trie_release(ref);
+    }
+
+    return 0;
+}
+
+/*
+ * Data of the prefixes in the concurrent test: the covering /8, the churned
+ * /24s and the /28s in every fourth /24
+ */
+#define CHURN_DATA8             0x300000000ULL
+#define CHURN_DATA24(k)         (0x100000000ULL | ((k) >> 8))
+#define CHURN_DATA28(k)         (0x200000000ULL | ((k) >> 4))
+#define CHURN_HAS28(k)          (0 == (((k) >> 8) & 3))
+#define CHURN_IN28(k)           (CHURN_HAS28(k) && 0x10 == ((k) & 0xf0))
+
+struct churn {
+    struct path_compressed_trie *trie;
+    /* Global lock instead of the epochs if non-zero */
+    int locked;
+    pthread_mutex_t mutex;
+    volatile int stop;
+    volatile int error;
+    uint64_t updates;
+};
+struct churn_reader {
+    pthread_t th;
+    struct churn *c;
+    uint32_t seed;
+    uint64_t lookups;
+};
+
+/*
+ * Reader thread of the concurrent test: looks up the keys in the churned
+ * range and checks that every result is one of the prefixes covering it
+ */
+static void *
+_churn_reader(void *arg)
+{
+    struct churn_reader *r;
+    struct path_compressed_trie_reader *reader;
+    uint64_t res;
+    uint32_t k;
+    int i;
+
+    r = arg;
+    reader = path_compressed_trie_reader_register(r->c->trie);
+    if ( NULL == reader ) {
+        r->c->error = 1;
+        return NULL;
+    }
+    while ( !r->c->stop ) {
+        if ( r->c->locked ) {
+            pthread_mutex_lock(&r->c->mutex);
+        } else {
+            path_compressed_trie_reader_enter(r->c->trie, reader);
+        }
+        for ( i = 0; i < TEST_BURST_SIZE; i++ ) {
+            /* Xorshift */
+            r->seed ^= r->seed << 13;
+            r->seed ^= r->seed >> 17;
+            r->seed ^= r->seed << 5;
+            k = TEST_CHURN_BASE | (r->seed & 0x000fffff);
+            res = (uint64_t)path_compressed_trie_lookup(r->c->trie, k);
+            if ( res != CHURN_DATA8 && res != CHURN_DATA24(k)
+                 && !(CHURN_IN28(k) && res == CHURN_DATA28(k)) ) {
+                r->c->error = 1;
+            }
+        }
+        if ( r->c->locked ) {
+            pthread_mutex_unlock(&r->c->mutex);
+        } else {
+            path_compressed_trie_reader_exit(reader);
+        }
+        r->lookups += TEST_BURST_SIZE;
+    }
+    path_compressed_trie_reader_unregister(r->c->trie, reader);
+
+    return NULL;
+}
+
+/*
+ * Add or delete the churned prefixes
+ */
+static int
+_churn_update(struct churn *c, int add)
+{
+    uint32_t k;
+    uint32_t i;
+    int ret;
+
+    for ( i = 0; i < TEST_CHURN_PREFIXES; i++ ) {
+        k = TEST_CHURN_BASE + (i << 8);
+        if ( c->locked ) {
+            pthread_mutex_lock(&c->mutex);
+        }
+        ret = 0;
+        if ( add ) {
+            ret = path_compressed_trie_add(c->trie, k, 24,
+                                           (void *)CHURN_DATA24(k));
+            if ( CHURN_HAS28(k) ) {
+                ret |= path_compressed_trie_add(c->trie, k + 0x10, 28,
+                                                (void *)CHURN_DATA28(k + 0x10));
+            }
+        } else {
+            if ( (void *)CHURN_DATA24(k)
+                 != path_compressed_trie_delete(c->trie, k, 24) ) {
+                ret = -1;
+            }
+            if ( CHURN_HAS28(k)
+                 && (void *)CHURN_DATA28(k + 0x10)
+                 != path_compressed_trie_delete(c->trie, k + 0x10, 28) ) {
+                ret = -1;
+            }
+        }
+        if ( c->locked ) {
+            pthread_mutex_unlock(&c->mutex);
+        }
+        if ( ret < 0 ) {
+            return -1;
+        }
+        c->updates += CHURN_HAS28(k) ? 2 : 1;
+    }
+
+    return 0;
+}
+
+/*
+ * Run the writer churning the prefixes along with the readers
+ */
+static int
+_churn_run(struct churn *c, int nreaders, double *lps, double *ups)
+{
+    struct churn_reader r[8];
+    uint64_t lookups;
+    double t0;
+    double t1;
+    int i;
+
+    c->stop = 0;
+    c->error = 0;
+    c->updates = 0;
+    t0 = getmicrotime();
+    for ( i = 0; i < nreaders; i++ ) {
+        r[i].c = c;
+        r[i].seed = 2463534242U + i;
+        r[i].lookups = 0;
+        if ( 0 != pthread_create(&r[i].th, NULL, _churn_reader, &r[i]) ) {
+            return -1;
+        }
+    }
+    for ( i = 0; i < TEST_CHURN_ROUNDS && !c->error; i++ ) {
+        if ( _churn_update(c, 0) < 0 || _churn_update(c, 1) < 0 ) {
+            c->error = 1;
+        }
+    }
+    c->stop = 1;
+    lookups = 0;
+    for ( i = 0; i < nreaders; i++ ) {
+        pthread_join(r[i].th, NULL);
+        lookups += r[i].lookups;
+    }
+    t1 = getmicrotime();
+
+    *lps = lookups / (t1 - t0);
+    *ups = c->updates / (t1 - t0);
+
+    return c->error ? -1 : 0;
+}
+
+/*
+ * Concurrent lookup test: reader threads run the lookups while a writer
+ * thread keeps deleting and adding prefixes
+ */
+static int
+test_concurrent(void)
+{
+    struct churn c;
+    struct path_compressed_trie_arena_stats st;
+    static const int nreaders[] = { 1, 2, 4, 8 };
+    size_t used;
+    double lps;
+    double ups;
+    size_t i;
+
+    /* Initialize */
+    c.trie = path_compressed_trie_init(NULL);
+    if ( NULL == c.trie ) {
+        return -1;
+    }
+    pthread_mutex_init(&c.mutex, NULL);
+
+    /* Load the full route and the prefixes to churn */
+    if ( _load_linx(c.trie, NULL) < 0 ) {
+        return -1;
+    }
+    if ( path_compressed_trie_add(c.trie, TEST_CHURN_BASE, 8,
+                                  (void *)CHURN_DATA8) < 0 ) {
+        return -1;
+    }
+    c.locked = 0;
+    c.updates = 0;
+    if ( _churn_update(&c, 1) < 0 ) {
+        return -1;
+    }
+    path_compressed_trie_arena_stats(c.trie, &st);
+    used = st.used;
+
+    for ( i = 0; i < sizeof(nreaders) / sizeof(nreaders[0]); i++ ) {
+        TEST_PROGRESS();
+        c.locked = 1;
+        if ( _churn_run(&c, nreaders[i], &lps, &ups) < 0 ) {
+            return -1;
+        }
+        printf("Concurrent[lock,%d]: %lf Mlps, %lf updates/sec\n", nreaders[i],
+               lps / 1000000, ups);
+        TEST_PROGRESS();
+        c.locked = 0;
+        if ( _churn_run(&c, nreaders[i], &lps, &ups) < 0 ) {
+            return -1;
+        }
+        printf("Concurrent[epoch,%d]: %lf Mlps, %lf updates/sec\n",
+               nreaders[i], lps / 1000000, ups);
+    }
+
+    /* All the retired nodes are released once the readers are gone */
+    path_compressed_trie_synchronize(c.trie);
+    path_compressed_trie_arena_stats(c.trie, &st);
+    if ( 0 != st.retired || used != st.used ) {
+        return -1;
+    }
+
+    /* Release */
+    pthread_mutex_destroy(&c.mutex);
+    path_compressed_trie_release(c.trie);
+
+    return 0;
+}
+
+/*
+ * Writer thread of the concurrent writer test: churns the prefixes in its own
+ * subtree
+ */
+struct churn_writer {
+    pthread_t th;
+    struct path_compressed_trie *trie;
+    uint32_t base;
+    int error;
+    uint64_t updates;
+};
+static void *
+_churn_writer(void *arg)
+{
+    struct churn_writer *w;
+    uint32_t k;
+    uint32_t i;
+    int r;
+
+    w = arg;
+    for ( r = 0; r < TEST_CHURN_ROUNDS; r++ ) {
+        for ( i = 0; i < TEST_CHURN_PREFIXES; i++ ) {
+            k = w->base + (i << 8);
+            if ( path_compressed_trie_add(w->trie, k, 24,
+                                          (void *)CHURN_DATA24(k)) < 0 ) {
+                w->error = 1;
+            }
+        }
+        for ( i = 0; i < TEST_CHURN_PREFIXES; i++ ) {
+            k = w->base + (i << 8);
+            if ( (void *)CHURN_DATA24(k)
+                 != path_compressed_trie_delete(w->trie, k, 24) ) {
+                w->error = 1;
+            }
+        }
+        w->updates += 2 * TEST_CHURN_PREFIXES;
+    }
+
+    return NULL;
+}
+
+/*
+ * Concurrent writer test: the writer threads update disjoint subtrees
+ */
+static int
+test_concurrent_writers(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie *ref;
+    struct path_compressed_trie_arena_stats st;
+    struct churn_writer w[8];
+    static const int nwriters[] = { 1, 2, 4, 8 };
+    uint64_t updates;
+    size_t used;
+    uint32_t a;
+    size_t i;
+    int j;
+    double t0;
+    double t1;
+
+    /* The trie with the pinned top levels is equivalent to the plain one */
+    trie = path_compressed_trie_init_flags(NULL,
+                                           PATH_COMPRESSED_TRIE_CONCURRENT);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    ref = path_compressed_trie_init(NULL);
+    if ( NULL == ref ) {
+        return -1;
+    }
+    if ( _load_linx(trie, NULL) < 0 || _load_linx(ref, NULL) < 0 ) {
+        return -1;
+    }
+    for ( i = 0; i < 0x1000000; i++ ) {
+        a = xor128();
+        if ( path_compressed_trie_lookup(trie, a)
+             != path_compressed_trie_lookup(ref, a) ) {
+            return -1;
+        }
+    }
+    path_compressed_trie_release(ref);
+    path_compressed_trie_release(trie);
+
+    TEST_PROGRESS();
+
+    /* Prefixes shorter than the pinned levels */
+    trie = path_compressed_trie_init_flags(NULL,
+                                           PATH_COMPRESSED_TRIE_CONCURRENT);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    path_compressed_trie_arena_stats(trie, &st);
+    used = st.used;
+    if ( path_compressed_trie_add(trie, 0, 0, (void *)1) < 0
+         || path_compressed_trie_add(trie, 0xa0000000, 4, (void *)2) < 0
+         || path_compressed_trie_add(trie, 0xa0000000, 4, (void *)2) >= 0 ) {
+        return -1;
+    }
+    if ( (void *)2 != path_compressed_trie_lookup(trie, 0xafffffff)
+         || (void *)1 != path_compressed_trie_lookup(trie, 0xb0000000) ) {
+        return -1;
+    }
+    if ( (void *)2 != path_compressed_trie_delete(trie, 0xa0000000, 4)
+         || NULL != path_compressed_trie_delete(trie, 0xa0000000, 4)
+         || (void *)1 != path_compressed_trie_delete(trie, 0, 0) ) {
+        return -1;
+    }
+    path_compressed_trie_arena_stats(trie, &st);
+    if ( used != st.used ) {
+        return -1;
+    }
+
+    /* Update throughput with the writers on the disjoint subtrees */
+    for ( i = 0; i < sizeof(nwriters) / sizeof(nwriters[0]); i++ ) {
+        TEST_PROGRESS();
+        t0 = getmicrotime();
+        for ( j = 0; j < nwriters[i]; j++ ) {
+            w[j].trie = trie;
+            w[j].base = (uint32_t)j << 29;
+            w[j].error = 0;
+            w[j].updates = 0;
+            if ( 0 != pthread_create(&w[j].th, NULL, _churn_writer, &w[j]) ) {
+                return -1;
+            }
+        }
+        updates = 0;
+        for ( j = 0; j < nwriters[i]; j++ ) {
+            pthread_join(w[j].th, NULL);
+            if ( w[j].error ) {
+                return -1;
+            }
+            updates += w[j].updates;
+        }
+        t1 = getmicrotime();
+        printf("Writers[%d]: %lf updates/sec\n", nwriters[i],
+               updates / (t1 - t0));
+    }
+
+    /* All the nodes are back except the pinned ones */
+    path_compressed_trie_synchronize(trie);
+    path_compressed_trie_arena_stats(trie, &st);
+    if ( 0 != st.retired || used != st.used ) {
+        return -1;
+    }
+
+    /* Release */
+    path_compressed_trie_release(trie);
+
+    return 0;
+}
+
+/*
+ * Bulk build test
+ */
+static int
+test_build(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie *ref;
+    struct path_compressed_trie_prefix_entry *entries;
+    struct path_compressed_trie_prefix_entry e[1024 + 3];
+    struct path_compressed_trie_arena_stats st0;
+    struct path_compressed_trie_arena_stats st1;
+    size_t n;
+    size_t i;
+
+    /* Nested prefixes in the reverse order */
+    n = 0;
+    for ( i = 0; i < 1024; i++ ) {
+        e[n].key = 0x0a000000 + ((1023 - i) << 12);
+        e[n].prefixlen = 20 + (i & 3);
+        e[n].data = (void *)(uint64_t)(i + 1);
+        n++;
+    }
+    e[n].key = 0x0a000000;
+    e[n].prefixlen = 8;
+    e[n].data = (void *)2048;
+    n++;
+    e[n].key = 0;
+    e[n].prefixlen = 0;
+    e[n].data = (void *)2049;
+    n++;
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    ref = path_compressed_trie_init(NULL);
+    if ( NULL == ref ) {
+        return -1;
+    }
+    if ( path_compressed_trie_build(trie, e, n) < 0 ) {
+        return -1;
+    }
+    for ( i = 0; i < n; i++ ) {
+        if ( path_compressed_trie_add(ref, e[i].key, e[i].prefixlen,
+                                      e[i].data) < 0 ) {
+            return -1;
+        }
+    }
+    if ( !_trie_equal(trie, trie->root, ref, ref->root) ) {
+        return -1;
+    }
+    path_compressed_trie_release(trie);
+
+    /* Duplicate prefixes are rejected */
+    e[n] = e[0];
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    if ( path_compressed_trie_build(trie, e, n + 1) >= 0 ) {
+        return -1;
+    }
+    path_compressed_trie_release(trie);
+    path_compressed_trie_release(ref);
+
+    /* Prefix lengths out of the range are rejected before any is added, also
+       on the concurrent trie adding them one by one */
+    e[n] = e[0];
+    e[n].prefixlen = 33;
+    trie = path_compressed_trie_init_flags(NULL,
+                                           PATH_COMPRESSED_TRIE_CONCURRENT);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    if ( path_compressed_trie_build(trie, e, n + 1) >= 0
+         || NULL != path_compressed_trie_lookup(trie, e[0].key) ) {
+        return -1;
+    }
+    e[n].prefixlen = -1;
+    if ( path_compressed_trie_build(trie, e, n + 1) >= 0
+         || NULL != path_compressed_trie_lookup(trie, e[0].key) ) {
+        return -1;
+    }
+    path_compressed_trie_release(trie);
+
+    TEST_PROGRESS();
+
+    /* Full route */
+    entries = _read_linx(&n);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    ref = path_compressed_trie_init(NULL);
+    if ( NULL == ref ) {
+        return -1;
+    }
+    if ( path_compressed_trie_build(trie, entries, n) < 0 ) {
+        return -1;
+    }
+    if ( _load_linx(ref, NULL) < 0 ) {
+        return -1;
+    }
+    path_compressed_trie_arena_stats(trie, &st0);
+    path_compressed_trie_arena_stats(ref, &st1);
+    if ( st0.used != st1.used
+         || !_trie_equal(trie, trie->root, ref, ref->root) ) {
+        return -1;
+    }
+    path_compressed_trie_release(trie);
+    path_compressed_trie_release(ref);
+    free(entries);
+
+    return 0;
+}
+
+/*
+ * RIB loader test
+ */
+static int
+test_rib(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie *ref;
+    struct path_compressed_trie_prefix_entry *entries;
+    struct path_compressed_trie_prefix_entry *e;
+    static const int nthreads[] = { 1, 3, 0 };
+    size_t n;
+    size_t m;
+    size_t i;
+    FILE *fp;
+
+    /* Malformed lines are skipped */
+    fp = fopen("tests/rib.tmp", "w");
+    if ( NULL == fp ) {
+        return -1;
+    }
+    fprintf(fp, "# header\n10.0.0.0/8 192.0.2.1\n256.0.0.0/8 192.0.2.1\n"
+            "10.1.0.0/33 192.0.2.1\n10.1.0.0 192.0.2.1\n\n"
+            "  10.1.0.0/16\t192.0.2.2 extra\n0.0.0.0/0 0.0.0.3");
+    fclose(fp);
+    e = path_compressed_trie_rib_parse("tests/rib.tmp", &n, 2);
+    unlink("tests/rib.tmp");
+    if ( NULL == e || 3 != n ) {
+        return -1;
+    }
+    if ( 0x0a000000 != e[0].key || 8 != e[0].prefixlen
+         || (void *)0xc0000201 != e[0].data
+         || 0x0a010000 != e[1].key || 16 != e[1].prefixlen
+         || (void *)0xc0000202 != e[1].data
+         || 0 != e[2].key || 0 != e[2].prefixlen || (void *)3 != e[2].data ) {
+        return -1;
+    }
+    free(e);
+
+    TEST_PROGRESS();
+
+    /* Same entries as sscanf() regardless of the number of the threads */
+    entries = _read_linx(&n);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    for ( i = 0; i < sizeof(nthreads) / sizeof(nthreads[0]); i++ ) {
+        e = path_compressed_trie_rib_parse(
+            "tests/linx-rib.20141217.0000-p46.txt", &m, nthreads[i]);
+        if ( NULL == e || m != n
+             || 0 != memcmp(e, entries, sizeof(*e) * n) ) {
+            return -1;
+        }
+        free(e);
+        TEST_PROGRESS();
+    }
+    free(entries);
+
+    /* Load into the trie */
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    ref = path_compressed_trie_init(NULL);
+    if ( NULL == ref ) {
+        return -1;
+    }
+    if ( (ssize_t)n != path_compressed_trie_rib_load(
+             trie, "tests/linx-rib.20141217.0000-p46.txt", 0) ) {
+        return -1;
+    }
+    if ( _load_linx(ref, NULL) < 0 ) {
+        return -1;
+    }
+    if ( !_trie_equal(trie, trie->root, ref, ref->root) ) {
+        return -1;
+    }
+    path_compressed_trie_release(trie);
+    path_compressed_trie_release(ref);
+
+    return 0;
+}
+
+/*
+ * Checksum of the binary image (the same as the one in pctrie_image.c)
+ */
+static uint64_t
+_image_checksum(const void *buf, size_t len)
+{
+    const uint32_t *w;
+    uint64_t a;
+    uint64_t b;
+    size_t i;
+
+    w = buf;
+    a = 1;
+    b = 0;
+    for ( i = 0; i < len / 4; i++ ) {
+        a += w[i];
+        b += a;
+    }
+
+    return (b << 32) ^ a ^ (len << 1);
+}
+
+/*
+ * Rewrite the first child link of the root in the binary image, to the end of
+ * the node array (loop = 0) or to the root itself (loop = 1), and fix the
+ * checksum so that only the link verification can reject the image
+ */
+static int
+_image_relink(const char *path, int loop)
+{
+    uint8_t *buf;
+    uint32_t nnodes;
+    uint32_t root;
+    uint64_t nodes_off;
+    uint64_t data_off;
+    uint64_t sum;
+    long size;
+    FILE *fp;
+    int ret;
+
+    fp = fopen(path, "r+b");
+    if ( NULL == fp ) {
+        return -1;
+    }
+    ret = -1;
+    buf = NULL;
+    if ( 0 == fseek(fp, 0, SEEK_END) && (size = ftell(fp)) > 0
+         && NULL != (buf = malloc(size)) && 0 == fseek(fp, 0, SEEK_SET)
+         && 1 == fread(buf, size, 1, fp) ) {
+        /* Header: nnodes, root, the node and data offsets, and the checksum */
+        memcpy(&nnodes, buf + 16, sizeof(uint32_t));
+        memcpy(&root, buf + 20, sizeof(uint32_t));
+        memcpy(&nodes_off, buf + 24, sizeof(uint64_t));
+        memcpy(&data_off, buf + 32, sizeof(uint64_t));
+        memcpy(buf + nodes_off + sizeof(struct path_compressed_trie_node) * root
+               + offsetof(struct path_compressed_trie_node, child),
+               loop ? &root : &nnodes, sizeof(uint32_t));
+        sum = _image_checksum(buf + nodes_off, data_off - nodes_off)
+            ^ (_image_checksum(buf + data_off, size - data_off) * 31);
+        memcpy(buf + 48, &sum, sizeof(uint64_t));
+        if ( 0 == fseek(fp, 0, SEEK_SET) && 1 == fwrite(buf, size, 1, fp) ) {
+            ret = 0;
+        }
+    }
+    free(buf);
+    if ( 0 != fclose(fp) ) {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/*
+ * Binary image test
+ */
+static int
+test_image(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_image *img;
+    struct path_compressed_trie_prefix_entry *entries;
+    uint32_t *keys;
+    size_t n;
+    size_t m;
+    ssize_t i;
+    double t0;
+    double t1;
+    FILE *fp;
+    int c;
+
+    /* Empty trie */
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    if ( path_compressed_trie_save(trie, "tests/image.tmp") < 0 ) {
+        return -1;
+    }
+    img = path_compressed_trie_map("tests/image.tmp");
+    if ( NULL == img ) {
+        return -1;
+    }
+    if ( NULL != path_compressed_trie_image_lookup(img, 0x0a000000) ) {
+        return -1;
+    }
+    path_compressed_trie_unmap(img);
+    path_compressed_trie_release(trie);
+
+    TEST_PROGRESS();
+
+    /* Full route */
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    if ( path_compressed_trie_rib_load(
+             trie, "tests/linx-rib.20141217.0000-p46.txt", 0) < 0 ) {
+        return -1;
+    }
+    t0 = getmicrotime();
+    if ( path_compressed_trie_save(trie, "tests/image.tmp") < 0 ) {
+        return -1;
+    }
+    t1 = getmicrotime();
+    printf("Image: %lf sec to save, ", t1 - t0);
+    t0 = getmicrotime();
+    img = path_compressed_trie_map("tests/image.tmp");
+    if ( NULL == img ) {
+        return -1;
+    }
+    t1 = getmicrotime();
+    printf("%lf sec to map, %zu bytes\n", t1 - t0, img->size);
+    entries = _read_linx(&n);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    keys = _boundary_keys(entries, n, &m);
+    if ( NULL == keys ) {
+        return -1;
+    }
+    for ( i = 0; i < (ssize_t)m; i++ ) {
+        if ( path_compressed_trie_lookup(trie, keys[i])
+             != path_compressed_trie_image_lookup(img, keys[i]) ) {
+            return -1;
+        }
+    }
+    free(keys);
+    free(entries);
+    path_compressed_trie_unmap(img);
+    path_compressed_trie_release(trie);
+
+    TEST_PROGRESS();
+
+    /* Images with a child out of the node array and with a loop are rejected
+       even with a valid checksum */
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    if ( path_compressed_trie_add(trie, 0x0a000000, 8, (void *)1) < 0
+         || path_compressed_trie_add(trie, 0x0a010000, 16, (void *)2) < 0
+         || path_compressed_trie_add(trie, 0x0a800000, 16, (void *)3) < 0 ) {
+        return -1;
+    }
+    for ( c = 0; c < 2; c++ ) {
+        if ( path_compressed_trie_save(trie, "tests/image.tmp") < 0 ) {
+            return -1;
+        }
+        if ( _image_relink("tests/image.tmp", c) < 0 ) {
+            return -1;
+        }
+        img = path_compressed_trie_map("tests/image.tmp");
+        if ( NULL != img ) {
+            return -1;
+        }
+    }
+    path_compressed_trie_release(trie);
+
+    /* A corrupted image is rejected */
+    fp = fopen("tests/image.tmp", "r+b");
+    if ( NULL == fp ) {
+        return -1;
+    }
+    if ( 0 != fseek(fp, 4096, SEEK_SET) ) {
+        return -1;
+    }
+    c = fgetc(fp);
+    if ( 0 != fseek(fp, 4096, SEEK_SET) ) {
+        return -1;
+    }
+    fputc(c ^ 1, fp);
+    fclose(fp);
+    img = path_compressed_trie_map("tests/image.tmp");
+    unlink("tests/image.tmp");
+    if ( NULL != img ) {
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Xorshift for 64-bit values
+ */
+static __inline__ uint64_t
+xor64(void)
+{
+    static uint64_t x = 88172645463325252ULL;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return x;
+}
+
+/*
+ * IPv6 prefix of the synthetic RIB
+ */
+struct test_prefix6 {
+    uint64_t key[2];
+    int prefixlen;
+};
+
+/*
+ * Generate an IPv6 RIB-like set of prefixes in 2000::/3 with the lengths
+ * dominated by /48, /32 and /40, and a few /64 and /128
+ */
+static void
+_gen_rib6(struct test_prefix6 *p, size_t n)
+{
+    static const int lens[16] = { 48, 48, 48, 48, 48, 48, 48, 32, 32, 32, 40,
+                                  44, 36, 29, 64, 128 };
+    size_t i;
+    int l;
+
+    for ( i = 0; i < n; i++ ) {
+        l = lens[xor64() & 15];
+        p[i].key[0] = 0x2000000000000000ULL
+            | (xor64() & 0x1fffffff00000000ULL) | (xor64() & 0xffffffffULL);
+        p[i].key[1] = xor64();
+        p[i].prefixlen = l;
+        if ( l < 64 ) {
+            p[i].key[0] &= ~0ULL << (64 - l);
+            p[i].key[1] = 0;
+        } else if ( l == 64 ) {
+            p[i].key[1] = 0;
+        }
+    }
+}
+
+/*
+ * Random IPv6 key under the prefix
+ */
+static void
+_key_under6(const struct test_prefix6 *p, uint64_t *key)
+{
+    key[0] = p->key[0];
+    key[1] = p->key[1];
+    if ( p->prefixlen < 64 ) {
+        key[0] |= xor64() >> p->prefixlen;
+        key[1] = xor64();
+    } else if ( p->prefixlen < 128 ) {
+        key[1] |= xor64() >> (p->prefixlen - 64);
+    }
+}
+
+/*
+ * Reference lookup of an IPv6 key by scanning all the prefixes
+ */
+static void *
+_lookup6_linear(struct test_prefix6 *p, void **data, size_t n,
+                const uint64_t *key)
+{
+    uint64_t m0;
+    uint64_t m1;
+    size_t i;
+    int best;
+    void *res;
+
+    best = -1;
+    res = NULL;
+    for ( i = 0; i < n; i++ ) {
+        if ( NULL == data[i] || p[i].prefixlen <= best ) {
+            continue;
+        }
+        m0 = p[i].prefixlen >= 64 ? ~0ULL
+            : (p[i].prefixlen ? ~0ULL << (64 - p[i].prefixlen) : 0);
+        m1 = p[i].prefixlen >= 128 ? ~0ULL
+            : (p[i].prefixlen > 64 ? ~0ULL << (128 - p[i].prefixlen) : 0);
+        if ( ((key[0] ^ p[i].key[0]) & m0) == 0
+             && ((key[1] ^ p[i].key[1]) & m1) == 0 ) {
+            best = p[i].prefixlen;
+            res = data[i];
+        }
+    }
+
+    return res;
+}
+
+/*
+ * IPv6 (128-bit key) test
+ */
+static int
+test_ipv6(void)
+{
+    struct path_compressed_trie6 *trie;
+    struct test_prefix6 p[4096];
+    void *data[4096];
+    uint64_t key[2];
+    size_t used;
+    size_t i;
+    size_t j;
+    int ret;
+
+    trie = path_compressed_trie6_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    used = trie->nused;
+
+    /* Small RIB with the covering /0 and /16 checked against a linear scan */
+    _gen_rib6(p, 4096);
+    p[0].key[0] = 0;
+    p[0].key[1] = 0;
+    p[0].prefixlen = 0;
+    p[1].key[0] = 0x2001000000000000ULL;
+    p[1].key[1] = 0;
+    p[1].prefixlen = 16;
+    for ( i = 0; i < 4096; i++ ) {
+        data[i] = (void *)(uint64_t)(i + 1);
+        ret = path_compressed_trie6_add(trie, p[i].key, p[i].prefixlen,
+                                        data[i]);
+        if ( ret < 0 ) {
+            /* Duplicate */
+            data[i] = NULL;
+        }
+    }
+    for ( j = 0; j < 2; j++ ) {
+        for ( i = 0; i < 0x10000; i++ ) {
+            /* Keys under the prefixes and random keys */
+            if ( i & 1 ) {
+                _key_under6(&p[i & 4095], key);
+            } else {
+                key[0] = 0x2000000000000000ULL | (xor64() >> 3);
+                key[1] = xor64();
+            }
+            if ( path_compressed_trie6_lookup(trie, key)
+                 != _lookup6_linear(p, data, 4096, key) ) {
+                return -1;
+            }
+        }
+        TEST_PROGRESS();
+
+        /* Delete a half of the prefixes */
+        for ( i = 0; j == 0 && i < 4096; i += 2 ) {
+            if ( path_compressed_trie6_delete(trie, p[i].key, p[i].prefixlen)
+                 != data[i] ) {
+                return -1;
+            }
+            data[i] = NULL;
+        }
+    }
+
+    /* Delete all; the nodes are released */
+    for ( i = 1; i < 4096; i += 2 ) {
+        if ( path_compressed_trie6_delete(trie, p[i].key, p[i].prefixlen)
+             != data[i] ) {
+            return -1;
+        }
+    }
+    if ( 0 != trie->nprefixes || used != trie->nused || 0 != trie->root ) {
+        return -1;
+    }
+
+    /* Release */
+    path_compressed_trie6_release(trie);
+
+    return 0;
+}
+
+/*
+ * Multi-table (VRF) test
+ */
+static int
+test_vrf(void)
+{
+    struct path_compressed_trie_vrf *vrf;
+    struct path_compressed_trie **tries;
+    struct path_compressed_trie_table_stats st;
+    struct path_compressed_trie_arena_stats ast;
+    struct path_compressed_trie_prefix_entry *entries;
+    uint32_t keys[100];
+    uint32_t *bkeys;
+    uint32_t ntables;
+    uint32_t t;
+    uint32_t k;
+    size_t mem;
+    size_t nentries;
+    size_t m;
+    ssize_t i;
+    uint64_t res;
+    double t0;
+    double t1;
+    int ret;
+
+    /* Tables of /16-/24 prefixes in 10.0.0.0/8 with the default routes */
+    ntables = 256;
+    vrf = path_compressed_trie_vrf_init(NULL, ntables);
+    if ( NULL == vrf ) {
+        return -1;
+    }
+    tries = malloc(sizeof(struct path_compressed_trie *) * ntables);
+    entries = malloc(sizeof(struct path_compressed_trie_prefix_entry)
+                     * ntables * 100);
+    if ( NULL == tries || NULL == entries ) {
+        return -1;
+    }
+    nentries = 0;
+    for ( t = 0; t < ntables; t++ ) {
+        tries[t] = path_compressed_trie_init(NULL);
+        if ( NULL == tries[t] ) {
+            return -1;
+        }
+        if ( path_compressed_trie_vrf_add(vrf, t, 0, 0,
+                                          (void *)(uint64_t)(t + 1)) < 0
+             || path_compressed_trie_add(tries[t], 0, 0,
+                                         (void *)(uint64_t)(t + 1)) < 0 ) {
+            return -1;
+        }
+        for ( i = 0; i < 100; i++ ) {
+            k = 0x0a000000 | (xor128() & 0x00ffff00);
+            k &= (uint32_t)(0xffffffff00000000ULL >> (16 + (i % 9)));
+            if ( 0 == t ) {
+                keys[i] = k;
+            }
+            entries[nentries].key = k;
+            entries[nentries].prefixlen = 16 + (i % 9);
+            nentries++;
+            ret = path_compressed_trie_vrf_add(vrf, t, k, 16 + (i % 9),
+                                               (void *)(uint64_t)k);
+            if ( ret != path_compressed_trie_add(tries[t], k, 16 + (i % 9),
+                                                 (void *)(uint64_t)k) ) {
+                return -1;
+            }
+        }
+    }
+    if ( path_compressed_trie_vrf_add(vrf, ntables, 0, 0, (void *)1) >= 0 ) {
+        return -1;
+    }
+
+    /* Lookups are namespaced by the table */
+    for ( i = 0; i < 0x100000; i++ ) {
+        t = xor128() % ntables;
+        k = 0x0a000000 | (xor128() & 0x00ffffff);
+        if ( path_compressed_trie_vrf_lookup(vrf, t, k)
+             != path_compressed_trie_lookup(tries[t], k) ) {
+            return -1;
+        }
+    }
+
+    /* Per-table counts and the memory against the separate tries */
+    mem = 0;
+    for ( t = 0; t < ntables; t++ ) {
+        if ( path_compressed_trie_vrf_stats(vrf, t, &st) < 0 ) {
+            return -1;
+        }
+        path_compressed_trie_arena_stats(tries[t], &ast);
+        if ( st.nodes != ast.used ) {
+            return -1;
+        }
+        mem += path_compressed_trie_memory(tries[t]);
+    }
+    printf("VRF: %u tables, %zu bytes shared, %zu bytes separate; ", ntables,
+           path_compressed_trie_vrf_memory(vrf), mem);
+
+    TEST_PROGRESS();
+
+    /* Delete the default routes and a table */
+    for ( t = 0; t < ntables; t++ ) {
+        if ( (void *)(uint64_t)(t + 1)
+             != path_compressed_trie_vrf_delete(vrf, t, 0, 0) ) {
+            return -1;
+        }
+    }
+    for ( i = 0; i < 100; i++ ) {
+        (void)path_compressed_trie_vrf_delete(vrf, 0, keys[i], 16 + (i % 9));
+        (void)path_compressed_trie_delete(tries[0], keys[i], 16 + (i % 9));
+    }
+    path_compressed_trie_vrf_stats(vrf, 0, &st);
+    if ( 0 != st.prefixes || 0 != st.nodes ) {
+        return -1;
+    }
+    for ( t = 0; t < ntables; t++ ) {
+        (void)path_compressed_trie_delete(tries[t], 0, 0);
+    }
+    for ( i = 0; i < 0x100000; i++ ) {
+        t = xor128() % ntables;
+        k = xor128();
+        if ( path_compressed_trie_vrf_lookup(vrf, t, k)
+             != path_compressed_trie_lookup(tries[t], k) ) {
+            return -1;
+        }
+    }
+
+    /* Lookups of all the tables on the boundaries of all the prefixes, and
+       the time of them */
+    bkeys = _boundary_keys(entries, nentries, &m);
+    if ( NULL == bkeys ) {
+        return -1;
+    }
+    t0 = getmicrotime();
+    res = 0;
+    for ( t = 0; t < ntables; t++ ) {
+        for ( i = 0; i < (ssize_t)m; i++ ) {
+            res += (uint64_t)path_compressed_trie_vrf_lookup(vrf, t, bkeys[i]);
+        }
+    }
+    t1 = getmicrotime();
+    printf("%lf ns/lookup\n", (t1 - t0) / ((double)ntables * m) * 1000000000);
+    for ( t = 0; t < ntables; t++ ) {
+        for ( i = 0; i < (ssize_t)m; i++ ) {
+            if ( path_compressed_trie_vrf_lookup(vrf, t, bkeys[i])
+                 != path_compressed_trie_lookup(tries[t], bkeys[i]) ) {
+                return -1;
+            }
+        }
+    }
+    free(bkeys);
+    free(entries);
+
+    /* Release */
+    for ( t = 0; t < ntables; t++ ) {
+        path_compressed_trie_release(tries[t]);
+    }
+    free(tries);
+    path_compressed_trie_vrf_release(vrf);
+
+    return res ? 0 : -1;
+}
+
+/*
+ * Transaction test
+ */
+static int
+test_txn(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie *ref;
+    struct path_compressed_trie_txn *txn;
+    struct path_compressed_trie_arena_stats st;
+    uint32_t *keys;
+    int *plens;
+    uint32_t k;
+    void *data;
+    ssize_t i;
+    int round;
+    int flags[3] = { 0, PATH_COMPRESSED_TRIE_FRONT_16,
+                     PATH_COMPRESSED_TRIE_CONCURRENT };
+    int f;
+    int plen;
+
+    keys = malloc(sizeof(uint32_t) * 64 * 4096);
+    plens = malloc(sizeof(int) * 64 * 4096);
+    if ( NULL == keys || NULL == plens ) {
+        return -1;
+    }
+    for ( f = 0; f < 3; f++ ) {
+        trie = path_compressed_trie_init_flags(NULL, flags[f]);
+        ref = path_compressed_trie_init(NULL);
+        if ( NULL == trie || NULL == ref ) {
+            return -1;
+        }
+        for ( round = 0; round < 64; round++ ) {
+            txn = path_compressed_trie_txn_begin(trie);
+            if ( NULL == txn ) {
+                return -1;
+            }
+            /* Announcements, replacements and withdrawals in 10.0.0.0/12 with
+               the same prefixes repeated in the batch */
+            for ( i = 0; i < 4096; i++ ) {
+                plen = 8 + xor128() % 25;
+                k = (0x0a000000 | (xor128() & 0x000fffff))
+                    & (uint32_t)(0xffffffff00000000ULL >> plen);
+                data = (xor128() % 3) ? (void *)(uint64_t)(k + plen) : NULL;
+                if ( path_compressed_trie_txn_apply(txn, k, plen, data) < 0 ) {
+                    return -1;
+                }
+                keys[round * 4096 + i] = k;
+                plens[round * 4096 + i] = plen;
+                (void)path_compressed_trie_delete(ref, k, plen);
+                if ( NULL != data ) {
+                    if ( path_compressed_trie_add(ref, k, plen, data) < 0 ) {
+                        return -1;
+                    }
+                }
+            }
+            if ( path_compressed_trie_txn_commit(txn) <= 0 ) {
+                return -1;
+            }
+            /* The spare front table is kept in sync with the published one,
+               also by the updates out of the transactions */
+            if ( NULL != trie->front ) {
+                k = 0x0b000000 | ((uint32_t)round << 8);
+                if ( path_compressed_trie_add(trie, k, 24, (void *)1) < 0
+                     || path_compressed_trie_add(ref, k, 24, (void *)1) < 0 ) {
+                    return -1;
+                }
+                if ( NULL == trie->front_spare
+                     || 0 != memcmp(trie->front, trie->front_spare,
+                                    sizeof(*trie->front)
+                                    << trie->front_bits) ) {
+                    return -1;
+                }
+            }
+            for ( i = 0; i < 0x10000; i++ ) {
+                k = 0x0a000000 | (xor128() & 0x001fffff);
+                if ( path_compressed_trie_lookup(trie, k)
+                     != path_compressed_trie_lookup(ref, k) ) {
+                    return -1;
+                }
+            }
+        }
+        TEST_PROGRESS();
+
+        /* Withdraw all in a transaction, and an empty transaction */
+        txn = path_compressed_trie_txn_begin(trie);
+        if ( NULL == txn ) {
+            return -1;
+        }
+        for ( i = 0; i < 64 * 4096; i++ ) {
+            if ( path_compressed_trie_txn_apply(txn, keys[i], plens[i],
+                                                NULL) < 0 ) {
+                return -1;
+            }
+        }
+        for ( i = 0; i < 64; i++ ) {
+            if ( path_compressed_trie_txn_apply(txn, 0x0b000000 | (i << 8), 24,
+                                                NULL) < 0 ) {
+                return -1;
+            }
+        }
+        if ( path_compressed_trie_txn_commit(txn) < 0 ) {
+            return -1;
+        }
+        txn = path_compressed_trie_txn_begin(trie);
+        if ( NULL == txn || 0 != path_compressed_trie_txn_commit(txn) ) {
+            return -1;
+        }
+        path_compressed_trie_synchronize(trie);
+        path_compressed_trie_arena_stats(trie, &st);
+        /* Only the pinned levels are left */
+        if ( st.used != ((flags[f] & PATH_COMPRESSED_TRIE_CONCURRENT)
+                         ? (1U << PATH_COMPRESSED_TRIE_LOCK_BITS) - 1 : 0) ) {
+            return -1;
+        }
+        for ( i = 0; i < 0x10000; i++ ) {
+            if ( NULL != path_compressed_trie_lookup(trie, xor128()) ) {
+                return -1;
+            }
+        }
+        path_compressed_trie_release(ref);
+        path_compressed_trie_release(trie);
+    }
+    free(keys);
+    free(plens);
+
+    return 0;
+}
+
+/*
+ * Lookup cache test
+ */
+static int
+test_cache(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_cache *cache;
+    uint32_t k;
+    ssize_t i;
+
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    cache = path_compressed_trie_cache_init(trie, 64);
+    if ( NULL == cache ) {
+        return -1;
+    }
+    if ( 0 != path_compressed_trie_cache_lookup(cache, 0x0a000001) ) {
+        return -1;
+    }
+
+    /* The updates invalidate the cached entries */
+    for ( i = 0; i < 256; i++ ) {
+        k = 0x0a000000 | ((uint32_t)i << 16);
+        if ( path_compressed_trie_add(trie, k, 16, (void *)(uint64_t)k) < 0 ) {
+            return -1;
+        }
+        if ( path_compressed_trie_cache_lookup(cache, k | 1)
+             != (void *)(uint64_t)k ) {
+            return -1;
+        }
+    }
+    if ( path_compressed_trie_add(trie, 0x0a050000, 24, (void *)1) < 0
+         || (void *)1 != path_compressed_trie_cache_lookup(cache,
+                                                           0x0a050001) ) {
+        return -1;
+    }
+    if ( (void *)1 != path_compressed_trie_delete(trie, 0x0a050000, 24)
+         || (void *)0x0a050000ULL
+         != path_compressed_trie_cache_lookup(cache, 0x0a050001) ) {
+        return -1;
+    }
+
+    /* Repeated keys hit the cache */
+    cache->hits = 0;
+    cache->misses = 0;
+    for ( i = 0; i < 0x10000; i++ ) {
+        k = 0x0a000000 | ((uint32_t)(i & 15) << 16) | 1;
+        if ( path_compressed_trie_cache_lookup(cache, k)
+             != path_compressed_trie_lookup(trie, k) ) {
+            return -1;
+        }
+    }
+    if ( cache->misses > 16 || cache->hits + cache->misses != 0x10000 ) {
+        return -1;
+    }
+
+    /* Random keys more than the entries */
+    for ( i = 0; i < 0x100000; i++ ) {
+        k = 0x0a000000 | (xor128() & 0x00ff0fff);
+        if ( path_compressed_trie_cache_lookup(cache, k)
+             != path_compressed_trie_lookup(trie, k) ) {
+            return -1;
+        }
+    }
+
+    path_compressed_trie_cache_release(cache);
+    path_compressed_trie_release(trie);
+
+    return 0;
+}
+
+/*
+ * Shape statistics test; prints the statistics of the full route
+ */
+static int
+test_stats(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_stats st;
+    struct path_compressed_trie_arena_stats ast;
+    struct path_compressed_trie_prefix_entry *entries;
+    size_t n;
+    size_t sum;
+    int i;
+
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    path_compressed_trie_stats(trie, &st);
+    if ( 0 != st.nodes || 0 != st.max_depth || 0.0 != st.avg_depth ) {
+        return -1;
+    }
+
+    /* The root is visited by all the lookups, and its child by a half */
+    if ( path_compressed_trie_add(trie, 0, 0, (void *)1) < 0
+         || path_compressed_trie_add(trie, 0x0a000000, 8, (void *)2) < 0 ) {
+        return -1;
+    }
+    path_compressed_trie_stats(trie, &st);
+    if ( 2 != st.nodes || 1 != st.internals || 1 != st.leaves
+         || 2 != st.max_depth || 1.5 != st.avg_depth
+         || 1 != st.prefixlen[0] || 1 != st.prefixlen[8] ) {
+        return -1;
+    }
+    path_compressed_trie_release(trie);
+
+    /* Full route */
+    entries = _read_linx(&n);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie || path_compressed_trie_build(trie, entries, n) < 0 ) {
+        return -1;
+    }
+    free(entries);
+    path_compressed_trie_stats(trie, &st);
+    path_compressed_trie_arena_stats(trie, &ast);
+    if ( st.nodes != ast.used || st.prefixes != n
+         || st.nodes != st.leaves + st.internals + st.branches
+         + st.empty_leaves ) {
+        return -1;
+    }
+    sum = 0;
+    for ( i = 0; i <= PATH_COMPRESSED_TRIE_MAX_DEPTH; i++ ) {
+        sum += st.depth[i];
+    }
+    if ( sum != st.nodes ) {
+        return -1;
+    }
+    sum = 0;
+    for ( i = 0; i <= 32; i++ ) {
+        sum += st.prefixlen[i];
+    }
+    if ( sum != st.prefixes ) {
+        return -1;
+    }
+
+    printf("\n  nodes %zu (leaves %zu, internal %zu, branching %zu, "
+           "empty %zu), prefixes %zu\n", st.nodes, st.leaves, st.internals,
+           st.branches, st.empty_leaves, st.prefixes);
+    printf("  bytes %zu, memory %zu, lookup depth %.3lf avg, %d max\n",
+           st.bytes, st.memory, st.avg_depth, st.max_depth);
+    printf("  depth:");
+    for ( i = 1; i <= st.max_depth; i++ ) {
+        printf(" %d:%zu", i, st.depth[i]);
+    }
+    printf("\n  prefixlen:");
+    for ( i = 0; i <= 32; i++ ) {
+        if ( st.prefixlen[i] ) {
+            printf(" /%d:%zu", i, st.prefixlen[i]);
+        }
+    }
+    printf("\n");
+    path_compressed_trie_release(trie);
+
+    return 0;
+}
+
+/*
+ * Interval map test
+ */
+static int
+test_interval(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_interval *im;
+    uint32_t keys[4];
+    uint32_t key;
+    uint32_t lo;
+    uint32_t hi;
+    size_t n;
+    int prefixlen;
+    int isa;
+    int i;
+    int j;
+
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+
+    /* No entry */
+    im = path_compressed_trie_interval_build(trie);
+    if ( NULL == im || 1 != im->nbounds
+         || NULL != path_compressed_trie_interval_lookup(im, 0)
+         || NULL != path_compressed_trie_interval_lookup(im, 0xffffffffU) ) {
+        return -1;
+    }
+    path_compressed_trie_interval_release(im);
+
+    /* Nested prefixes including the ones at the ends of the address space */
+    if ( path_compressed_trie_add(trie, 0, 0, (void *)1) < 0
+         || path_compressed_trie_add(trie, 0xffffffffU, 32, (void *)2) < 0
+         || path_compressed_trie_add(trie, 0, 32, (void *)3) < 0 ) {
+        return -1;
+    }
+    n = 3;
+    for ( i = 0; i < 4000; i++ ) {
+        prefixlen = 8 + xor128() % 25;
+        key = xor128() & (uint32_t)(0xffffffff00000000ULL >> prefixlen);
+        if ( 0 == path_compressed_trie_add(trie, key, prefixlen,
+                                           (void *)(uint64_t)(4 + i % 7)) ) {
+            n++;
+        }
+    }
+
+    /* Check the boundaries and their neighbours, and random keys, with all
+       the instruction sets supported by the CPU */
+    for ( isa = PATH_COMPRESSED_TRIE_SIMD_SCALAR;
+          isa <= PATH_COMPRESSED_TRIE_SIMD_AVX512; isa++ ) {
+        if ( path_compressed_trie_simd_set(isa) < 0 ) {
+            continue;
+        }
+        im = path_compressed_trie_interval_build(trie);
+        if ( NULL == im || im->isa != isa
+             || im->nbounds > 2 * n + 1 ) {
+            return -1;
+        }
+        for ( i = 0; i < (int)im->nbounds; i++ ) {
+            lo = (uint32_t)(im->keys[(size_t)im->off[0]
+                                     * PATH_COMPRESSED_TRIE_INTERVAL_KEYS + i]
+                            ^ 0x80000000U);
+            hi = i + 1 < (int)im->nbounds
+                ? (uint32_t)(im->keys[(size_t)im->off[0]
+                                      * PATH_COMPRESSED_TRIE_INTERVAL_KEYS
+                                      + i + 1] ^ 0x80000000U) - 1
+                : 0xffffffffU;
+            keys[0] = lo;
+            keys[1] = lo - 1;
+            keys[2] = hi;
+            keys[3] = xor128();
+            for ( j = 0; j < 4; j++ ) {
+                if ( path_compressed_trie_interval_lookup(im, keys[j])
+                     != path_compressed_trie_lookup(trie, keys[j]) ) {
+                    return -1;
+                }
+            }
+        }
+        path_compressed_trie_interval_release(im);
+    }
+    path_compressed_trie_simd_set(PATH_COMPRESSED_TRIE_SIMD_AUTO);
+
+    path_compressed_trie_release(trie);
+
+    return 0;
+}
+
+/*
+ * Poptrie test
+ */
+static int
+test_poptrie(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_poptrie *pt;
+    uint32_t keys[TEST_CHURN_PREFIXES];
+    int plens[TEST_CHURN_PREFIXES];
+    uint32_t key;
+    int added[TEST_CHURN_PREFIXES];
+    int round;
+    int i;
+
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+
+    /* No entry */
+    pt = path_compressed_trie_poptrie_build(trie);
+    if ( NULL == pt || 0 != pt->nnodes
+         || NULL != path_compressed_trie_poptrie_lookup(pt, 0)
+         || NULL != path_compressed_trie_poptrie_lookup(pt, 0xffffffffU) ) {
+        return -1;
+    }
+
+    /* Add and delete random prefixes, refreshing the Poptrie */
+    for ( i = 0; i < TEST_CHURN_PREFIXES; i++ ) {
+        plens[i] = xor128() % 33;
+        keys[i] = xor128() & (uint32_t)(0xffffffff00000000ULL >> plens[i]);
+        added[i] = 0;
+    }
+    for ( round = 0; round < 8; round++ ) {
+        for ( i = 0; i < TEST_CHURN_PREFIXES; i++ ) {
+            if ( xor128() & 1 ) {
+                continue;
+            }
+            if ( added[i] ) {
+                if ( NULL == path_compressed_trie_delete(trie, keys[i],
+                                                         plens[i]) ) {
+                    return -1;
+                }
+                added[i] = 0;
+            } else if ( 0 == path_compressed_trie_add(trie, keys[i], plens[i],
+                                                      (void *)(uint64_t)
+                                                      (1 + i % 13)) ) {
+                added[i] = 1;
+            } else {
+                /* Duplicate prefix */
+                continue;
+            }
+            if ( path_compressed_trie_poptrie_update(pt, keys[i],
+                                                     plens[i]) < 0 ) {
+                return -1;
+            }
+        }
+        for ( i = 0; i < 0x10000; i++ ) {
+            key = 0 == (i & 1) ? xor128()
+                : keys[xor128() % TEST_CHURN_PREFIXES] + (i & 2) - 1;
+            if ( path_compressed_trie_poptrie_lookup(pt, key)
+                 != path_compressed_trie_lookup(trie, key) ) {
+                return -1;
+            }
+        }
+        TEST_PROGRESS();
+    }
+
+    /* The blocks are all released with the prefixes */
+    for ( i = 0; i < TEST_CHURN_PREFIXES; i++ ) {
+        if ( added[i] ) {
+            (void)path_compressed_trie_delete(trie, keys[i], plens[i]);
+            if ( path_compressed_trie_poptrie_update(pt, keys[i],
+                                                     plens[i]) < 0 ) {
+                return -1;
+            }
+        }
+    }
+    if ( 0 != pt->nnodes || 0 != pt->nleaves ) {
+        return -1;
+    }
+
+    /* The data replaced are compacted out of the table */
+    if ( path_compressed_trie_add(trie, 0x0a000000, 8, (void *)1) < 0
+         || path_compressed_trie_poptrie_update(pt, 0x0a000000, 8) < 0 ) {
+        return -1;
+    }
+    for ( i = 0; i < 0x10000; i++ ) {
+        key = 0x0a000000 | ((uint32_t)(i & 0xff) << 12);
+        (void)path_compressed_trie_delete(trie, key, 20);
+        if ( path_compressed_trie_add(trie, key, 20,
+                                      (void *)(uint64_t)(2 + i)) < 0
+             || path_compressed_trie_poptrie_update(pt, key, 20) < 0 ) {
+            return -1;
+        }
+        if ( path_compressed_trie_poptrie_lookup(pt, key + (i & 0xfff))
+             != (void *)(uint64_t)(2 + i)
+             || path_compressed_trie_poptrie_lookup(pt, 0x0a100000 - 1)
+             != path_compressed_trie_lookup(trie, 0x0a100000 - 1) ) {
+            return -1;
+        }
+    }
+    if ( pt->nlive != 257 || pt->ndata > 1 + 257 * 2 ) {
+        return -1;
+    }
+
+    path_compressed_trie_poptrie_release(pt);
+    path_compressed_trie_release(trie);
+
+    return 0;
+}
+
+/*
+ * Churn test: the full route is announced and withdrawn repeatedly in random
+ * orders, and the trie must return to the same shape, node count and memory.
+ * The memory is the high-water mark of the arena, which the copies of the
+ * first transaction raise; it is the baseline from the second round.
+ */
+static int
+test_churn(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie *ref;
+    struct path_compressed_trie_txn *txn;
+    struct path_compressed_trie_prefix_entry *entries;
+    struct path_compressed_trie_prefix_entry e;
+    void *data;
+    size_t nodes;
+    size_t memory;
+    size_t n;
+    size_t i;
+    size_t j;
+    int round;
+
+    entries = _read_linx(&n);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    nodes = 0;
+    memory = 0;
+    for ( round = 0; round < TEST_FULL_CHURN_ROUNDS; round++ ) {
+        /* Announce in a random order */
+        for ( i = n - 1; i > 0; i-- ) {
+            j = xor128() % (i + 1);
+            e = entries[i];
+            entries[i] = entries[j];
+            entries[j] = e;
+        }
+        for ( i = 0; i < n; i++ ) {
+            if ( path_compressed_trie_add(trie, entries[i].key,
+                                          entries[i].prefixlen,
+                                          entries[i].data) < 0 ) {
+                return -1;
+            }
+        }
+        if ( 0 == round ) {
+            nodes = trie->arena.nused;
+        } else if ( trie->arena.nused != nodes
+                    || (round > 1
+                        && path_compressed_trie_memory(trie) != memory) ) {
+            return -1;
+        }
+
+        /* Withdraw a half, which leaves the same shape as the one built from
+           the other half */
+        ref = path_compressed_trie_init(NULL);
+        if ( NULL == ref ) {
+            return -1;
+        }
+        for ( i = 0; i < n; i++ ) {
+            if ( i & 1 ) {
+                data = path_compressed_trie_delete(trie, entries[i].key,
+                                                   entries[i].prefixlen);
+                if ( data != entries[i].data ) {
+                    return -1;
+                }
+            } else if ( path_compressed_trie_add(ref, entries[i].key,
+                                                 entries[i].prefixlen,
+                                                 entries[i].data) < 0 ) {
+                return -1;
+            }
+        }
+        if ( trie->arena.nused != ref->arena.nused
+             || !_trie_equal(trie, trie->root, ref, ref->root) ) {
+            return -1;
+        }
+        path_compressed_trie_release(ref);
+
+        /* Withdraw the rest, every other round in a transaction */
+        if ( round & 1 ) {
+            txn = path_compressed_trie_txn_begin(trie);
+            if ( NULL == txn ) {
+                return -1;
+            }
+            for ( i = 0; i < n; i += 2 ) {
+                if ( path_compressed_trie_txn_apply(txn, entries[i].key,
+                                                    entries[i].prefixlen,
+                                                    NULL) < 0 ) {
+                    return -1;
+                }
+            }
+            if ( path_compressed_trie_txn_commit(txn) < 0 ) {
+                return -1;
+            }
+        } else {
+            for ( i = 0; i < n; i += 2 ) {
+                data = path_compressed_trie_delete(trie, entries[i].key,
+                                                   entries[i].prefixlen);
+                if ( data != entries[i].data ) {
+                    return -1;
+                }
+            }
+        }
+        if ( 0 != trie->root || 0 != trie->arena.nused
+             || (round > 1 && path_compressed_trie_memory(trie) != memory) ) {
+            return -1;
+        }
+        if ( 1 == round ) {
+            memory = path_compressed_trie_memory(trie);
+        }
+        TEST_PROGRESS();
+    }
+    printf("%zu nodes, %zu bytes ", nodes, memory);
+
+    path_compressed_trie_release(trie);
+    free(entries);
+
+    return 0;
+}
+
+/*
+ * Equivalence checker of the lookups against the radix tree.  The keys are
+ * split across the threads, each checking its share in bursts.
+ */
+#define TEST_CHECK_THREADS_MAX  64
+
+struct _check {
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie *front;
+    struct path_compressed_trie_snapshot *snap;
+    struct path_compressed_trie_lc *lc;
+    struct path_compressed_trie_interval *im;
+    struct path_compressed_trie_poptrie *pt;
+    struct radix_tree *radix;
+    /* Keys to check, or all the addresses if NULL */
+    const uint32_t *keys;
+};
+
+struct _check_worker {
+    struct _check *c;
+    pthread_t th;
+    /* Share [start, end) of the keys (or addresses) */
+    uint64_t start;
+    uint64_t end;
+    /* Result and the first key giving a different result */
+    int ret;
+    uint32_t key;
+};
+
+static void *
+_check_worker(void *arg)
+{
+    struct _check_worker *w;
+    struct _check *c;
+    uint32_t keys[TEST_BURST_SIZE];
+    void *out0[TEST_BURST_SIZE];
+    void *out1[TEST_BURST_SIZE];
+    uint64_t i;
+    size_t n;
+    size_t j;
+    uint32_t a;
+    uint64_t res0;
+    uint64_t res1;
+
+    w = arg;
+    c = w->c;
+    w->ret = 0;
+    for ( i = w->start; i < w->end; i += n ) {
+        n = w->end - i < TEST_BURST_SIZE ? w->end - i : TEST_BURST_SIZE;
+        for ( j = 0; j < n; j++ ) {
+            keys[j] = NULL != c->keys ? c->keys[i + j] : (uint32_t)(i + j);
+        }
+        path_compressed_trie_lookup_batch(c->trie, keys, out0, n);
+        path_compressed_trie_lookup_simd(c->trie, keys, out1, n);
+        for ( j = 0; j < n; j++ ) {
+            a = keys[j];
+            res0 = (uint64_t)path_compressed_trie_lookup(c->trie, a);
+            res1 = (uint64_t)radix_tree_lookup(c->radix, a);
+            if ( res0 != res1
+                 || res0 != (uint64_t)_lookup_reference(c->trie,
+                                                        c->trie->root, 0, a)
+                 || res0 != (uint64_t)out0[j] || res0 != (uint64_t)out1[j]
+                 || res0 != (uint64_t)
+                 path_compressed_trie_snapshot_lookup(c->snap, a)
+                 || res0 != (uint64_t)path_compressed_trie_lc_lookup(c->lc, a)
+                 || res0 != (uint64_t)
+                 path_compressed_trie_interval_lookup(c->im, a)
+                 || res0 != (uint64_t)
+                 path_compressed_trie_poptrie_lookup(c->pt, a)
+                 || res0 != (uint64_t)path_compressed_trie_lookup(c->front,
+                                                                  a) ) {
+                w->ret = -1;
+                w->key = a;
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Check the n keys (or addresses) on all the online processors
+ */
+static int
+_check_run(struct _check *c, uint64_t n)
+{
+    struct _check_worker w[TEST_CHECK_THREADS_MAX];
+    long nth;
+    long i;
+    int ret;
+
+    nth = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( nth < 1 ) {
+        nth = 1;
+    } else if ( nth > TEST_CHECK_THREADS_MAX ) {
+        nth = TEST_CHECK_THREADS_MAX;
+    }
+    for ( i = 0; i < nth; i++ ) {
+        w[i].c = c;
+        w[i].start = n * i / nth;
+        w[i].end = n * (i + 1) / nth;
+        if ( 0 != pthread_create(&w[i].th, NULL, _check_worker, &w[i]) ) {
+            /* Check the share in this thread instead */
+            _check_worker(&w[i]);
+            w[i].th = pthread_self();
+        }
+    }
+    ret = 0;
+    for ( i = 0; i < nth; i++ ) {
+        if ( !pthread_equal(w[i].th, pthread_self()) ) {
+            pthread_join(w[i].th, NULL);
+        }
+        if ( w[i].ret < 0 ) {
+            printf("mismatch at %08x ", w[i].key);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Load the full route into the structures to be checked
+ */
+static int
+_check_init(struct _check *c)
+{
+    c->trie = path_compressed_trie_init(NULL);
+    c->radix = radix_tree_init(NULL);
+    c->front = path_compressed_trie_init_flags(NULL,
+                                               PATH_COMPRESSED_TRIE_FRONT_24);
+    if ( NULL == c->trie || NULL == c->radix || NULL == c->front ) {
+        return -1;
+    }
+    if ( _load_linx(c->trie, c->radix) < 0 ) {
+        return -1;
+    }
+    if ( _load_linx(c->front, NULL) < 0 ) {
+        return -1;
+    }
+    c->snap = path_compressed_trie_freeze(c->trie);
+    if ( NULL == c->snap ) {
+        return -1;
+    }
+    c->lc = path_compressed_trie_lc_build(c->trie, 0);
+    if ( NULL == c->lc ) {
+        return -1;
+    }
+    c->im = path_compressed_trie_interval_build(c->trie);
+    if ( NULL == c->im ) {
+        return -1;
+    }
+    c->pt = path_compressed_trie_poptrie_build(c->trie);
+    if ( NULL == c->pt ) {
+        return -1;
+    }
+    c->keys = NULL;
+
+    return 0;
+}
+
+static void
+_check_release(struct _check *c)
+{
+    path_compressed_trie_poptrie_release(c->pt);
+    path_compressed_trie_interval_release(c->im);
+    path_compressed_trie_lc_release(c->lc);
+    path_compressed_trie_snapshot_release(c->snap);
+    path_compressed_trie_release(c->front);
+    path_compressed_trie_release(c->trie);
+    radix_tree_release(c->radix);
+}
+
+/*
+ * Full route test on the boundaries of the prefixes.  The longest prefix
+ * match only changes at the first address of a prefix and at the address
+ * next to its last one, so the results of two structures of the same
+ * prefixes are equal everywhere if they are equal on these boundaries.  The
+ * addresses just before them are checked as well to catch off-by-one errors.
+ */
+static int
+test_lookup_linx(void)
+{
+    struct _check c;
+    struct path_compressed_trie_prefix_entry *entries;
+    uint32_t *keys;
+    size_t n;
+    size_t m;
+    int ret;
+
+    if ( _check_init(&c) < 0 ) {
+        return -1;
+    }
+    entries = _read_linx(&n);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    keys = _boundary_keys(entries, n, &m);
+    if ( NULL == keys ) {
+        return -1;
+    }
+
+    c.keys = keys;
+    ret = _check_run(&c, m);
+
+    free(keys);
+    free(entries);
+    _check_release(&c);
+
+    return ret;
+}
+
+/*
+ * Full route test on all the 2^32 addresses
+ */
+static int
+test_lookup_linx_exhaustive(void)
+{
+    struct _check c;
+    int ret;
+
+    if ( _check_init(&c) < 0 ) {
+        return -1;
+    }
+    ret = _check_run(&c, 0x100000000LL);
+    _check_release(&c);
+
+    return ret;
+}
+
+static int
+test_lookup_linx_performance(void)
+{
+    struct path_compressed_trie *trie;
+    FILE *fp;
+    char buf[4096];
+    int prefix[4];
+    int prefixlen;
+    int nexthop[4];
+    int ret;
+    uint32_t addr1;
+    uint64_t addr2;
+    ssize_t i;
+    uint64_t res;
+    double t0;
+    double t1;
+    double tref;
+    uint32_t a;
+    struct path_compressed_trie_arena_stats st;
+    struct path_compressed_trie_snapshot *snap;
+    struct path_compressed_trie_lc *lc;
+    struct path_compressed_trie_interval *im;
+    struct path_compressed_trie_poptrie *pt;
+    struct path_compressed_trie *front;
+    static const char *isa_names[] = { "auto", "scalar", "avx2", "avx512" };
+    static const int flags[] = { PATH_COMPRESSED_TRIE_FRONT_16,
+                                 PATH_COMPRESSED_TRIE_FRONT_24 };
+    struct path_compressed_trie_prefix_entry *entries;
+    size_t n;
+    size_t j;
+    size_t f;
+    double tpct;
+    int isa;
+
+    /* Load from the linx file */
+    fp = fopen("tests/linx-rib.20141217.0000-p46.txt", "r");
+    if ( NULL == fp ) {
+        return -1;
+    }
+
+    /* Initialize */
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+
+    /* Load the full route */
+    t0 = getmicrotime();
+    i = 0;
+    while ( !feof(fp) ) {
+        if ( !fgets(buf, sizeof(buf), fp) ) {
+            continue;
+        }
+        ret = sscanf(buf, "%d.%d.%d.%d/%d %d.%d.%d.%d", &prefix[0], &prefix[1],
+                     &prefix[2], &prefix[3], &prefixlen, &nexthop[0],
+                     &nexthop[1], &nexthop[2], &nexthop[3]);
+        if ( ret < 0 ) {
+            return -1;
+        }
+
+        /* Convert to u32 */
+        addr1 = ((uint32_t)prefix[0] << 24) + ((uint32_t)prefix[1] << 16)
+            + ((uint32_t)prefix[2] << 8) + (uint32_t)prefix[3];
+        addr2 = ((uint32_t)nexthop[0] << 24) + ((uint32_t)nexthop[1] << 16)
+            + ((uint32_t)nexthop[2] << 8) + (uint32_t)nexthop[3];
+
+        /* Add an entry */
+        ret = path_compressed_trie_add(trie, addr1, prefixlen,
+                                       (void *)(uint64_t)addr2);
+        if ( ret < 0 ) {
+            return -1;
+        }
+        if ( 0 == i % 10000 ) {
+            TEST_PROGRESS();
+        }
+        i++;
+    }
+    t1 = getmicrotime();
+
+    printf("Load: %lf sec (%zd prefixes)\n", t1 - t0, i);
+
+    /* Insertion loop against the bulk build from the parsed prefixes */
+    entries = _read_linx(&n);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    front = path_compressed_trie_init(NULL);
+    if ( NULL == front ) {
+        return -1;
+    }
+    t0 = getmicrotime();
+    for ( j = 0; j < n; j++ ) {
+        if ( path_compressed_trie_add(front, entries[j].key,
+                                      entries[j].prefixlen,
+                                      entries[j].data) < 0 ) {
+            return -1;
+        }
+    }
+    t1 = getmicrotime();
+    path_compressed_trie_release(front);
+    printf("Build[add]: %lf sec\n", t1 - t0);
+    front = path_compressed_trie_init(NULL);
+    if ( NULL == front ) {
+        return -1;
+    }
+    t0 = getmicrotime();
+    if ( path_compressed_trie_build(front, entries, n) < 0 ) {
+        return -1;
+    }
+    t1 = getmicrotime();
+    path_compressed_trie_release(front);
+    printf("Build[bulk]: %lf sec\n", t1 - t0);
+    free(entries);
+    path_compressed_trie_arena_stats(trie, &st);
+    printf("Arena: %zu slabs, %zu/%zu nodes used, %zu bytes\n", st.slabs,
+           st.used, st.capacity, st.bytes);
+
+    /* Reference (recursive) lookup */
+    t0 = getmicrotime();
+
+    res = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        a = xor128();
+        res ^= (uint64_t)_lookup_reference(trie, trie->root, 0, a);
+    }
+    t1 = getmicrotime();
+    tref = t1 - t0;
+
+    printf("RESULT(reference): %llx\n", (unsigned long long)res);
+
+    printf("Result[ref,0]: %lf ns/lookup\n", tref/i * 1000000000);
+    printf("Result[ref,1]: %lf Mlps\n", 1.0 * i / tref / 1000000);
+
+    t0 = getmicrotime();
+
+    res = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        a = xor128();
+        res ^= (uint64_t)path_compressed_trie_lookup(trie, a);
+    }
+    t1 = getmicrotime();
+
+    printf("RESULT: %llx\n", res);
+
+    printf("Result[0]: %lf ns/lookup\n", (t1 - t0)/i * 1000000000);
+    printf("Result[1]: %lf Mlps\n", 1.0 * i / (t1 - t0) / 1000000);
+    printf("Result[2]: %lf x speedup over the reference\n", tref / (t1 - t0));
+    tpct = t1 - t0;
+
+    /* Snapshot lookup */
+    t0 = getmicrotime();
+    snap = path_compressed_trie_freeze(trie);
+    if ( NULL == snap ) {
+        return -1;
+    }
+    t1 = getmicrotime();
+    printf("Snapshot: %lf sec to freeze, %u nodes, %zu bytes\n", t1 - t0,
+           snap->nnodes, snap->size);
+
+    t0 = getmicrotime();
+
+    res = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        a = xor128();
+        res ^= (uint64_t)path_compressed_trie_snapshot_lookup(snap, a);
+    }
+    t1 = getmicrotime();
+
+    printf("RESULT(snapshot): %llx\n", (unsigned long long)res);
+
+    printf("Result[snapshot,0]: %lf ns/lookup\n", (t1 - t0)/i * 1000000000);
+    printf("Result[snapshot,1]: %lf Mlps\n", 1.0 * i / (t1 - t0) / 1000000);
+    printf("Result[snapshot,2]: %lf x speedup over the reference\n",
+           tref / (t1 - t0));
+
+    path_compressed_trie_snapshot_release(snap);
+
+    /* Level-compressed trie lookup */
+    t0 = getmicrotime();
+    lc = path_compressed_trie_lc_build(trie, 0);
+    if ( NULL == lc ) {
+        return -1;
+    }
+    t1 = getmicrotime();
+    printf("LC-trie: %lf sec to build, %zu nodes, %zu entries, %zu skips, "
+           "%zu bytes\n", t1 - t0, lc->nnodes, lc->nentries, lc->nskips,
+           lc->size);
+
+    t0 = getmicrotime();
+
+    res = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        a = xor128();
+        res ^= (uint64_t)path_compressed_trie_lc_lookup(lc, a);
+    }
+    t1 = getmicrotime();
+
+    printf("RESULT(lc): %llx\n", (unsigned long long)res);
+
+    printf("Result[lc,0]: %lf ns/lookup\n", (t1 - t0)/i * 1000000000);
+    printf("Result[lc,1]: %lf Mlps\n", 1.0 * i / (t1 - t0) / 1000000);
+    printf("Result[lc,2]: %lf x speedup over path_compressed_trie_lookup\n",
+           tpct / (t1 - t0));
+
+    path_compressed_trie_lc_release(lc);
+
+    /* Interval map lookup with all the instruction sets supported by the
+       CPU */
+    for ( isa = PATH_COMPRESSED_TRIE_SIMD_SCALAR;
+          isa <= PATH_COMPRESSED_TRIE_SIMD_AVX512; isa++ ) {
+        if ( path_compressed_trie_simd_set(isa) < 0 ) {
+            continue;
+        }
+        t0 = getmicrotime();
+        im = path_compressed_trie_interval_build(trie);
+        if ( NULL == im ) {
+            return -1;
+        }
+        t1 = getmicrotime();
+        printf("Interval[%s]: %lf sec to build, %zu boundaries, %d levels, "
+               "%zu bytes\n", isa_names[isa], t1 - t0, im->nbounds,
+               im->nlevels, im->size);
+
+        t0 = getmicrotime();
+
+        res = 0;
+        for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+            if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+                TEST_PROGRESS();
+            }
+            a = xor128();
+            res ^= (uint64_t)path_compressed_trie_interval_lookup(im, a);
+        }
+        t1 = getmicrotime();
+
+        printf("RESULT(interval-%s): %llx\n", isa_names[isa],
+               (unsigned long long)res);
+
+        printf("Result[interval-%s,0]: %lf ns/lookup\n", isa_names[isa],
+               (t1 - t0)/i * 1000000000);
+        printf("Result[interval-%s,1]: %lf Mlps\n", isa_names[isa],
+               1.0 * i / (t1 - t0) / 1000000);
+        printf("Result[interval-%s,2]: %lf x speedup over "
+               "path_compressed_trie_lookup\n", isa_names[isa],
+               tpct / (t1 - t0));
+
+        path_compressed_trie_interval_release(im);
+    }
+    path_compressed_trie_simd_set(PATH_COMPRESSED_TRIE_SIMD_AUTO);
+
+    /* Poptrie lookup */
+    t0 = getmicrotime();
+    pt = path_compressed_trie_poptrie_build(trie);
+    if ( NULL == pt ) {
+        return -1;
+    }
+    t1 = getmicrotime();
+    printf("Poptrie: %lf sec to build, %zu nodes, %zu leaves, %zu bytes\n",
+           t1 - t0, pt->nnodes, pt->nleaves,
+           path_compressed_trie_poptrie_memory(pt));
+
+    t0 = getmicrotime();
+
+    res = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        a = xor128();
+        res ^= (uint64_t)path_compressed_trie_poptrie_lookup(pt, a);
+    }
+    t1 = getmicrotime();
+
+    printf("RESULT(poptrie): %llx\n", (unsigned long long)res);
+
+    printf("Result[poptrie,0]: %lf ns/lookup\n", (t1 - t0)/i * 1000000000);
+    printf("Result[poptrie,1]: %lf Mlps\n", 1.0 * i / (t1 - t0) / 1000000);
+    printf("Result[poptrie,2]: %lf x speedup over "
+           "path_compressed_trie_lookup\n", tpct / (t1 - t0));
+
+    path_compressed_trie_poptrie_release(pt);
+
+    /* Front table lookup */
+    printf("Memory: %zu bytes\n", path_compressed_trie_memory(trie));
+    for ( f = 0; f < sizeof(flags) / sizeof(flags[0]); f++ ) {
+        front = path_compressed_trie_init_flags(NULL, flags[f]);
+        if ( NULL == front ) {
+            return -1;
+        }
+        if ( _load_linx(front, NULL) < 0 ) {
+            return -1;
+        }
+        printf("Front-%d: %zu bytes\n", front->front_bits,
+               path_compressed_trie_memory(front));
+
+        t0 = getmicrotime();
+
+        res = 0;
+        for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+            if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+                TEST_PROGRESS();
+            }
+            a = xor128();
+            res ^= (uint64_t)path_compressed_trie_lookup(front, a);
+        }
+        t1 = getmicrotime();
+
+        printf("RESULT(front-%d): %llx\n", front->front_bits,
+               (unsigned long long)res);
+
+        printf("Result[front-%d,0]: %lf ns/lookup\n", front->front_bits,
+               (t1 - t0)/i * 1000000000);
+        printf("Result[front-%d,1]: %lf Mlps\n", front->front_bits,
+               1.0 * i / (t1 - t0) / 1000000);
+        printf("Result[front-%d,2]: %lf x speedup over "
+               "path_compressed_trie_lookup\n", front->front_bits,
+               tpct / (t1 - t0));
+
+        path_compressed_trie_release(front);
+    }
+
+    /* Release */
+    path_compressed_trie_release(trie);
+
+    /* Close */
+    fclose(fp);
+
+    return 0;
+}
+
+/*
+ * IPv6 lookup performance test with a RIB of 200k prefixes
+ */
+static int
+test_ipv6_performance(void)
+{
+    struct path_compressed_trie6 *trie;
+    struct test_prefix6 *p;
+    uint64_t (*keys)[2];
+    uint64_t res;
+    ssize_t i;
+    double t0;
+    double t1;
+
+    p = malloc(sizeof(struct test_prefix6) * 200000);
+    keys = malloc(sizeof(*keys) * TEST_KEY_BUFFER_SIZE);
+    if ( NULL == p || NULL == keys ) {
+        return -1;
+    }
+    _gen_rib6(p, 200000);
+    trie = path_compressed_trie6_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    t0 = getmicrotime();
+    for ( i = 0; i < 200000; i++ ) {
+        (void)path_compressed_trie6_add(trie, p[i].key, p[i].prefixlen,
+                                        (void *)(uint64_t)(i + 1));
+    }
+    t1 = getmicrotime();
+    printf("IPv6: %lf sec to load %zu prefixes, %zu nodes, %zu bytes\n",
+           t1 - t0, trie->nprefixes, trie->nused,
+           path_compressed_trie6_memory(trie));
+
+    /* Keys under the prefixes */
+    for ( i = 0; i < TEST_KEY_BUFFER_SIZE; i++ ) {
+        _key_under6(&p[xor64() % 200000], keys[i]);
+    }
+
+    t0 = getmicrotime();
 
     res = 0;
-    for ( i = 0; i < 0x100000000LL; i++ ) {
-        if ( 0 == i % 0x10000000ULL ) {
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
             TEST_PROGRESS();
         }
-        a = xor128();
-        res ^= (uint64_t)path_compressed_trie_lookup(trie, a);
+        res += (uint64_t)path_compressed_trie6_lookup(
+            trie, keys[i & (TEST_KEY_BUFFER_SIZE - 1)]);
     }
     t1 = getmicrotime();
 
-    printf("RESULT: %llx\n", res);
+    printf("RESULT(ipv6): %llx\n", (unsigned long long)res);
 
-    printf("Result[0]: %lf ns/lookup\n", (t1 - t0)/i * 1000000000);
-    printf("Result[1]: %lf Mlps\n", 1.0 * i / (t1 - t0) / 1000000);
+    printf("Result[ipv6,0]: %lf ns/lookup\n", (t1 - t0)/i * 1000000000);
+    printf("Result[ipv6,1]: %lf Mlps\n", 1.0 * i / (t1 - t0) / 1000000);
 
-    /* Release */
-    path_compressed_trie_release(trie);
+    path_compressed_trie6_release(trie);
+    free(keys);
+    free(p);
 
-    /* Close */
+    return 0;
+}
+
+/*
+ * RIB loader performance test with the linx RIB and a 5M-line RIB
+ */
+static int
+test_rib_performance(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_prefix_entry *entries;
+    static const char *files[] = { "tests/linx-rib.20141217.0000-p46.txt",
+                                   "tests/rib-5m.tmp" };
+    FILE *fp;
+    size_t n;
+    size_t i;
+    uint32_t k;
+    double t0;
+    double t1;
+
+    /* Generate 5M prefixes of /24 and /32 */
+    fp = fopen(files[1], "w");
+    if ( NULL == fp ) {
+        return -1;
+    }
+    for ( i = 0; i < 5000000; i++ ) {
+        k = (uint32_t)(i << 8) | (i & 1);
+        fprintf(fp, "%u.%u.%u.%u/%d %u.%u.%u.%u\n", k >> 24, (k >> 16) & 0xff,
+                (k >> 8) & 0xff, k & 0xff, (i & 1) ? 32 : 24, 192, 0, 2,
+                (unsigned)(i & 0xff));
+    }
     fclose(fp);
 
+    for ( i = 0; i < sizeof(files) / sizeof(files[0]); i++ ) {
+        TEST_PROGRESS();
+
+        /* fgets() and sscanf() with the insertions one by one */
+        trie = path_compressed_trie_init(NULL);
+        if ( NULL == trie ) {
+            return -1;
+        }
+        t0 = getmicrotime();
+        entries = _read_rib(files[i], &n);
+        if ( NULL == entries ) {
+            return -1;
+        }
+        for ( k = 0; k < n; k++ ) {
+            if ( path_compressed_trie_add(trie, entries[k].key,
+                                          entries[k].prefixlen,
+                                          entries[k].data) < 0 ) {
+                return -1;
+            }
+        }
+        t1 = getmicrotime();
+        free(entries);
+        path_compressed_trie_release(trie);
+        printf("RIB[%zu lines,sscanf+add]: %lf sec\n", n, t1 - t0);
+
+        /* Parser with a thread and the threads of the processors */
+        t0 = getmicrotime();
+        entries = path_compressed_trie_rib_parse(files[i], &n, 1);
+        if ( NULL == entries ) {
+            return -1;
+        }
+        t1 = getmicrotime();
+        free(entries);
+        printf("RIB[%zu lines,parse,1]: %lf sec\n", n, t1 - t0);
+        t0 = getmicrotime();
+        entries = path_compressed_trie_rib_parse(files[i], &n, 0);
+        if ( NULL == entries ) {
+            return -1;
+        }
+        t1 = getmicrotime();
+        free(entries);
+        printf("RIB[%zu lines,parse,auto]: %lf sec\n", n, t1 - t0);
+
+        /* Parser and the bulk build */
+        trie = path_compressed_trie_init(NULL);
+        if ( NULL == trie ) {
+            return -1;
+        }
+        t0 = getmicrotime();
+        if ( (ssize_t)n != path_compressed_trie_rib_load(trie, files[i], 0) ) {
+            return -1;
+        }
+        t1 = getmicrotime();
+        path_compressed_trie_release(trie);
+        printf("RIB[%zu lines,load]: %lf sec\n", n, t1 - t0);
+    }
+    unlink(files[1]);
+
+    return 0;
+}
+
+/*
+ * Batched lookup performance test: the keys are looked up in bursts as in a
+ * packet processing path
+ */
+static int
+test_lookup_linx_batch_performance(void)
+{
+    struct path_compressed_trie *trie;
+    uint32_t *keys;
+    void *out[TEST_BURST_SIZE];
+    ssize_t i;
+    ssize_t j;
+    uint64_t res;
+    double t0;
+    double t1;
+    double tscalar;
+    int isa;
+
+    /* Initialize */
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+    if ( _load_linx(trie, NULL) < 0 ) {
+        return -1;
+    }
+
+    /* Prepare the keys */
+    keys = malloc(sizeof(uint32_t) * TEST_KEY_BUFFER_SIZE);
+    if ( NULL == keys ) {
+        return -1;
+    }
+    for ( i = 0; i < TEST_KEY_BUFFER_SIZE; i++ ) {
+        keys[i] = xor128();
+    }
+
+    /* Check the results of the batched lookup */
+    for ( i = 0; i < TEST_KEY_BUFFER_SIZE; i += TEST_BURST_SIZE ) {
+        path_compressed_trie_lookup_batch(trie, keys + i, out,
+                                          TEST_BURST_SIZE);
+        for ( j = 0; j < TEST_BURST_SIZE; j++ ) {
+            if ( out[j] != path_compressed_trie_lookup(trie, keys[i + j]) ) {
+                return -1;
+            }
+        }
+    }
+
+    /* Check the results of the vectorized lookup with all the instruction
+       sets supported by the CPU */
+    for ( isa = PATH_COMPRESSED_TRIE_SIMD_SCALAR;
+          isa <= PATH_COMPRESSED_TRIE_SIMD_AVX512; isa++ ) {
+        if ( path_compressed_trie_simd_set(isa) < 0 ) {
+            continue;
+        }
+        for ( i = 0; i < TEST_KEY_BUFFER_SIZE; i += TEST_BURST_SIZE ) {
+            /* Odd size to test the remainder */
+            path_compressed_trie_lookup_simd(trie, keys + i, out,
+                                             TEST_BURST_SIZE - 1);
+            for ( j = 0; j < TEST_BURST_SIZE - 1; j++ ) {
+                if ( out[j]
+                     != path_compressed_trie_lookup(trie, keys[i + j]) ) {
+                    return -1;
+                }
+            }
+        }
+    }
+    path_compressed_trie_simd_set(PATH_COMPRESSED_TRIE_SIMD_AUTO);
+
+    /* Scalar lookup */
+    t0 = getmicrotime();
+    res = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i += TEST_BURST_SIZE ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        for ( j = 0; j < TEST_BURST_SIZE; j++ ) {
+            out[j] = path_compressed_trie_lookup(
+                trie, keys[(i + j) & (TEST_KEY_BUFFER_SIZE - 1)]);
+        }
+        for ( j = 0; j < TEST_BURST_SIZE; j++ ) {
+            res += (uint64_t)out[j];
+        }
+    }
+    t1 = getmicrotime();
+    tscalar = t1 - t0;
+
+    printf("RESULT(scalar): %llx\n", (unsigned long long)res);
+    printf("Result[scalar,0]: %lf ns/lookup\n", tscalar / i * 1000000000);
+
+    /* Batched lookup */
+    t0 = getmicrotime();
+    res = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i += TEST_BURST_SIZE ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        path_compressed_trie_lookup_batch(
+            trie, keys + (i & (TEST_KEY_BUFFER_SIZE - 1)), out,
+            TEST_BURST_SIZE);
+        for ( j = 0; j < TEST_BURST_SIZE; j++ ) {
+            res += (uint64_t)out[j];
+        }
+    }
+    t1 = getmicrotime();
+
+    printf("RESULT(batch): %llx\n", (unsigned long long)res);
+    printf("Result[batch,0]: %lf ns/lookup\n", (t1 - t0) / i * 1000000000);
+    printf("Result[batch,1]: %lf Mlps\n", 1.0 * i / (t1 - t0) / 1000000);
+    printf("Result[batch,2]: %lf x speedup over the scalar loop\n",
+           tscalar / (t1 - t0));
+
+    /* Vectorized lookup */
+    t0 = getmicrotime();
+    res = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i += TEST_BURST_SIZE ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        path_compressed_trie_lookup_simd(
+            trie, keys + (i & (TEST_KEY_BUFFER_SIZE - 1)), out,
+            TEST_BURST_SIZE);
+        for ( j = 0; j < TEST_BURST_SIZE; j++ ) {
+            res += (uint64_t)out[j];
+        }
+    }
+    t1 = getmicrotime();
+
+    printf("RESULT(simd): %llx\n", (unsigned long long)res);
+    printf("Result[simd,0]: %lf ns/lookup (isa=%d)\n",
+           (t1 - t0) / i * 1000000000, path_compressed_trie_simd_get());
+    printf("Result[simd,1]: %lf Mlps\n", 1.0 * i / (t1 - t0) / 1000000);
+    printf("Result[simd,2]: %lf x speedup over the scalar loop\n",
+           tscalar / (t1 - t0));
+
+    /* Release */
+    free(keys);
+    path_compressed_trie_release(trie);
+
     return 0;
 }
 
 /*
  * Main routine for the basic test
  */
+/*
+ * Throughput of the bursts of the updates applied one by one and in the
+ * transactions
+ */
+static int
+test_txn_performance(void)
+{
+    struct path_compressed_trie *trie[4];
+    struct path_compressed_trie_txn *txn;
+    struct path_compressed_trie_prefix_entry *entries;
+    struct path_compressed_trie_prefix_entry *e;
+    size_t *burst;
+    size_t n;
+    size_t i;
+    size_t nb;
+    uint32_t k;
+    int mode;
+    int round;
+    double t0;
+    double t1;
+    static const char *names[] = { "random,per-call", "random,txn",
+                                   "adjacent,per-call", "adjacent,txn" };
+
+    entries = _read_linx(&n);
+    if ( NULL == entries || 0 == n ) {
+        return -1;
+    }
+    nb = 10000;
+    burst = malloc(sizeof(size_t) * nb * 32);
+    if ( NULL == burst ) {
+        return -1;
+    }
+    for ( mode = 0; mode < 4; mode++ ) {
+        if ( 0 == (mode & 1) ) {
+            /* Random prefixes, or runs of the adjacent prefixes in the RIB */
+            for ( i = 0; i < nb * 32; i++ ) {
+                if ( (mode & 2) && 0 != i % nb ) {
+                    burst[i] = (burst[i - 1] + 1) % n;
+                } else {
+                    burst[i] = xor128() % n;
+                }
+            }
+        }
+        trie[mode] = path_compressed_trie_init(NULL);
+        if ( NULL == trie[mode]
+             || path_compressed_trie_build(trie[mode], entries, n) < 0 ) {
+            return -1;
+        }
+        TEST_PROGRESS();
+
+        /* Withdraw and then announce back the bursts of random prefixes */
+        t0 = getmicrotime();
+        for ( round = 0; round < 64; round++ ) {
+            txn = NULL;
+            if ( mode & 1 ) {
+                txn = path_compressed_trie_txn_begin(trie[mode]);
+                if ( NULL == txn ) {
+                    return -1;
+                }
+            }
+            for ( i = 0; i < nb; i++ ) {
+                e = &entries[burst[(round >> 1) * nb + i]];
+                if ( mode & 1 ) {
+                    (void)path_compressed_trie_txn_apply(txn, e->key,
+                                                         e->prefixlen,
+                                                         (round & 1)
+                                                         ? e->data : NULL);
+                } else if ( round & 1 ) {
+                    (void)path_compressed_trie_add(trie[mode], e->key,
+                                                   e->prefixlen, e->data);
+                } else {
+                    (void)path_compressed_trie_delete(trie[mode], e->key,
+                                                      e->prefixlen);
+                }
+            }
+            if ( (mode & 1) && path_compressed_trie_txn_commit(txn) < 0 ) {
+                return -1;
+            }
+        }
+        t1 = getmicrotime();
+        printf("Result[%s]: %lf Mups (bursts of %zu)\n", names[mode],
+               64.0 * nb / (t1 - t0) / 1000000, nb);
+    }
+
+    /* All are back to the RIB */
+    for ( i = 0; i < 0x100000; i++ ) {
+        k = xor128();
+        for ( mode = 1; mode < 4; mode++ ) {
+            if ( path_compressed_trie_lookup(trie[0], k)
+                 != path_compressed_trie_lookup(trie[mode], k) ) {
+                return -1;
+            }
+        }
+    }
+    for ( mode = 0; mode < 4; mode++ ) {
+        path_compressed_trie_release(trie[mode]);
+    }
+    free(burst);
+    free(entries);
+
+    return 0;
+}
+
+/*
+ * Lookup cache performance with the destinations in the Zipf distribution
+ */
+static int
+test_cache_performance(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_cache *cache;
+    struct path_compressed_trie_prefix_entry *entries;
+    uint32_t *dests;
+    uint32_t *keys;
+    double *cdf;
+    double u;
+    size_t ndests;
+    size_t n;
+    size_t lo;
+    size_t hi;
+    size_t mid;
+    ssize_t i;
+    uint64_t res;
+    uint64_t ref;
+    double t0;
+    double t1;
+    int c;
+    static const size_t sizes[] = { 1024, 16384, 262144 };
+
+    entries = _read_linx(&n);
+    if ( NULL == entries ) {
+        return -1;
+    }
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie || path_compressed_trie_build(trie, entries, n) < 0 ) {
+        return -1;
+    }
+    free(entries);
+
+    /* Ranks of 1M destinations in the Zipf distribution of the exponent 1 */
+    ndests = 1 << 20;
+    dests = malloc(sizeof(uint32_t) * ndests);
+    cdf = malloc(sizeof(double) * ndests);
+    keys = malloc(sizeof(uint32_t) * TEST_KEY_BUFFER_SIZE);
+    if ( NULL == dests || NULL == cdf || NULL == keys ) {
+        return -1;
+    }
+    u = 0;
+    for ( i = 0; i < (ssize_t)ndests; i++ ) {
+        dests[i] = xor128();
+        u += 1.0 / (i + 1);
+        cdf[i] = u;
+    }
+    for ( i = 0; i < TEST_KEY_BUFFER_SIZE; i++ ) {
+        u = (double)xor128() / 4294967296.0 * cdf[ndests - 1];
+        lo = 0;
+        hi = ndests - 1;
+        while ( lo < hi ) {
+            mid = (lo + hi) / 2;
+            if ( cdf[mid] < u ) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        keys[i] = dests[lo];
+    }
+    free(cdf);
+    free(dests);
+
+    /* Without the cache */
+    t0 = getmicrotime();
+    ref = 0;
+    for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+        if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+            TEST_PROGRESS();
+        }
+        ref += (uint64_t)path_compressed_trie_lookup(
+            trie, keys[i & (TEST_KEY_BUFFER_SIZE - 1)]);
+    }
+    t1 = getmicrotime();
+    printf("Result[zipf]: %lf ns/lookup\n", (t1 - t0) / i * 1000000000);
+
+    for ( c = 0; c < (int)(sizeof(sizes) / sizeof(sizes[0])); c++ ) {
+        cache = path_compressed_trie_cache_init(trie, sizes[c]);
+        if ( NULL == cache ) {
+            return -1;
+        }
+        t0 = getmicrotime();
+        res = 0;
+        for ( i = 0; i < TEST_PERF_LOOKUPS; i++ ) {
+            if ( 0 == i % (TEST_PERF_LOOKUPS / 16) ) {
+                TEST_PROGRESS();
+            }
+            res += (uint64_t)path_compressed_trie_cache_lookup(
+                cache, keys[i & (TEST_KEY_BUFFER_SIZE - 1)]);
+        }
+        t1 = getmicrotime();
+        if ( res != ref ) {
+            return -1;
+        }
+        printf("Result[zipf,cache %zu]: %lf ns/lookup, %.2lf%% hits\n",
+               sizes[c], (t1 - t0) / i * 1000000000,
+               100.0 * cache->hits / (cache->hits + cache->misses));
+        path_compressed_trie_cache_release(cache);
+    }
+
+    free(keys);
+    path_compressed_trie_release(trie);
+
+    return 0;
+}
+
+/*
+ * Monotonic time in nanoseconds
+ */
+static __inline__ uint64_t
+_nanotime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+_u64_cmp(const void *a, const void *b)
+{
+    uint64_t x;
+    uint64_t y;
+
+    x = *(const uint64_t *)a;
+    y = *(const uint64_t *)b;
+
+    return x < y ? -1 : (x > y);
+}
+
+/*
+ * Sort the latencies and print the percentiles
+ */
+static void
+_print_percentiles(const char *label, uint64_t *lat, size_t n)
+{
+    qsort(lat, n, sizeof(uint64_t), _u64_cmp);
+    printf("%s[%zu]: p50 %llu ns, p90 %llu ns, p99 %llu ns, p99.9 %llu ns, "
+           "max %llu ns\n", label, n,
+           (unsigned long long)lat[n / 2],
+           (unsigned long long)lat[n * 90 / 100],
+           (unsigned long long)lat[n * 99 / 100],
+           (unsigned long long)lat[n * 999 / 1000],
+           (unsigned long long)lat[n - 1]);
+}
+
+/*
+ * Latency of the updates inserting and withdrawing the full route
+ */
+static int
+test_update_performance(void)
+{
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_prefix_entry *entries;
+    struct path_compressed_trie_prefix_entry e;
+    struct path_compressed_trie_arena_stats st;
+    uint64_t *lat;
+    uint64_t t0;
+    void *data;
+    size_t n;
+    size_t i;
+    size_t j;
+
+    entries = _read_linx(&n);
+    if ( NULL == entries || 0 == n ) {
+        return -1;
+    }
+    lat = malloc(sizeof(uint64_t) * n);
+    if ( NULL == lat ) {
+        return -1;
+    }
+    trie = path_compressed_trie_init(NULL);
+    if ( NULL == trie ) {
+        return -1;
+    }
+
+    /* Insert in the order of the RIB */
+    for ( i = 0; i < n; i++ ) {
+        t0 = _nanotime();
+        if ( path_compressed_trie_add(trie, entries[i].key,
+                                      entries[i].prefixlen,
+                                      entries[i].data) < 0 ) {
+            return -1;
+        }
+        lat[i] = _nanotime() - t0;
+    }
+    _print_percentiles("add", lat, n);
+
+    TEST_PROGRESS();
+
+    /* Withdraw in a random order */
+    for ( i = n - 1; i > 0; i-- ) {
+        j = xor128() % (i + 1);
+        e = entries[i];
+        entries[i] = entries[j];
+        entries[j] = e;
+    }
+    for ( i = 0; i < n; i++ ) {
+        t0 = _nanotime();
+        data = path_compressed_trie_delete(trie, entries[i].key,
+                                           entries[i].prefixlen);
+        lat[i] = _nanotime() - t0;
+        if ( data != entries[i].data ) {
+            return -1;
+        }
+    }
+    _print_percentiles("delete", lat, n);
+
+    /* All the nodes are released */
+    path_compressed_trie_synchronize(trie);
+    path_compressed_trie_arena_stats(trie, &st);
+    if ( 0 != st.used ) {
+        return -1;
+    }
+
+    path_compressed_trie_release(trie);
+    free(lat);
+    free(entries);
+
+    return 0;
+}
+
 int
 main(int argc, const char *const argv[])
 {
+    int exhaustive;
+    int performance;
     int ret;
+    int i;
 
     /* Reset */
     ret = 0;
 
+    /* -x also checks the lookups on all the addresses, and -p runs the
+       performance tests */
+    exhaustive = 0;
+    performance = 0;
+    for ( i = 1; i < argc; i++ ) {
+        if ( 0 == strcmp(argv[i], "-x") ) {
+            exhaustive = 1;
+        } else if ( 0 == strcmp(argv[i], "-p") ) {
+            performance = 1;
+        }
+    }
+
     /* Run tests */
     TEST_FUNC("init", test_init, ret);
     TEST_FUNC("lookup", test_lookup, ret);
+    TEST_FUNC("arena", test_arena, ret);
+    TEST_FUNC("snapshot", test_snapshot, ret);
+    TEST_FUNC("front", test_front, ret);
+    TEST_FUNC("build", test_build, ret);
+    TEST_FUNC("rib", test_rib, ret);
+    TEST_FUNC("image", test_image, ret);
+    TEST_FUNC("ipv6", test_ipv6, ret);
+    TEST_FUNC("vrf", test_vrf, ret);
+    TEST_FUNC("txn", test_txn, ret);
+    TEST_FUNC("cache", test_cache, ret);
+    TEST_FUNC("stats", test_stats, ret);
+    TEST_FUNC("interval", test_interval, ret);
+    TEST_FUNC("poptrie", test_poptrie, ret);
+    TEST_FUNC("churn", test_churn, ret);
+    TEST_FUNC("concurrent", test_concurrent, ret);
+    TEST_FUNC("concurrent_writers", test_concurrent_writers, ret);
     TEST_FUNC("lookup_fullroute", test_lookup_linx, ret);
-    TEST_FUNC("performance", test_lookup_linx_performance, ret);
+    if ( exhaustive ) {
+        TEST_FUNC("lookup_fullroute_exhaustive", test_lookup_linx_exhaustive,
+                  ret);
+    }
+    if ( performance ) {
+        TEST_FUNC("performance", test_lookup_linx_performance, ret);
+        TEST_FUNC("performance_batch", test_lookup_linx_batch_performance,
+                  ret);
+        TEST_FUNC("performance_rib", test_rib_performance, ret);
+        TEST_FUNC("performance_ipv6", test_ipv6_performance, ret);
+        TEST_FUNC("performance_update", test_update_performance, ret);
+        TEST_FUNC("performance_txn", test_txn_performance, ret);
+        TEST_FUNC("performance_cache", test_cache_performance, ret);
+    }
 
     return 0;
 }
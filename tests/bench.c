@@ -0,0 +1,1074 @@
+/*_
+ * Copyright (c) 2018 Hirochika Asai <asai@jar.jp>
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Benchmark of the lookups with the workload generators:
+ *   path_compressed_trie_bench [-e engine] [-r rib] [-w workload] [-t trace]
+ *                              [-z exponent] [-u percent] [-n lookups]
+ *                              [-p threads] [-s interval] [-o csv|json] [-H]
+ * The hardware counters of the threads are collected through perf_event_open
+ * over the run (including the timed samples), and the cycles fall back to the
+ * time-stamp counter where the counters are not available.
+ */
+
+#define _GNU_SOURCE
+#include "../pctrie.h"
+#include "radix.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+/* Number of the keys generated by a thread before the run */
+#define BENCH_KEYS          (1 << 20)
+
+/* Default interval of the lookups between the latency samples */
+#define BENCH_SAMPLE        64
+
+/* Number of the entries of the lookup cache of a thread */
+#define BENCH_CACHE_ENTRIES 16384
+
+/*
+ * Lookup engines
+ */
+enum bench_engine {
+    BENCH_PCTRIE,
+    BENCH_FRONT16,
+    BENCH_FRONT24,
+    BENCH_CACHE,
+    BENCH_SNAPSHOT,
+    BENCH_LC,
+    BENCH_INTERVAL,
+    BENCH_POPTRIE,
+    BENCH_RADIX,
+};
+
+static const char *bench_engines[] = {
+    "pctrie", "front16", "front24", "cache", "snapshot", "lc", "interval",
+    "poptrie", "radix", NULL
+};
+
+/*
+ * Hardware counters
+ */
+enum bench_counter {
+    BENCH_CYCLES,
+    BENCH_INSTRUCTIONS,
+    BENCH_L1D_MISSES,
+    BENCH_LLC_MISSES,
+    BENCH_DTLB_MISSES,
+    BENCH_BRANCH_MISSES,
+    BENCH_NCOUNTERS,
+};
+
+static const char *bench_counters[] = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "dtlb_misses",
+    "branch_misses"
+};
+
+/*
+ * Counters of a thread; the values are negative if not available
+ */
+struct bench_counters {
+    int fd[BENCH_NCOUNTERS];
+    double value[BENCH_NCOUNTERS];
+    uint64_t tsc;
+    /* Non-zero if the cycles are taken from the timer */
+    int fallback;
+};
+
+/*
+ * Workloads
+ */
+enum bench_workload {
+    BENCH_UNIFORM,
+    BENCH_SEQUENTIAL,
+    BENCH_ZIPF,
+    BENCH_TRACE,
+    BENCH_MIXED,
+};
+
+static const char *bench_workloads[] = {
+    "uniform", "sequential", "zipf", "trace", "mixed", NULL
+};
+
+/*
+ * Configuration of a run
+ */
+struct bench_config {
+    enum bench_engine engine;
+    const char *rib;
+    const char *trace;
+    enum bench_workload workload;
+    /* Exponent of the Zipf distribution */
+    double zipf;
+    /* Percentage of the updates to the lookups in the mixed workload */
+    double update;
+    uint64_t nlookups;
+    int nthreads;
+    /* Interval of the latency samples */
+    int sample;
+    int json;
+    int header;
+};
+
+/*
+ * Thread of the benchmark
+ */
+struct bench_thread {
+    pthread_t th;
+    int id;
+    const struct bench_config *cfg;
+    struct path_compressed_trie *trie;
+    pthread_barrier_t *barrier;
+
+    /* Lookup of the engine */
+    void *(*lookup)(void *, uint32_t);
+    void *ctx;
+
+    /* Keys looked up, and the prefixes withdrawn and announced back */
+    uint32_t *keys;
+    const struct path_compressed_trie_prefix_entry *entries;
+    size_t nentries;
+
+    /* Results */
+    uint64_t *samples;
+    size_t nsamples;
+    uint64_t updates;
+    uint64_t result;
+    struct timespec start;
+    struct timespec end;
+    struct bench_counters counters;
+};
+
+/* Nanoseconds per tick of the timer, and the overhead of a sample */
+static double bench_ns_per_tick = 1.0;
+static uint64_t bench_overhead;
+
+/*
+ * Xorshift of a thread
+ */
+static __inline__ uint32_t
+_xorshift(uint32_t *s)
+{
+    *s ^= *s << 13;
+    *s ^= *s >> 17;
+    *s ^= *s << 5;
+
+    return *s;
+}
+
+/*
+ * Read the timer: the time-stamp counter on x86, and the monotonic clock in
+ * nanoseconds otherwise
+ */
+static __inline__ uint64_t
+_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo;
+    uint32_t hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a"(lo), "=d"(hi));
+
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+static __inline__ double
+_elapsed(const struct timespec *t0, const struct timespec *t1)
+{
+    return (double)(t1->tv_sec - t0->tv_sec)
+        + (double)(t1->tv_nsec - t0->tv_nsec) / 1000000000.0;
+}
+
+/*
+ * Calibrate the timer against the monotonic clock, and measure the overhead
+ * of reading it twice
+ */
+static void
+_calibrate(void)
+{
+    struct timespec t0;
+    struct timespec t1;
+    struct timespec req;
+    uint64_t c0;
+    uint64_t c1;
+    uint64_t d;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    c0 = _ticks();
+    req.tv_sec = 0;
+    req.tv_nsec = 100000000;
+    nanosleep(&req, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    c1 = _ticks();
+    if ( c1 > c0 ) {
+        bench_ns_per_tick = _elapsed(&t0, &t1) * 1000000000.0 / (c1 - c0);
+    }
+
+    bench_overhead = UINT64_MAX;
+    for ( i = 0; i < 1000; i++ ) {
+        c0 = _ticks();
+        c1 = _ticks();
+        d = c1 - c0;
+        if ( d < bench_overhead ) {
+            bench_overhead = d;
+        }
+    }
+}
+
+/*
+ * Pin the calling thread to a processor
+ */
+static void
+_pin(int id)
+{
+#ifdef __linux__
+    cpu_set_t set;
+    long ncpus;
+
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if ( ncpus <= 0 ) {
+        return;
+    }
+    CPU_ZERO(&set);
+    CPU_SET(id % ncpus, &set);
+    (void)pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)id;
+#endif
+}
+
+#ifdef __linux__
+/*
+ * Open a counter of the calling thread in the user space
+ */
+static int
+_counter_open(uint32_t type, uint64_t config)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED
+        | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+/* Configuration of the read misses of a cache */
+#define HW_CACHE_MISSES(c)                                              \
+    ((c) | (PERF_COUNT_HW_CACHE_OP_READ << 8)                           \
+     | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+#endif
+
+/*
+ * Open and start the counters of the calling thread
+ */
+static void
+_counters_start(struct bench_counters *c)
+{
+    int i;
+
+    for ( i = 0; i < BENCH_NCOUNTERS; i++ ) {
+        c->fd[i] = -1;
+        c->value[i] = -1;
+    }
+#ifdef __linux__
+    c->fd[BENCH_CYCLES] = _counter_open(PERF_TYPE_HARDWARE,
+                                        PERF_COUNT_HW_CPU_CYCLES);
+    c->fd[BENCH_INSTRUCTIONS] = _counter_open(PERF_TYPE_HARDWARE,
+                                              PERF_COUNT_HW_INSTRUCTIONS);
+    c->fd[BENCH_L1D_MISSES]
+        = _counter_open(PERF_TYPE_HW_CACHE,
+                        HW_CACHE_MISSES(PERF_COUNT_HW_CACHE_L1D));
+    c->fd[BENCH_LLC_MISSES]
+        = _counter_open(PERF_TYPE_HW_CACHE,
+                        HW_CACHE_MISSES(PERF_COUNT_HW_CACHE_LL));
+    c->fd[BENCH_DTLB_MISSES]
+        = _counter_open(PERF_TYPE_HW_CACHE,
+                        HW_CACHE_MISSES(PERF_COUNT_HW_CACHE_DTLB));
+    c->fd[BENCH_BRANCH_MISSES] = _counter_open(PERF_TYPE_HARDWARE,
+                                               PERF_COUNT_HW_BRANCH_MISSES);
+    for ( i = 0; i < BENCH_NCOUNTERS; i++ ) {
+        if ( c->fd[i] >= 0 ) {
+            ioctl(c->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(c->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+    c->fallback = 0;
+    c->tsc = _ticks();
+}
+
+/*
+ * Stop and read the counters; the counts are scaled when the counters are
+ * multiplexed, and the cycles are taken from the timer if not available
+ */
+static void
+_counters_stop(struct bench_counters *c)
+{
+    uint64_t tsc;
+    int i;
+#ifdef __linux__
+    uint64_t v[3];
+#endif
+
+    tsc = _ticks() - c->tsc;
+    for ( i = 0; i < BENCH_NCOUNTERS; i++ ) {
+        if ( c->fd[i] < 0 ) {
+            continue;
+        }
+#ifdef __linux__
+        ioctl(c->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+        if ( sizeof(v) == read(c->fd[i], v, sizeof(v)) && v[2] > 0 ) {
+            c->value[i] = (double)v[0] * v[1] / v[2];
+        }
+        close(c->fd[i]);
+#endif
+    }
+    if ( c->value[BENCH_CYCLES] < 0 ) {
+        /* Software fallback */
+        c->value[BENCH_CYCLES] = tsc;
+        c->fallback = 1;
+    }
+}
+
+/*
+ * Lookups of the engines
+ */
+static void *
+_lookup_pctrie(void *ctx, uint32_t key)
+{
+    return path_compressed_trie_lookup(ctx, key);
+}
+
+static void *
+_lookup_cache(void *ctx, uint32_t key)
+{
+    return path_compressed_trie_cache_lookup(ctx, key);
+}
+
+static void *
+_lookup_snapshot(void *ctx, uint32_t key)
+{
+    return path_compressed_trie_snapshot_lookup(ctx, key);
+}
+
+static void *
+_lookup_lc(void *ctx, uint32_t key)
+{
+    return path_compressed_trie_lc_lookup(ctx, key);
+}
+
+static void *
+_lookup_interval(void *ctx, uint32_t key)
+{
+    return path_compressed_trie_interval_lookup(ctx, key);
+}
+
+static void *
+_lookup_poptrie(void *ctx, uint32_t key)
+{
+    return path_compressed_trie_poptrie_lookup(ctx, key);
+}
+
+static void *
+_lookup_radix(void *ctx, uint32_t key)
+{
+    return radix_tree_lookup(ctx, key);
+}
+
+/*
+ * Read the addresses to replay, in the dotted-quad or the decimal notation,
+ * one per line
+ */
+static uint32_t *
+_read_trace(const char *path, size_t *n)
+{
+    FILE *fp;
+    char buf[256];
+    unsigned int a[4];
+    unsigned long v;
+    uint32_t *addrs;
+    uint32_t *na;
+    size_t size;
+
+    fp = fopen(path, "r");
+    if ( NULL == fp ) {
+        return NULL;
+    }
+    size = 1 << 16;
+    addrs = malloc(sizeof(uint32_t) * size);
+    if ( NULL == addrs ) {
+        fclose(fp);
+        return NULL;
+    }
+    *n = 0;
+    while ( fgets(buf, sizeof(buf), fp) ) {
+        if ( 4 == sscanf(buf, "%u.%u.%u.%u", &a[0], &a[1], &a[2], &a[3]) ) {
+            v = ((unsigned long)a[0] << 24) | (a[1] << 16) | (a[2] << 8)
+                | a[3];
+        } else if ( 1 != sscanf(buf, "%lu", &v) ) {
+            continue;
+        }
+        if ( *n == size ) {
+            size *= 2;
+            na = realloc(addrs, sizeof(uint32_t) * size);
+            if ( NULL == na ) {
+                free(addrs);
+                fclose(fp);
+                return NULL;
+            }
+            addrs = na;
+        }
+        addrs[(*n)++] = (uint32_t)v;
+    }
+    fclose(fp);
+
+    return addrs;
+}
+
+/*
+ * Generate the keys of the threads for the workload
+ */
+static int
+_gen_keys(const struct bench_config *cfg, struct bench_thread *threads)
+{
+    uint32_t *trace;
+    uint32_t *dests;
+    double *cdf;
+    double u;
+    size_t ntrace;
+    size_t lo;
+    size_t hi;
+    size_t mid;
+    size_t i;
+    uint32_t s;
+    int t;
+
+    trace = NULL;
+    ntrace = 0;
+    if ( BENCH_TRACE == cfg->workload ) {
+        trace = _read_trace(cfg->trace, &ntrace);
+        if ( NULL == trace || 0 == ntrace ) {
+            fprintf(stderr, "Cannot read the trace: %s\n", cfg->trace);
+            free(trace);
+            return -1;
+        }
+    }
+    dests = NULL;
+    cdf = NULL;
+    if ( BENCH_ZIPF == cfg->workload ) {
+        /* Ranks of the destinations; the rank i is chosen with the
+           probability proportional to 1 / i^s */
+        dests = malloc(sizeof(uint32_t) * BENCH_KEYS);
+        cdf = malloc(sizeof(double) * BENCH_KEYS);
+        if ( NULL == dests || NULL == cdf ) {
+            free(dests);
+            free(cdf);
+            return -1;
+        }
+        s = 88675123;
+        u = 0;
+        for ( i = 0; i < BENCH_KEYS; i++ ) {
+            dests[i] = _xorshift(&s);
+            u += pow((double)(i + 1), -cfg->zipf);
+            cdf[i] = u;
+        }
+    }
+
+    for ( t = 0; t < cfg->nthreads; t++ ) {
+        threads[t].keys = malloc(sizeof(uint32_t) * BENCH_KEYS);
+        if ( NULL == threads[t].keys ) {
+            return -1;
+        }
+        s = 2463534242U + t * 7919;
+        for ( i = 0; i < BENCH_KEYS; i++ ) {
+            switch ( cfg->workload ) {
+            case BENCH_SEQUENTIAL:
+                /* Ascending over the whole address space */
+                threads[t].keys[i] = (uint32_t)((((uint64_t)t << 32)
+                                                 / cfg->nthreads)
+                                                + (i << 12));
+                break;
+            case BENCH_ZIPF:
+                u = (double)_xorshift(&s) / 4294967296.0 * cdf[BENCH_KEYS - 1];
+                lo = 0;
+                hi = BENCH_KEYS - 1;
+                while ( lo < hi ) {
+                    mid = (lo + hi) / 2;
+                    if ( cdf[mid] < u ) {
+                        lo = mid + 1;
+                    } else {
+                        hi = mid;
+                    }
+                }
+                threads[t].keys[i] = dests[lo];
+                break;
+            case BENCH_TRACE:
+                threads[t].keys[i]
+                    = trace[(ntrace / cfg->nthreads * t + i) % ntrace];
+                break;
+            default:
+                threads[t].keys[i] = _xorshift(&s);
+            }
+        }
+    }
+    free(trace);
+    free(dests);
+    free(cdf);
+
+    return 0;
+}
+
+/*
+ * Withdraw a prefix and announce it back
+ */
+static void
+_update(struct bench_thread *bt, uint32_t *s)
+{
+    const struct path_compressed_trie_prefix_entry *e;
+
+    e = &bt->entries[_xorshift(s) % bt->nentries];
+    if ( NULL != path_compressed_trie_delete(bt->trie, e->key,
+                                             e->prefixlen) ) {
+        (void)path_compressed_trie_add(bt->trie, e->key, e->prefixlen,
+                                       e->data);
+        bt->updates += 2;
+    }
+}
+
+/*
+ * Run the lookups of a thread; one lookup of every sample interval is timed
+ */
+static void *
+_run(void *arg)
+{
+    struct bench_thread *bt;
+    const struct bench_config *cfg;
+    struct path_compressed_trie_reader *reader;
+    uint64_t i;
+    uint64_t c0;
+    uint64_t c1;
+    uint64_t res;
+    uint32_t threshold;
+    uint32_t s;
+    int pending;
+    int j;
+
+    bt = arg;
+    cfg = bt->cfg;
+    _pin(bt->id);
+    if ( BENCH_CACHE == cfg->engine ) {
+        /* Cache of the thread */
+        bt->ctx = path_compressed_trie_cache_init(bt->trie,
+                                                  BENCH_CACHE_ENTRIES);
+        if ( NULL == bt->ctx ) {
+            return NULL;
+        }
+    }
+
+    reader = NULL;
+    threshold = 0;
+    if ( BENCH_MIXED == cfg->workload ) {
+        reader = path_compressed_trie_reader_register(bt->trie);
+        if ( NULL == reader ) {
+            return NULL;
+        }
+        threshold = (uint32_t)(cfg->update / 100 * 4294967295.0);
+    }
+    s = 123456789 + bt->id * 104729;
+    res = 0;
+    bt->nsamples = 0;
+    bt->updates = 0;
+
+    pthread_barrier_wait(bt->barrier);
+    _counters_start(&bt->counters);
+    clock_gettime(CLOCK_MONOTONIC, &bt->start);
+    for ( i = 0; i < cfg->nlookups; i += cfg->sample ) {
+        if ( NULL != reader ) {
+            path_compressed_trie_reader_enter(bt->trie, reader);
+        }
+        c0 = _ticks();
+        res += (uint64_t)bt->lookup(bt->ctx, bt->keys[i & (BENCH_KEYS - 1)]);
+        c1 = _ticks();
+        bt->samples[bt->nsamples++] = c1 - c0;
+        for ( j = 1; j < cfg->sample; j++ ) {
+            res += (uint64_t)bt->lookup(bt->ctx,
+                                        bt->keys[(i + j) & (BENCH_KEYS - 1)]);
+        }
+        if ( NULL != reader ) {
+            path_compressed_trie_reader_exit(reader);
+
+            /* The updates in the interval outside the read-side section */
+            pending = 0;
+            for ( j = 0; j < cfg->sample; j++ ) {
+                pending += (_xorshift(&s) < threshold);
+            }
+            while ( pending-- > 0 ) {
+                _update(bt, &s);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &bt->end);
+    _counters_stop(&bt->counters);
+
+    if ( NULL != reader ) {
+        path_compressed_trie_reader_unregister(bt->trie, reader);
+    }
+    if ( BENCH_CACHE == cfg->engine ) {
+        path_compressed_trie_cache_release(bt->ctx);
+    }
+    bt->result = res;
+
+    return NULL;
+}
+
+static int
+_u64_cmp(const void *a, const void *b)
+{
+    uint64_t x;
+    uint64_t y;
+
+    x = *(const uint64_t *)a;
+    y = *(const uint64_t *)b;
+
+    return x < y ? -1 : (x > y);
+}
+
+/*
+ * Latency of the percentile in nanoseconds
+ */
+static double
+_percentile(const uint64_t *samples, size_t n, double p)
+{
+    size_t i;
+    uint64_t t;
+
+    i = (size_t)(p / 100 * (n - 1));
+    t = samples[i] > bench_overhead ? samples[i] - bench_overhead : 0;
+
+    return t * bench_ns_per_tick;
+}
+
+/*
+ * Print the result of the run
+ */
+static void
+_report(const struct bench_config *cfg, struct bench_thread *threads)
+{
+    struct timespec start;
+    struct timespec end;
+    uint64_t *samples;
+    uint64_t updates;
+    uint64_t lookups;
+    size_t n;
+    double sec;
+    double mlps;
+    double p[6];
+    double counters[BENCH_NCOUNTERS];
+    int t;
+    int i;
+
+    start = threads[0].start;
+    end = threads[0].end;
+    n = 0;
+    updates = 0;
+    for ( t = 0; t < cfg->nthreads; t++ ) {
+        if ( _elapsed(&threads[t].start, &start) > 0 ) {
+            start = threads[t].start;
+        }
+        if ( _elapsed(&end, &threads[t].end) > 0 ) {
+            end = threads[t].end;
+        }
+        n += threads[t].nsamples;
+        updates += threads[t].updates;
+    }
+    samples = malloc(sizeof(uint64_t) * (n + 1));
+    if ( NULL == samples ) {
+        return;
+    }
+    n = 0;
+    for ( t = 0; t < cfg->nthreads; t++ ) {
+        memcpy(samples + n, threads[t].samples,
+               sizeof(uint64_t) * threads[t].nsamples);
+        n += threads[t].nsamples;
+    }
+    qsort(samples, n, sizeof(uint64_t), _u64_cmp);
+    p[0] = _percentile(samples, n, 50);
+    p[1] = _percentile(samples, n, 90);
+    p[2] = _percentile(samples, n, 99);
+    p[3] = _percentile(samples, n, 99.9);
+    p[4] = _percentile(samples, n, 100);
+    free(samples);
+
+    lookups = ((cfg->nlookups + cfg->sample - 1) / cfg->sample) * cfg->sample
+        * cfg->nthreads;
+    sec = _elapsed(&start, &end);
+    mlps = lookups / sec / 1000000;
+    /* Mean over the threads running in parallel */
+    p[5] = sec * 1000000000.0 * cfg->nthreads / lookups;
+
+    /* Counters per lookup summed over the threads (negative if any of the
+       threads could not count) */
+    for ( i = 0; i < BENCH_NCOUNTERS; i++ ) {
+        counters[i] = 0;
+        for ( t = 0; t < cfg->nthreads; t++ ) {
+            if ( threads[t].counters.value[i] < 0 ) {
+                counters[i] = -1;
+                break;
+            }
+            counters[i] += threads[t].counters.value[i];
+        }
+        if ( counters[i] >= 0 ) {
+            counters[i] /= lookups;
+        }
+    }
+
+    if ( cfg->json ) {
+        printf("{\"engine\": \"%s\", \"workload\": \"%s\", \"threads\": %d, "
+               "\"lookups\": %llu, \"updates\": %llu, \"seconds\": %.6lf, "
+               "\"mlps\": %.3lf, \"ns_mean\": %.2lf, \"ns_p50\": %.1lf, "
+               "\"ns_p90\": %.1lf, \"ns_p99\": %.1lf, \"ns_p999\": %.1lf, "
+               "\"ns_max\": %.1lf, \"counters\": \"%s\"",
+               bench_engines[cfg->engine], bench_workloads[cfg->workload],
+               cfg->nthreads, (unsigned long long)lookups,
+               (unsigned long long)updates, sec, mlps, p[5], p[0], p[1], p[2],
+               p[3], p[4], threads[0].counters.fallback ? "tsc" : "perf");
+        for ( i = 0; i < BENCH_NCOUNTERS; i++ ) {
+            if ( counters[i] < 0 ) {
+                printf(", \"%s\": null", bench_counters[i]);
+            } else {
+                printf(", \"%s\": %.3lf", bench_counters[i], counters[i]);
+            }
+        }
+        printf("}\n");
+    } else {
+        if ( cfg->header ) {
+            printf("engine,workload,threads,lookups,updates,seconds,mlps,"
+                   "ns_mean,ns_p50,ns_p90,ns_p99,ns_p999,ns_max,counters");
+            for ( i = 0; i < BENCH_NCOUNTERS; i++ ) {
+                printf(",%s", bench_counters[i]);
+            }
+            printf("\n");
+        }
+        printf("%s,%s,%d,%llu,%llu,%.6lf,%.3lf,%.2lf,%.1lf,%.1lf,%.1lf,%.1lf,"
+               "%.1lf,%s", bench_engines[cfg->engine],
+               bench_workloads[cfg->workload], cfg->nthreads,
+               (unsigned long long)lookups, (unsigned long long)updates, sec,
+               mlps, p[5], p[0], p[1], p[2], p[3], p[4],
+               threads[0].counters.fallback ? "tsc" : "perf");
+        for ( i = 0; i < BENCH_NCOUNTERS; i++ ) {
+            if ( counters[i] < 0 ) {
+                printf(",");
+            } else {
+                printf(",%.3lf", counters[i]);
+            }
+        }
+        printf("\n");
+    }
+}
+
+static void
+_usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-e pctrie|front16|front24|cache|snapshot|lc|"
+            "interval|poptrie|radix] [-r rib] "
+            "[-w uniform|sequential|zipf|trace|mixed] [-t trace] "
+            "[-z exponent] [-u percent] [-n lookups] [-p threads] "
+            "[-s interval] [-o csv|json] [-H]\n", prog);
+}
+
+/*
+ * Main routine
+ */
+int
+main(int argc, char *argv[])
+{
+    struct bench_config cfg;
+    struct bench_thread *threads;
+    struct path_compressed_trie *trie;
+    struct path_compressed_trie_prefix_entry *entries;
+    struct path_compressed_trie_snapshot *snap;
+    struct path_compressed_trie_lc *lc;
+    struct path_compressed_trie_interval *im;
+    struct path_compressed_trie_poptrie *pt;
+    struct radix_tree *radix;
+    void *(*lookup)(void *, uint32_t);
+    void *ctx;
+    pthread_barrier_t barrier;
+    size_t n;
+    size_t i;
+    int flags;
+    int opt;
+    int t;
+
+    /* Defaults */
+    cfg.engine = BENCH_PCTRIE;
+    cfg.rib = "tests/linx-rib.20141217.0000-p46.txt";
+    cfg.trace = NULL;
+    cfg.workload = BENCH_UNIFORM;
+    cfg.zipf = 1.0;
+    cfg.update = 1.0;
+    cfg.nlookups = 10000000;
+    cfg.nthreads = 1;
+    cfg.sample = BENCH_SAMPLE;
+    cfg.json = 0;
+    cfg.header = 0;
+
+    while ( -1 != (opt = getopt(argc, argv, "e:r:w:t:z:u:n:p:s:o:H")) ) {
+        switch ( opt ) {
+        case 'e':
+            for ( t = 0; NULL != bench_engines[t]; t++ ) {
+                if ( 0 == strcmp(optarg, bench_engines[t]) ) {
+                    break;
+                }
+            }
+            if ( NULL == bench_engines[t] ) {
+                _usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            cfg.engine = t;
+            break;
+        case 'r':
+            cfg.rib = optarg;
+            break;
+        case 'w':
+            for ( t = 0; NULL != bench_workloads[t]; t++ ) {
+                if ( 0 == strcmp(optarg, bench_workloads[t]) ) {
+                    break;
+                }
+            }
+            if ( NULL == bench_workloads[t] ) {
+                _usage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            cfg.workload = t;
+            break;
+        case 't':
+            cfg.trace = optarg;
+            cfg.workload = BENCH_TRACE;
+            break;
+        case 'z':
+            cfg.zipf = atof(optarg);
+            break;
+        case 'u':
+            cfg.update = atof(optarg);
+            break;
+        case 'n':
+            cfg.nlookups = strtoull(optarg, NULL, 10);
+            break;
+        case 'p':
+            cfg.nthreads = atoi(optarg);
+            break;
+        case 's':
+            cfg.sample = atoi(optarg);
+            break;
+        case 'o':
+            cfg.json = (0 == strcmp(optarg, "json"));
+            break;
+        case 'H':
+            cfg.header = 1;
+            break;
+        default:
+            _usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if ( cfg.nthreads < 1 || cfg.sample < 1 || 0 == cfg.nlookups
+         || (BENCH_TRACE == cfg.workload && NULL == cfg.trace) ) {
+        _usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if ( BENCH_MIXED == cfg.workload && cfg.engine > BENCH_CACHE ) {
+        fprintf(stderr, "The mixed workload needs an engine on the trie\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Load the RIB; the updates by the threads need the concurrent writers */
+    entries = path_compressed_trie_rib_parse(cfg.rib, &n, 0);
+    if ( NULL == entries || 0 == n ) {
+        fprintf(stderr, "Cannot read the RIB: %s\n", cfg.rib);
+        return EXIT_FAILURE;
+    }
+    flags = 0;
+    if ( BENCH_FRONT16 == cfg.engine ) {
+        flags |= PATH_COMPRESSED_TRIE_FRONT_16;
+    } else if ( BENCH_FRONT24 == cfg.engine ) {
+        flags |= PATH_COMPRESSED_TRIE_FRONT_24;
+    }
+    if ( BENCH_MIXED == cfg.workload && cfg.nthreads > 1 ) {
+        flags |= PATH_COMPRESSED_TRIE_CONCURRENT;
+    }
+    trie = path_compressed_trie_init_flags(NULL, flags);
+    if ( NULL == trie || path_compressed_trie_build(trie, entries, n) < 0 ) {
+        fprintf(stderr, "Cannot build the trie\n");
+        return EXIT_FAILURE;
+    }
+
+    /* Engine; the cache is created by each thread */
+    snap = NULL;
+    lc = NULL;
+    im = NULL;
+    pt = NULL;
+    radix = NULL;
+    lookup = _lookup_pctrie;
+    ctx = trie;
+    switch ( cfg.engine ) {
+    case BENCH_CACHE:
+        lookup = _lookup_cache;
+        break;
+    case BENCH_SNAPSHOT:
+        snap = path_compressed_trie_freeze(trie);
+        lookup = _lookup_snapshot;
+        ctx = snap;
+        break;
+    case BENCH_LC:
+        lc = path_compressed_trie_lc_build(trie, PATH_COMPRESSED_TRIE_LC_FILL);
+        lookup = _lookup_lc;
+        ctx = lc;
+        break;
+    case BENCH_INTERVAL:
+        im = path_compressed_trie_interval_build(trie);
+        lookup = _lookup_interval;
+        ctx = im;
+        break;
+    case BENCH_POPTRIE:
+        pt = path_compressed_trie_poptrie_build(trie);
+        lookup = _lookup_poptrie;
+        ctx = pt;
+        break;
+    case BENCH_RADIX:
+        radix = radix_tree_init(NULL);
+        if ( NULL != radix ) {
+            for ( i = 0; i < n; i++ ) {
+                (void)radix_tree_add(radix, entries[i].key,
+                                     entries[i].prefixlen, entries[i].data);
+            }
+        }
+        lookup = _lookup_radix;
+        ctx = radix;
+        break;
+    default:
+        break;
+    }
+    if ( NULL == ctx ) {
+        fprintf(stderr, "Cannot build the engine\n");
+        return EXIT_FAILURE;
+    }
+
+    threads = calloc(cfg.nthreads, sizeof(struct bench_thread));
+    if ( NULL == threads ) {
+        return EXIT_FAILURE;
+    }
+    if ( _gen_keys(&cfg, threads) < 0 ) {
+        return EXIT_FAILURE;
+    }
+    _calibrate();
+
+    pthread_barrier_init(&barrier, NULL, cfg.nthreads);
+    for ( t = 0; t < cfg.nthreads; t++ ) {
+        threads[t].id = t;
+        threads[t].cfg = &cfg;
+        threads[t].trie = trie;
+        threads[t].barrier = &barrier;
+        threads[t].lookup = lookup;
+        threads[t].ctx = ctx;
+        threads[t].entries = entries;
+        threads[t].nentries = n;
+        threads[t].samples = malloc(sizeof(uint64_t)
+                                    * (cfg.nlookups / cfg.sample + 1));
+        if ( NULL == threads[t].samples ) {
+            return EXIT_FAILURE;
+        }
+    }
+    for ( t = 1; t < cfg.nthreads; t++ ) {
+        if ( 0 != pthread_create(&threads[t].th, NULL, _run, &threads[t]) ) {
+            return EXIT_FAILURE;
+        }
+    }
+    _run(&threads[0]);
+    for ( t = 1; t < cfg.nthreads; t++ ) {
+        pthread_join(threads[t].th, NULL);
+    }
+    pthread_barrier_destroy(&barrier);
+
+    _report(&cfg, threads);
+
+    for ( t = 0; t < cfg.nthreads; t++ ) {
+        free(threads[t].keys);
+        free(threads[t].samples);
+    }
+    free(threads);
+    if ( NULL != snap ) {
+        path_compressed_trie_snapshot_release(snap);
+    }
+    if ( NULL != lc ) {
+        path_compressed_trie_lc_release(lc);
+    }
+    if ( NULL != im ) {
+        path_compressed_trie_interval_release(im);
+    }
+    if ( NULL != pt ) {
+        path_compressed_trie_poptrie_release(pt);
+    }
+    if ( NULL != radix ) {
+        radix_tree_release(radix);
+    }
+    path_compressed_trie_release(trie);
+    free(entries);
+
+    return EXIT_SUCCESS;
+}
+
+/*
+ * Local variables:
+ * tab-width: 4
+ * c-basic-offset: 4
+ * End:
+ * vim600: sw=4 ts=4 fdm=marker
+ * vim<600: sw=4 ts=4
+ */